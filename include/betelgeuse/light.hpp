@@ -43,18 +43,57 @@ namespace betelgeuse
             /// Attenuation parameter.
             macs::types::named<float> atten_par;
 
+            /**
+             * True if this light does not move. The shadows cast by static
+             * instances are then kept across frames and only the dynamic
+             * instances' ones are evaluated again.
+             *
+             * @sa instance::is_static
+             */
+            bool is_static;
+
 
             friend class scene;
 
         private:
+            /// Number of floats describing all parameters (see state()).
+            enum { state_size = 13 };
+
+            /**
+             * Packs all parameters into an array: position, direction,
+             * color, distribution exponent, cutoff angle cosine and
+             * attenuation parameter.
+             */
+            void state(float *dst) const;
+
+
             /// Shading render object.
             macs::render *shade;
 
+            /// Parameters the current shading results were computed with.
+            float rendered_state[state_size];
+            /// True iff <tt>rendered_state</tt> is valid.
+            bool rendered;
+
             /// Attenuation function source code.
             const char *atten_func;
 
-            /// Shadow map.
-            macs::texture shadow_map;
+            /// Shadow map (NULL if shadows are interleaved with the shading).
+            macs::texture *shadow_map;
+            /// Reduced resolution shadow map (NULL at full resolution).
+            macs::texture *shadow_lowres;
+            /**
+             * Shadows cast by static instances (at the shadow resolution;
+             * NULL unless this light is static).
+             */
+            macs::texture *static_shadow;
+            /// True iff <tt>static_shadow</tt> is valid for all pixels.
+            bool static_valid;
+
+            /// Contribution to the shading (NULL without shading cache).
+            macs::texture *contribution;
+            /// True iff <tt>contribution</tt> is up to date.
+            bool contribution_valid;
     };
 }
 
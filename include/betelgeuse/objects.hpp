@@ -8,7 +8,9 @@
 #ifndef BETELGEUSE_OBJECTS_HPP
 #define BETELGEUSE_OBJECTS_HPP
 
+#include <cstddef>
 #include <list>
+#include <vector>
 
 #include <macs/macs.hpp>
 
@@ -28,6 +30,23 @@ namespace betelgeuse
     class instance
     {
         public:
+            /**
+             * Structure of a transformation, from the most specific to the
+             * most general one. The inverse and normal matrices are computed
+             * with the cheapest formula that is exact for the structure.
+             */
+            enum transform_structure
+            {
+                /// Rotation and translation only
+                rigid,
+                /// Rotation, translation and uniform scaling
+                uniform_scale,
+                /// Any transformation with (0, 0, 0, 1) as the last row
+                affine,
+                /// Anything (general 4x4 inversion)
+                general
+            };
+
             /// Basic constructor.
             instance(object *obj);
             /// Basic deconstructor.
@@ -38,34 +57,227 @@ namespace betelgeuse
              * matrix, you have to call this function afterwards to carry out
              * the actual transformation.
              *
+             * For an instance without parent and children, this computes the
+             * world, inverse and normal matrices right away. Otherwise, it
+             * just marks the instance so its subtree is recomputed by the
+             * next <tt>update_world()</tt>.
+             *
+             * The inverse is computed according to <tt>structure</tt>
+             * (combined with the parents' structures).
+             *
              * @sa instance::trans
              */
             void update_transformation(void);
 
             /**
-             * Transformation matrix.
+             * Sets the transformation to the identity (and its structure to
+             * <tt>rigid</tt>).
+             */
+            void reset_transformation(void)
+            { trans = macs::types::mat4(); structure = rigid; }
+
+            /// Sets the transformation together with its structure.
+            void set_transformation(const macs::types::mat4 &m, transform_structure s = general)
+            { trans = m; structure = s; }
+
+            /// Translates the transformation (keeps its structure).
+            void translate(const macs::types::vec3 &v)
+            { trans.translate(v); }
+
+            /// Rotates the transformation (keeps its structure).
+            void rotate(float angle, const macs::types::vec3 &axis)
+            { trans.rotate(angle, axis); }
+
+            /**
+             * Scales the transformation. A uniform scale makes a rigid
+             * transformation <tt>uniform_scale</tt>, any other one makes
+             * it at least <tt>affine</tt>.
+             */
+            void scale(const macs::types::vec3 &v);
+
+            /**
+             * Attaches this instance to a parent instance. Its world
+             * transformation then is the parent's world transformation
+             * times its own (local) one. Passing NULL detaches it again.
+             * The parent must not be this instance or one of its
+             * descendants.
+             */
+            void set_parent(instance *parent_inst);
+
+            /// Returns the parent instance (NULL if there is none).
+            instance *get_parent(void) const
+            { return parent; }
+
+            /**
+             * Brings the world, inverse and normal matrices of the hierarchy
+             * this instance belongs to up to date. Only the subtrees below
+             * instances marked by <tt>update_transformation()</tt> (or moved
+             * by <tt>set_parent()</tt>) are recomputed, in depth-first
+             * order. scene::render() does this for all instances it draws.
+             */
+            void update_world(void);
+
+            /**
+             * Sets the transformations of several instances at once. This is
+             * equivalent to setting <tt>trans</tt> and calling
+             * <tt>update_transformation()</tt> for every instance, but the
+             * inverse and normal matrices are computed for four instances at
+             * a time in a structure of arrays layout (which the compiler can
+             * vectorize), optionally spread across several threads. The
+             * result may differ from <tt>update_transformation()</tt> in
+             * rounding. The structure of the instances is set to
+             * <tt>general</tt>.
+             *
+             * @param insts Instances to be updated.
+             * @param trans New transformation of every instance.
+             * @param count Number of instances.
+             * @param threads Maximum number of threads (0: one per hardware
+             *                thread). Every thread gets at least
+             *                <tt>batch_per_thread</tt> instances.
+             */
+            static void update_transformations(instance *const *insts, const macs::types::mat4 *trans, size_t count, int threads = 1);
+
+            /**
+             * Sets the transformations of several instances at once from
+             * their components. The transformation becomes T * R * S, i.e.,
+             * scaled first, then rotated and translated last. The inverse and
+             * normal matrices are derived from the components directly
+             * instead of by a general inversion. The structure of the
+             * instances is set according to their scale.
+             *
+             * @param insts Instances to be updated.
+             * @param translation Translation of every instance.
+             * @param rotation Rotation of every instance as a unit
+             *                 quaternion (XYZ: axis * sin(angle / 2), W:
+             *                 cos(angle / 2); same sense as
+             *                 <tt>mat4::rotate()</tt>).
+             * @param scale Scale of every instance (no component may be 0).
+             * @param count Number of instances.
+             * @param threads Maximum number of threads (see above).
+             */
+            static void update_transformations(instance *const *insts, const macs::types::vec3 *translation,
+                                               const macs::types::vec4 *rotation, const macs::types::vec3 *scale,
+                                               size_t count, int threads = 1);
+
+            /// Minimum number of instances a batch update thread handles.
+            enum { batch_per_thread = 1024 };
+
+            /// Returns the world transformation (as of the last update).
+            const macs::types::mat4 &world_transformation(void) const
+            { return world; }
+
+            /// Returns the inverse world transformation (as of the last
+            /// update).
+            const macs::types::mat4 &inverse_transformation(void) const
+            { return inv_trans; }
+
+            /// Returns the normal matrix (as of the last update).
+            const macs::types::mat3 &normal_matrix(void) const
+            { return normal; }
+
+            /**
+             * Transformation matrix (relative to the parent, if any).
              *
              * @sa void instance::update_transformation(void)
              */
             macs::types::mat4 trans;
 
+            /**
+             * Structure of <tt>trans</tt>. It is kept up to date by
+             * <tt>reset_transformation()</tt>, <tt>set_transformation()</tt>,
+             * <tt>translate()</tt>, <tt>rotate()</tt> and <tt>scale()</tt>.
+             * If you write to <tt>trans</tt> in any other way, you have to
+             * make sure it still describes the result. It starts out as
+             * <tt>general</tt>, which is always correct.
+             */
+            transform_structure structure;
+
             /// Material assigned to this instance.
             material mat;
 
+            /**
+             * Index of a material registered with the scene this instance is
+             * rendered in. If this is -1 (the default), <tt>mat</tt> is used
+             * instead. Rendering an instance whose index has not been
+             * registered throws macs::exc::inv_index.
+             *
+             * @sa int scene::add_material(const material &mat)
+             */
+            int material_index;
+
             /// True if this instance should cast shadows.
             bool cast_shadows;
 
+            /**
+             * True if this instance does not move. Its shadows are cast into
+             * the cached shadow maps of static lights, which have to be
+             * redone completely whenever a static instance changes.
+             *
+             * @sa light::is_static
+             */
+            bool is_static;
+
 
             friend class scene;
 
         private:
-            /// Inverse transformation matrix.
+            /// Batch update of the instances [begin, end) (see above).
+            /// Returns true if any of them is part of a hierarchy (those
+            /// are marked dirty).
+            static bool update_batch(instance *const *insts, const macs::types::mat4 *trans, size_t begin, size_t end);
+            /// @overload
+            static bool update_batch(instance *const *insts, const macs::types::vec3 *translation,
+                                     const macs::types::vec4 *rotation, const macs::types::vec3 *scale,
+                                     size_t begin, size_t end);
+            /// Marks the hierarchies of dirty instances after a batch update.
+            static void mark_pending(instance *const *insts, size_t count);
+            /// Prefetches the members a batch update writes.
+            static void prefetch(const instance *inst);
+
+            /// Recomputes all world matrices from the local one and the
+            /// parent's world transformation.
+            void compute_world(void);
+            /// Marks the world matrices for recomputation.
+            void invalidate_world(void);
+            /// Sets the hierarchy root of this subtree.
+            void set_root(instance *new_root);
+            /// Appends this subtree to the root's depth-first arrays.
+            void flatten(std::vector<instance *> &order, std::vector<size_t> &end);
+
+            /// World transformation matrix.
+            macs::types::mat4 world;
+            /// Structure of the world transformation.
+            transform_structure world_structure;
+            /// Inverse world transformation matrix.
             macs::types::mat4 inv_trans;
             /// Normal matrix (transposed inverse).
             macs::types::mat3 normal;
 
             /// Object class this instance belongs to.
             object *obj;
+
+            /// Parent instance (or NULL).
+            instance *parent;
+            /// Root of the hierarchy (this instance if it has no parent).
+            instance *root;
+            /// Child instances.
+            std::vector<instance *> children;
+            /// True if the local transformation has changed since the last
+            /// world update.
+            bool dirty;
+
+            /**
+             * Hierarchy in depth-first order (only used on the root):
+             * <tt>flat_end[i]</tt> is the index after the last descendant of
+             * <tt>flat[i]</tt>, so a changed subtree is one contiguous range.
+             */
+            std::vector<instance *> flat;
+            /// @sa flat
+            std::vector<size_t> flat_end;
+            /// True if flat and flat_end match the current hierarchy.
+            bool flat_valid;
+            /// True if any instance in the hierarchy is dirty.
+            bool pending;
     };
 
     /**
@@ -81,7 +293,14 @@ namespace betelgeuse
             /**
              * Object type constructor.
              *
-             * @param min_isct Function body to find the first intersection.
+             * @param min_isct Function body to return the parameter of the
+             *                 first intersection of the ray (given by
+             *                 <tt>start</tt> and <tt>dir</tt> <tt>vec3</tt>
+             *                 parameters, the intersection point being
+             *                 <tt>start + parameter * dir</tt>), or a
+             *                 negative value on a miss. All instances are
+             *                 tested in the same fragment, so it must not
+             *                 <tt>discard</tt>.
              * @param isct Function body to return true iff a given line
              *             intersects (given by <tt>start</tt> and <tt>dir</tt>
              *             <tt>vec3</tt> parameters
@@ -109,46 +328,25 @@ namespace betelgeuse
             char *global_src;
             /// Intersection (and basically everything) render object.
             macs::render *isct;
-            /// Current transformation matrix object.
-            macs::types::named<macs::types::mat4> cur_trans;
             /// Current inverse transformation matrix object.
             macs::types::named<macs::types::mat4> cur_inv_trans;
-            /// Current normal matrix object.
-            macs::types::named<macs::types::mat3> cur_normal;
-
-            /// Current material ambient color flat/texture switch.
-            macs::types::named<bool> cur_ambient_flat_tex;
-            /// Current material mirror flat/texture switch.
-            macs::types::named<bool> cur_mirror_flat_tex;
-            /// Current material refraction flat/texture switch.
-            macs::types::named<bool> cur_refract_flat_tex;
-
-            /// Current material ambient color object.
-            macs::types::named<macs::types::vec3> cur_ambient_flat;
-            /// Current material mirror object.
-            macs::types::named<macs::types::vec3> cur_mirror_flat;
-            /// Current material refraction object.
-            macs::types::named<macs::types::vec4> cur_refract_flat;
-
-            /// Current material layer 0 color flat/texture switch.
-            macs::types::named<bool> cur_color0_flat_tex;
-            /// Current material layer 0 roughness/isotropy flat/texture switch.
-            macs::types::named<bool> cur_rp0_flat_tex;
-
-            /// Current material layer 0 color object.
-            macs::types::named<macs::types::vec3> cur_color0_flat;
-            /// Current material layer 0 roughness/isotropy object.
-            macs::types::named<macs::types::vec2> cur_rp0_flat;
-
-            /// Current material layer 1 color flat/texture switch.
-            macs::types::named<bool> cur_color1_flat_tex;
-            /// Current material layer 1 roughness/isotropy flat/texture switch.
-            macs::types::named<bool> cur_rp1_flat_tex;
-
-            /// Current material layer 1 color object.
-            macs::types::named<macs::types::vec3> cur_color1_flat;
-            /// Current material layer 1 roughness/isotropy object.
-            macs::types::named<macs::types::vec2> cur_rp1_flat;
+
+            /// Index of this object type in the scene (starting at 1).
+            macs::types::named<float> type_index;
+            /// Number of instances in the instance table.
+            macs::types::named<float> inst_count;
+            /// Number of rows the instance table has room for.
+            macs::types::named<float> inst_rows;
+            /**
+             * Instance table. Contains the transformation and material of
+             * every instance (one row per instance), so all instances can be
+             * intersected in a single pass.
+             */
+            macs::texture *inst_table;
+            /// Instance table contents.
+            macs::formats::f0123 *inst_data;
+            /// Instance table input slot of the intersection render object.
+            int inst_slot;
 
             /// List of available instances.
             std::list<instance *> insts;
@@ -158,6 +356,9 @@ namespace betelgeuse
 
             /// Shadow rendering object.
             macs::render *shadow;
+            /// Intersection point and stencil input slots of the shadow
+            /// rendering object.
+            int shadow_isct_slot, shadow_stencil_slot;
     };
 }
 
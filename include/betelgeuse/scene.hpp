@@ -7,6 +7,17 @@
 #ifndef BETELGEUSE_SCENE_HPP
 #define BETELGEUSE_SCENE_HPP
 
+#include <cstddef>
+#include <list>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include <macs/macs.hpp>
+
+#include "material.hpp"
+
+
 namespace betelgeuse
 {
     class object;
@@ -20,8 +31,33 @@ namespace betelgeuse
     class scene
     {
         public:
-            /// Basic constructor.
-            scene(void);
+            /// Default maximum resolution of a material texture layer.
+            enum { default_material_res = 1024 };
+
+            /**
+             * Basic constructor.
+             *
+             * Material textures are resampled into the layers of a texture
+             * array. The array grows with the textures registered: it has as
+             * many layers as needed (doubling its size when full) and every
+             * layer is as wide and as high as the largest texture so far.
+             * Smaller textures are stretched to that size; when the array
+             * grows, the existing layers are scaled up from their current
+             * contents. Material textures have to be removed with
+             * <tt>forget_material_texture()</tt> before they are deleted.
+             *
+             * Every layer takes width * height * 16 bytes (RGBA, 32 bit
+             * floats), so the array takes that times its layer count: with
+             * the default resolution, 16 MB per layer once a texture of
+             * 1024x1024 or larger has been registered.
+             *
+             * @param material_textures Number of layers to start with.
+             * @param material_res Maximum resolution of a layer (0:
+             *                     <tt>default_material_res</tt>; never more
+             *                     than the OpenGL limit). Larger textures
+             *                     are downsampled to it.
+             */
+            scene(int material_textures = 1, int material_res = 0);
 
             /// Basic destructor.
             ~scene(void);
@@ -40,14 +76,254 @@ namespace betelgeuse
             /// Adds a light instance.
             void add_light(light *lgt);
 
+            /**
+             * Sets the resolution shadows are evaluated at. With a divisor
+             * greater than 1, the shadow rays are only traced for one
+             * intersection point per divisor x divisor block (the one nearest
+             * to the camera); the full resolution shadow maps are then
+             * reconstructed by a joint bilateral upsampling guided by the
+             * intersection points and surface normals.
+             *
+             * @param divisor Resolution divisor (1 for full, 2 for half, 4
+             *                for quarter resolution).
+             */
+            void set_shadow_resolution(int divisor);
+
+            /**
+             * Enables rendering every light's shadows right before its
+             * shading, into a single shadow map shared by all lights. The
+             * memory used for shadow maps then no longer grows with the
+             * number of lights (except for the static shadows kept by static
+             * lights). In exchange, a light's shadows have to be rendered
+             * again whenever it is shaded; unless the shading cache is in
+             * effect, any light change thus leads to all shadows being
+             * rendered again. The output is the same in both modes.
+             *
+             * @param enable Interleaves shadows and shading iff true.
+             *
+             * @sa void scene::set_shading_cache(size_t max_bytes)
+             */
+            void set_interleaved_shadows(bool enable);
+
+            /**
+             * Enables counting the shadow ray evaluations saved by skipping
+             * the pixels already known to be in shadow. Every light's shadow
+             * casters are evaluated one after another, starting with the
+             * largest ones (relative to their distance to the light); a
+             * pixel found in shadow is marked in the stencil buffer and not
+             * evaluated again by any later caster.
+             *
+             * @param enable Counting is enabled iff true. Enabling it resets
+             *               the counter.
+             *
+             * @sa unsigned long long scene::shadow_fragments_saved(void)
+             */
+            void set_shadow_statistics(bool enable);
+            /**
+             * Returns the number of shadow ray evaluations saved since the
+             * statistics have been enabled. This waits for all shadow passes
+             * rendered so far to finish.
+             *
+             * @sa void scene::set_shadow_statistics(bool enable)
+             */
+            unsigned long long shadow_fragments_saved(void);
+
+            /**
+             * Enables keeping every light's contribution to the shading in a
+             * texture of its own. Changing a single light then only requires
+             * that light to be shaded again; the contributions of all others
+             * are just added up. If the contribution textures of all lights
+             * would need more memory than allowed, every light is shaded
+             * again whenever any of them has changed (as without the cache).
+             *
+             * @param max_bytes Maximum amount of memory used for the
+             *                  contribution textures (0 disables the cache).
+             */
+            void set_shading_cache(size_t max_bytes);
+
+            /**
+             * Sets the resolution everything is rendered at relative to the
+             * fundamental resolution. Only the lower left part of
+             * <tt>output</tt> is rendered then; <tt>display()</tt> scales it
+             * up to the whole screen. This disables the dynamic resolution.
+             *
+             * @param scale Resolution scale (in (0, 1], applied to both
+             *              dimensions).
+             */
+            void set_resolution_scale(float scale);
+
+            /**
+             * Enables the dynamic resolution: the GPU time of every frame
+             * rendered from scratch is measured and the resolution scale is
+             * adjusted so that such a frame takes (about) the given time.
+             * Requires timer queries (OpenGL 3.3); without them, the scale
+             * is left as it is.
+             *
+             * @param frame_ms Target GPU time per frame in milliseconds (0
+             *                 disables the dynamic resolution).
+             * @param min_scale Lower bound of the resolution scale.
+             * @param max_scale Upper bound of the resolution scale.
+             */
+            void set_dynamic_resolution(float frame_ms, float min_scale = .5f, float max_scale = 1.f);
+
+            /// Returns the current resolution scale.
+            float resolution_scale(void) const;
+
+            /**
+             * Enables the progressive mode: as long as the scene does not
+             * change, every <tt>render()</tt> traces another sample per pixel
+             * (with the camera rays jittered within the pixel) and
+             * <tt>output</tt> contains the average of all samples so far.
+             * Sampling stops after the given number of samples or once the
+             * average has converged; any change to the scene starts it over.
+             *
+             * @param max_samples Maximum number of samples per pixel (less
+             *                    than 2 disables the progressive mode).
+             * @param threshold The average has converged once the mean
+             *                  change of <tt>output</tt> (largest color
+             *                  channel, over all pixels) caused by a sample
+             *                  is less than this (0: never).
+             */
+            void set_progressive(int max_samples, float threshold = 0.f);
+
+            /// Returns the number of samples accumulated in <tt>output</tt>.
+            int progressive_samples(void) const;
+            /// Returns true iff the progressive mode has stopped sampling.
+            bool progressive_done(void) const;
+
+            /**
+             * Enables the edge-adaptive anti-aliasing. After the intersection,
+             * pixels differing from a neighbor in coverage, instance, distance
+             * or surface normal are detected. Only those are traced again
+             * with several rays within the pixel. These rays are processed
+             * as a compacted list with a G-buffer of its own, and their
+             * average replaces the pixel in <tt>output</tt>. The anti-aliasing
+             * is not applied in the progressive mode.
+             *
+             * @param samples Rays per edge pixel (0 disables the
+             *                anti-aliasing).
+             * @param max_edges Fraction of all pixels which may be edge
+             *                  pixels; the list G-buffer is allocated for
+             *                  this many. Edge pixels beyond are left as they
+             *                  are.
+             * @param depth_threshold Distance difference between neighbors
+             *                        (relative to the distance to the camera)
+             *                        considered an edge.
+             * @param normal_threshold Cosine of the angle between neighboring
+             *                         surface normals below which the pixel
+             *                         is considered an edge.
+             */
+            void set_edge_aa(int samples, float max_edges = .125f, float depth_threshold = .05f, float normal_threshold = .9f);
+
+            /**
+             * Enables secondary rays. Pixels with a non-zero mirror or
+             * refraction coefficient spawn a reflected or refracted ray
+             * (falling back to reflection on total internal reflection).
+             * These rays are compacted into a queue with a G-buffer of its
+             * own, traced and shaded like the edge rays, and may spawn
+             * further rays up to the given depth. Finally, every level's
+             * color, weighted by the coefficients, is added to its parent
+             * and eventually to <tt>output</tt>. The index of refraction is
+             * <tt>material::n</tt> times the refraction alpha.
+             *
+             * @param depth Maximum number of bounces (0 disables secondary
+             *              rays).
+             * @param max_rays Fraction of all pixels which may spawn rays per
+             *                 level; the queues are allocated for this many.
+             *                 Rays beyond are dropped.
+             * @param threshold Contribution to the output (the product of
+             *                  all coefficients along the path, maximum over
+             *                  the channels) below which rays are dropped.
+             */
+            void set_secondary_rays(int depth, float max_rays = .25f, float threshold = 1.f / 256.f);
+
+
+            /**
+             * Registers a material. Textures used by the material are copied
+             * into the scene's material texture array (once per texture), so
+             * instances using different textures can still be rendered in a
+             * single pass.
+             *
+             * @param mat Material to be registered.
+             *
+             * @return Material index to be assigned to
+             *         <tt>instance::material_index</tt>.
+             */
+            int add_material(const material &mat);
+
+            /**
+             * Changes a registered material.
+             *
+             * @param index Material index as returned by
+             *              <tt>add_material()</tt> (throws
+             *              macs::exc::inv_index otherwise).
+             * @param mat New material.
+             */
+            void update_material(int index, const material &mat);
+
+            /**
+             * Copies a material texture again. Call this after changing the
+             * contents of a texture used by any material.
+             *
+             * @param tex Texture which has been modified.
+             */
+            void refresh_material_texture(const macs::texture *tex);
+
+            /**
+             * Removes a texture from the material texture array. Call this
+             * before deleting a texture used by any material; its layer is
+             * reused for the next new texture. Registered materials using it
+             * lose that texture (as if it was not set). Instance materials
+             * (<tt>instance::mat</tt>) still using it when the scene is
+             * rendered register it again.
+             *
+             * @param tex Texture which is no longer used.
+             */
+            void forget_material_texture(const macs::texture *tex);
+
 
             /**
              * Renders everything into the <tt>output</tt> texture.
              *
+             * Only the stages affected by changes since the last frame are
+             * executed: camera, instance (transformation, material, shadow
+             * casting, creation and deletion) and material changes lead to
+             * everything being rendered again; a moved light only requires
+             * its shadow map and the shading to be redone; other light
+             * parameter changes only require the shading (of that light
+             * alone, if the shading cache is in effect). If nothing has
+             * changed, <tt>output</tt> is left as it is.
+             *
+             * Static lights keep the shadows cast by static instances; these
+             * are redone completely only when the camera, the light itself or
+             * any static instance changes, otherwise just for the pixels
+             * whose visible surface has changed.
+             *
+             * At a resolution scale below 1, only the lower left part of
+             * <tt>output</tt> is rendered. In the progressive mode, another
+             * sample is added as long as the mode has not stopped.
+             *
              * @sa scene::output
+             * @sa void scene::set_shading_cache(size_t max_bytes)
+             * @sa void scene::set_resolution_scale(float scale)
+             * @sa void scene::set_progressive(int max_samples, float threshold)
+             * @sa void scene::invalidate(void)
+             * @sa light::is_static
+             * @sa instance::is_static
              */
             void render(void);
-            /// Displays the <tt>output</tt> texture onto the screen.
+
+            /**
+             * Forces the next <tt>render()</tt> to redo everything. Call this
+             * after changing anything the scene cannot detect itself, e.g.,
+             * the contents of a material texture (unless
+             * <tt>refresh_material_texture()</tt> is used).
+             */
+            void invalidate(void);
+            /**
+             * Displays the <tt>output</tt> texture onto the screen (its
+             * rendered part, if the resolution scale is below 1).
+             */
             void display(void);
 
 
@@ -63,16 +339,213 @@ namespace betelgeuse
 
 
         private:
+            /**
+             * Compares the camera parameters to those the current results
+             * were rendered with and stores them.
+             *
+             * @return true iff they have changed.
+             */
+            bool update_view_state(void);
+            /**
+             * Updates the instance tables of all objects (after bringing
+             * the world transformations of instance hierarchies up to date).
+             *
+             * @return true iff any of them has changed.
+             */
+            bool update_instance_tables(void);
+            /**
+             * Compares the static shadow casting instances to those the
+             * static shadows were rendered with and stores them.
+             *
+             * @return true iff they have changed.
+             */
+            bool update_static_occluders(void);
+
+            /**
+             * Evaluates the last frame time measurement (if any) and adapts
+             * the resolution scale to it.
+             */
+            void update_dynamic_resolution(void);
+            /**
+             * Derives the rendered area and everything depending on it from
+             * the resolution scale and the shadow resolution.
+             */
+            void update_render_size(void);
+            /**
+             * Restricts rendering to the rendered area.
+             *
+             * @param divisor Resolution divisor of the render targets.
+             */
+            void scissor_render_size(int divisor);
+
+            /// Evaluates the last convergence measurement (if any).
+            void update_progressive(void);
+            /// Adds the current frame to the progressive average.
+            void accumulate(void);
+
             /// Initializes the view rays.
             void render_view(void);
-            /// Renders object intersection points.
-            void render_intersection(void);
-            /// Creates the shadow maps.
-            void render_shadows(void);
-            /// Does the light shading.
-            void render_shading(void);
-            /// Adds the ambient lighting.
-            void render_ambient(void);
+            /**
+             * Renders object intersection points.
+             *
+             * @param stt Ray starting points.
+             * @param dir Ray directions.
+             * @param gbuf G-buffer textures to be written (see
+             *             <tt>gbuffer</tt>).
+             */
+            void render_intersection(const macs::texture *stt, const macs::texture *dir, const macs::texture *const *gbuf);
+            /**
+             * Creates the shadow maps.
+             *
+             * @param dirty Lights whose shadow maps have to be created.
+             * @param geometry True iff the intersection points have changed.
+             */
+            void render_shadows(const std::list<light *> &dirty, bool geometry);
+            /**
+             * Prepares the shadow evaluation: downsamples the intersection
+             * points (at reduced shadow resolution) and updates the static
+             * shadows.
+             *
+             * @param dirty Lights whose shadow maps have to be created.
+             * @param geometry True iff the intersection points have changed.
+             */
+            void prepare_shadows(const std::list<light *> &dirty, bool geometry);
+            /**
+             * Creates a light's shadow map (prepare_shadows() has to be
+             * called before).
+             *
+             * @param lgt Light.
+             * @param map Full resolution shadow map.
+             * @param lowres Reduced resolution shadow map (only used at
+             *               reduced shadow resolution).
+             */
+            void render_shadow_map(light *lgt, const macs::texture *map, const macs::texture *lowres);
+            /**
+             * Returns the shadow map to shade a light with. If shadows are
+             * interleaved with the shading, it is rendered first (together
+             * with the light's static shadow, if that is out of date).
+             */
+            const macs::texture *shading_shadow_map(light *lgt);
+            /**
+             * Allocates or frees the lights' and the shared shadow maps
+             * according to the shadow resolution and scheduling.
+             */
+            void update_shadow_maps(void);
+            /// Downsamples the intersection points for shadow evaluation.
+            void render_shadow_downsample(void);
+            /**
+             * Upsamples a reduced resolution shadow map.
+             *
+             * @param map Full resolution shadow map to be written.
+             * @param lowres Reduced resolution shadow map.
+             */
+            void render_shadow_upsample(const macs::texture *map, const macs::texture *lowres);
+            /// Shadow casters evaluated by <tt>render_light_shadows()</tt>.
+            enum caster_set
+            {
+                /// All shadow casting instances
+                all_casters,
+                /// Static shadow casting instances only
+                static_casters,
+                /// Dynamic shadow casting instances only
+                dynamic_casters
+            };
+
+            /**
+             * Renders one light's shadows. The stencil buffer marks the pixels
+             * found in shadow, so no later caster evaluates them again.
+             *
+             * @param lgt Light.
+             * @param map Shadow map to be written.
+             * @param isct Intersection points.
+             * @param sten Stencil (pixels to be evaluated).
+             * @param init Shadow map to start with (NULL for none).
+             * @param clear True iff the shadow map has to be cleared before.
+             * @param casters Instances to be evaluated.
+             */
+            void render_light_shadows(light *lgt, const macs::texture *map, const macs::texture *isct,
+                                      const macs::texture *sten, const macs::texture *init, bool clear,
+                                      caster_set casters);
+            /**
+             * Executes a shadow pass, counting the fragments found in shadow
+             * if the shadow statistics are enabled.
+             *
+             * @param rnd Shadow render object (prepared).
+             * @param queries Queries issued for the current light so far.
+             */
+            void execute_shadow_pass(macs::render *rnd, std::vector<GLuint> &queries);
+            /**
+             * Evaluates the shadow pass counters which are available.
+             *
+             * @param wait Waits for all of them iff true.
+             */
+            void update_shadow_statistics(bool wait);
+            /**
+             * Updates the static lights' shadows cast by static instances.
+             *
+             * @param dirty Lights whose shadow maps have to be created.
+             * @param geometry True iff the intersection points have changed.
+             * @param isct Intersection points (at the shadow resolution).
+             * @param sten Stencil (at the shadow resolution).
+             */
+            void render_static_shadows(const std::list<light *> &dirty, bool geometry,
+                                       const macs::texture *isct, const macs::texture *sten);
+            /**
+             * Allocates or frees the static shadow textures according to the
+             * lights' static flags.
+             *
+             * @return true iff there is any static light.
+             */
+            bool update_static_shadows(void);
+            /**
+             * Does the light shading.
+             *
+             * @param dirty Lights whose contribution has changed (only used
+             *              if the shading cache is in effect).
+             */
+            void render_shading(const std::list<light *> &dirty);
+            /**
+             * Allocates or frees the lights' contribution textures according
+             * to the shading cache limit.
+             *
+             * @return true iff the shading cache is in effect.
+             */
+            bool update_shading_cache(void);
+            /**
+             * Runs a light's shade pass.
+             *
+             * @param lgt Light.
+             * @param gbuf G-buffer textures to be used.
+             * @param dir Ray directions.
+             * @param shadow Shadow map.
+             * @param target Texture to add the light's contribution to.
+             * @param clear True iff the target has to be cleared before.
+             */
+            void shade_light(light *lgt, const macs::texture *const *gbuf, const macs::texture *dir,
+                             const macs::texture *shadow, const macs::texture *target, bool clear);
+            /**
+             * Adds the ambient lighting.
+             *
+             * @param gbuf G-buffer textures to be used.
+             * @param target Texture to add the ambient lighting to.
+             */
+            void render_ambient(const macs::texture *const *gbuf, const macs::texture *target);
+            /// Supersamples the edge pixels of <tt>output</tt>.
+            void render_edge_aa(bool geometry);
+            /// Traces, shades and composites the secondary rays.
+            void render_secondary(void);
+
+
+            /**
+             * Returns the layer of the material texture array containing the
+             * given texture. The texture is copied into a free layer, if it
+             * has not been used before.
+             */
+            int material_layer(const macs::texture *tex);
+            /// Copies a texture into a layer of the material texture array.
+            void copy_material_texture(const macs::texture *tex, int layer);
+            /// Converts a material into the instance table format.
+            void pack_material(const material &mat, macs::formats::f0123 *dst);
 
 
             /// Display aspect.
@@ -113,11 +586,11 @@ namespace betelgeuse
             macs::texture tang_map;
             /// Material ambient map.
             macs::texture ambient_map;
-            /// Material mirror map.
+            /// Material mirror map (W: refraction coefficient).
             macs::texture mirror_map;
             /// Material refraction map.
             macs::texture refract_map;
-            /// Texture UV map.
+            /// Texture UV map (ZW: object type and instance index).
             macs::texture uv_map;
             /// Material layer 0 color map.
             macs::texture color0_map;
@@ -129,6 +602,24 @@ namespace betelgeuse
             /// "Artificial" stencil buffer (for early-out in fragment shaders).
             macs::texture asten;
 
+            /// Number of textures written by the intersection passes.
+            enum { gbuffer_size = 11 };
+            /**
+             * Textures written by the intersection passes (from
+             * <tt>glob_isct</tt> to <tt>asten</tt>, in declaration order).
+             */
+            const macs::texture *gbuffer[gbuffer_size];
+
+            /// Number of floats describing the camera (see update_view_state()).
+            enum { view_state_size = 16 };
+
+            /// True iff everything has to be rendered again.
+            bool invalid;
+            /// True iff all shadow maps have to be rendered again.
+            bool shadows_invalid;
+            /// Camera parameters the current results were rendered with.
+            float rendered_view[view_state_size];
+
             /// Initial view rendering object.
             macs::render *rnd_view;
 
@@ -137,6 +628,215 @@ namespace betelgeuse
 
             /// Current light source position (for shadow calculation).
             macs::types::named<macs::types::vec4> cur_light_pos;
+
+            /// Static shadow casting instances (inverse transformations).
+            std::vector<float> static_occluders;
+            /**
+             * Intersection points (W: surface present) the static shadows
+             * were rendered for, and the ones they are updated to next.
+             */
+            macs::texture *static_isct[2];
+            /// Pixels whose static shadows have to be rendered again.
+            macs::texture *static_stale;
+            /// Render object finding the pixels with a new visible surface.
+            macs::render *rnd_static_stale;
+            /// Render object clearing the stale pixels of a static shadow map.
+            macs::render *rnd_static_clear;
+            /**
+             * Render object initializing a shadow map with the static
+             * shadows.
+             */
+            macs::render *rnd_shadow_init;
+
+            /// True iff the shadow statistics are enabled.
+            bool shadow_stats;
+            /// Shadow ray evaluations saved so far.
+            unsigned long long shadow_saved;
+            /**
+             * Shadow pass queries not yet evaluated, together with the number
+             * of passes after them evaluating the same light (each of which
+             * skips every fragment passed).
+             */
+            std::vector<std::pair<GLuint, int>> shadow_queries;
+            /// Query objects not in use.
+            std::vector<GLuint> shadow_query_pool;
+
+            /// True iff shadows are rendered right before the shading.
+            bool shadow_interleaved;
+            /// Shadow map shared by all lights (only if interleaved).
+            macs::texture *shadow_shared;
+            /// Reduced resolution version of <tt>shadow_shared</tt>.
+            macs::texture *shadow_shared_lowres;
+
+            /// Shadow resolution divisor.
+            int shadow_div;
+            /// Reduced resolution shadow map size.
+            macs::types::named<macs::types::vec2> shadow_size;
+            /// Full resolution to reduced resolution coordinate scale.
+            macs::types::named<macs::types::vec2> shadow_scale;
+            /// Reduced resolution intersection points (W: surface present).
+            macs::texture *shadow_isct;
+            /// Reduced resolution surface normals.
+            macs::texture *shadow_norm;
+            /// Reduced resolution "artificial" stencil buffer.
+            macs::texture *shadow_asten;
+            /// Intersection point downsampling render object.
+            macs::render *rnd_shadow_down;
+            /// Joint bilateral upsampling render object.
+            macs::render *rnd_shadow_up;
+            /// Reduced resolution shadow map input slot of the upsampling.
+            int shadow_up_slot;
+
+            /// Resolution scale.
+            float res_scale;
+            /// Dynamic resolution target GPU time per frame (ms, 0: off).
+            float res_target;
+            /// Lower bound of the dynamic resolution scale.
+            float res_min;
+            /// Upper bound of the dynamic resolution scale.
+            float res_max;
+            /// Size of the rendered area (lower left part of all textures).
+            int render_w, render_h;
+            /// Fundamental size divided by the size of the rendered area.
+            macs::types::named<macs::types::vec2> view_scale;
+            /// Size of the rendered area.
+            macs::types::named<macs::types::vec2> render_size;
+            /// Last reduced resolution shadow map texel rendered.
+            macs::types::named<macs::types::vec2> shadow_limit;
+            /// Timer query measuring the frame time (0 if unavailable).
+            GLuint frame_timer;
+            /// True iff <tt>frame_timer</tt> has been issued but not read.
+            bool frame_timer_pending;
+
+            /// Maximum number of progressive samples (0: progressive mode off).
+            int accum_max;
+            /// Progressive convergence threshold.
+            float accum_threshold;
+            /// Number of progressive samples accumulated.
+            int accum_samples;
+            /// True iff the progressive average has converged.
+            bool accum_converged;
+            /// Camera ray offset within the pixel (in texture coordinates).
+            macs::types::named<macs::types::vec2> view_jitter;
+            /// Number of progressive samples as a shader input.
+            macs::types::named<float> accum_count;
+            /// Sum of all progressive samples.
+            macs::texture *accum_sum;
+            /// Change of the average caused by the last sample.
+            macs::texture *accum_delta;
+            /// Render object adding a sample to the sum.
+            macs::render *rnd_accum;
+            /// Render object calculating the change of the average.
+            macs::render *rnd_accum_delta;
+            /// Render object writing the average into the output.
+            macs::render *rnd_accum_avg;
+            /// Sums up the change of the average.
+            macs::reduce *accum_reduce;
+            /// True iff <tt>accum_reduce</tt> has a result not yet evaluated.
+            bool accum_reduce_pending;
+
+            /// Rays per edge pixel (0: edge anti-aliasing off).
+            int aa_samples;
+            /// Height of the list G-buffer.
+            int aa_list_height;
+            /// Number of list G-buffer rows currently in use.
+            int aa_list_rows;
+            /// Edge detection distance threshold.
+            macs::types::named<float> aa_depth_threshold;
+            /// Edge detection normal threshold.
+            macs::types::named<float> aa_normal_threshold;
+            /// Edge pixel flags.
+            macs::texture *aa_edges;
+            /// Ray starting points of the edge rays.
+            macs::texture *aa_ray_stt;
+            /// Ray directions of the edge rays.
+            macs::texture *aa_ray_dir;
+            /// G-buffer of the edge rays (see <tt>gbuffer</tt>).
+            macs::texture *aa_gbuffer[gbuffer_size];
+            /// Shadow map of the edge rays (for one light at a time).
+            macs::texture *aa_shadow;
+            /// Color of the edge rays.
+            macs::texture *aa_color;
+            /// Edge detection render object.
+            macs::render *rnd_aa_edges;
+            /// Compacts the edge pixels into a list.
+            macs::compact *aa_compact;
+            /// Creates the edge rays.
+            macs::render *rnd_aa_rays;
+            /// Replaces the edge pixels of the output by their average.
+            macs::render *rnd_aa_resolve;
+            /// Edge ray color input slot of the resolving render object.
+            int aa_resolve_slot;
+
+            /// Maximum number of secondary ray levels (0: secondary rays off).
+            int sec_depth;
+            /// Height of the secondary ray queues.
+            int sec_queue_height;
+            /// Minimum contribution of a secondary ray.
+            macs::types::named<float> sec_threshold;
+            /// Size of the textures secondary rays are spawned from.
+            macs::types::named<macs::types::vec2> sec_parent_size;
+            /// Part of these textures which may contain rays.
+            macs::types::named<macs::types::vec2> sec_parent_limit;
+            /// Number of rays in these textures.
+            macs::types::named<float> sec_parent_count;
+            /// 1 iff the parents are the camera rays, 0 otherwise.
+            macs::types::named<float> sec_primary;
+            /// Candidate ray origins (lower half: reflections, upper half:
+            /// refractions of the parent at the same position).
+            macs::texture *sec_cand_origin;
+            /// Candidate ray directions.
+            macs::texture *sec_cand_dir;
+            /// Candidate coefficients (RGB) and contributions (A).
+            macs::texture *sec_cand_info;
+            /// Ray starting points of the queued rays.
+            macs::texture *sec_ray_stt;
+            /// Ray directions of the queued rays.
+            macs::texture *sec_ray_dir;
+            /// G-buffer of the queued rays (see <tt>gbuffer</tt>).
+            macs::texture *sec_gbuffer[gbuffer_size];
+            /// Shadow map of the queued rays (for one light at a time).
+            macs::texture *sec_shadow;
+            /// Per level: queue position plus one of every candidate (0: not
+            /// queued).
+            std::vector<macs::texture *> sec_maps;
+            /// Per level: coefficients and contributions of the queued rays.
+            std::vector<macs::texture *> sec_infos;
+            /// Per level: color of the queued rays.
+            std::vector<macs::texture *> sec_colors;
+            /// Spawns the candidates from a G-buffer.
+            macs::render *rnd_sec_spawn;
+            /// Compacts the candidates into a queue.
+            macs::compact *sec_compact;
+            /// Stores the candidates' queue positions.
+            macs::render *rnd_sec_map;
+            /// Creates the queued rays.
+            macs::render *rnd_sec_rays;
+            /// Adds the weighted color of the queued rays to their parents.
+            macs::render *rnd_sec_resolve;
+
+            /// Memory limit for the lights' contribution textures.
+            size_t shading_cache_limit;
+            /// Render object adding a light's contribution to the output.
+            macs::render *rnd_combine;
+            /// Contribution texture input slot of the combining render object.
+            int combine_slot;
+
+            /// Maximum resolution of a material texture layer.
+            int material_res;
+            /// All textures used by materials (resampled).
+            macs::texture_array material_textures;
+            /// Layer of the material texture array used by each texture.
+            std::map<const macs::texture *, int> material_layers;
+            /// Layers of forgotten textures (to be reused).
+            std::vector<int> free_material_layers;
+            /// Registered materials (in instance table format).
+            std::vector<macs::formats::f0123> materials;
+
+            /// Render object copying textures into the material texture array.
+            macs::render *rnd_resample;
+            /// Source texture input slot of the resampling render object.
+            int resample_slot;
     };
 }
 
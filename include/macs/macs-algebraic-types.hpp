@@ -16,6 +16,10 @@
 #include "macs-internals.hpp"
 #include "macs-root.hpp"
 
+#ifdef MACS_SIMD
+#include <xmmintrin.h>
+#endif
+
 
 namespace macs
 {
@@ -487,7 +491,12 @@ namespace macs
         };
 
 
-        /// 4x4 matrix consisting of floats.
+        /**
+         * 4x4 matrix consisting of floats (column-major). With MACS_SIMD, its
+         * columns are loaded into SSE registers with unaligned loads, because
+         * before C++17, neither new nor std::vector honour an over-aligned
+         * type (and there is no penalty for aligned data anyway).
+         */
         class mat4
         {
             public:
@@ -527,6 +536,11 @@ namespace macs
                 /// Tranposes this matrix and returns the result.
                 mat4 transposed(void) const
                 {
+#ifdef MACS_SIMD
+                    mat4 res(*this);
+                    res.transpose();
+                    return res;
+#else
                     float nd[16] = {
                         d[0], d[4], d[ 8], d[12],
                         d[1], d[5], d[ 9], d[13],
@@ -534,11 +548,17 @@ namespace macs
                         d[3], d[7], d[11], d[15]
                     };
                     return mat4(nd);
+#endif
                 }
 
                 /// Transposes this matrix, storing the result in here.
                 void transpose(void)
                 {
+#ifdef MACS_SIMD
+                    __m128 c0 = _mm_loadu_ps(&d[0]), c1 = _mm_loadu_ps(&d[4]), c2 = _mm_loadu_ps(&d[8]), c3 = _mm_loadu_ps(&d[12]);
+                    _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+                    _mm_storeu_ps(&d[0], c0); _mm_storeu_ps(&d[4], c1); _mm_storeu_ps(&d[8], c2); _mm_storeu_ps(&d[12], c3);
+#else
                     float nd[16] = {
                         d[0], d[4], d[ 8], d[12],
                         d[1], d[5], d[ 9], d[13],
@@ -546,11 +566,16 @@ namespace macs
                         d[3], d[7], d[11], d[15]
                     };
                     memcpy(d, nd, sizeof(nd));
+#endif
                 }
 
                 /// Returns the determinant.
                 float det(void) const;
-                /// Returns the inverse matrix.
+                /**
+                 * Returns the inverse matrix. With MACS_SIMD, it is computed
+                 * blockwise (2x2 blocks) in SSE registers, which may round
+                 * slightly differently from the scalar cofactor expansion.
+                 */
                 mat4 inv(void) const;
                 /// Inverts this matrix.
                 void invert(void);
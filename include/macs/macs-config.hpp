@@ -12,4 +12,12 @@
  */
 // #define DEBUG
 
+/**
+ * MACS_SIMD macro. Defined if the algebraic types use SSE; define MACS_NO_SIMD
+ * to build the scalar versions instead.
+ */
+#if defined(__SSE__) && !defined(MACS_NO_SIMD)
+#define MACS_SIMD
+#endif
+
 #endif
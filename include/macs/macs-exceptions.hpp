@@ -104,6 +104,36 @@ namespace macs
         }
         /// Texture not declared exception instance
         tex_nd;
+
+        /**
+         * Output size mismatch exception. Thrown if a render pass is to be
+         * executed whose outputs do not all have the same size (the viewport
+         * is derived from them).
+         */
+        static class output_size_mismatch: std::exception
+        {
+            public:
+                /// Returns an error description.
+                virtual const char *what(void) const throw()
+                { return "Output textures differ in size."; }
+        }
+        /// Output size mismatch exception instance
+        size_mm;
+
+        /**
+         * Invalid index exception. Thrown if an index refers to an element
+         * which does not exist (e.g., a material index beyond the materials
+         * registered with a scene).
+         */
+        static class invalid_index: std::exception
+        {
+            public:
+                /// Returns an error description.
+                virtual const char *what(void) const throw()
+                { return "Index out of range."; }
+        }
+        /// Invalid index exception instance
+        inv_index;
     }
 }
 
@@ -47,6 +47,7 @@ namespace macs
     class textures_in;
     class texture;
     class texture_array;
+    class texture_layer;
 
 
     /**
@@ -96,7 +97,11 @@ namespace macs
                     /// Fragment shader
                     fragment = GL_FRAGMENT_SHADER,
                     /// Vertex shader
-                    vertex   = GL_VERTEX_SHADER
+                    vertex   = GL_VERTEX_SHADER,
+                    /// Geometry shader
+                    geometry = GL_GEOMETRY_SHADER,
+                    /// Compute shader
+                    compute  = GL_COMPUTE_SHADER
                 };
 
                 /**
@@ -179,6 +184,13 @@ namespace macs
                  */
                 void operator=(const in *obj) throw(exc::invalid_type, exc::texture_not_assigned);
 
+                /// Sets this (integer) uniform.
+                void set(int x);
+                /// Sets this (two-component integer vector) uniform.
+                void set(int x, int y);
+                /// Sets this (two-component float vector) uniform.
+                void set(float x, float y);
+
             private:
                 /// OpenGL uniform location ID
                 unsigned id;
@@ -312,9 +324,9 @@ namespace macs
                 void loosen(void);
 
                 /**
-                 * Tries to assign this texture to a TMU. If a unit is found
-                 * which is already assigned to this texture, this will mark
-                 * that TMU as definitely assigned.
+                 * Tries to assign this texture to a TMU. If the texture is
+                 * already assigned to a unit, this will mark that TMU as
+                 * definitely assigned.
                  *
                  * @param tex Texture to assign a TMU to.
                  *
@@ -324,8 +336,8 @@ namespace macs
                 bool operator&=(const textures_in *tex);
 
                 /**
-                 * Assigns this texture to a TMU. Finds a loosely assigned TMU
-                 * and assigns it to that texture.
+                 * Assigns this texture to a TMU. Finds the least recently used
+                 * loosely assigned TMU and assigns it to that texture.
                  *
                  * @param tex Texture to assign a TMU to.
                  *
@@ -335,6 +347,26 @@ namespace macs
                  */
                 void operator+=(const textures_in *tex);
 
+                /**
+                 * Releases a texture. Detaches the given texture from every
+                 * TMU it is assigned to. This has to be done before the
+                 * texture is destroyed, since another texture may be created
+                 * at the same address afterwards.
+                 *
+                 * @param tex Texture to be released.
+                 */
+                void operator-=(const textures_in *tex);
+
+                /**
+                 * Makes a texture accessible. Assigns the texture to a TMU (if
+                 * it is not already assigned to one) and activates that unit,
+                 * so it may be modified through the usual OpenGL functions.
+                 * Definitely assigned units are left alone.
+                 *
+                 * @param tex Texture to be selected.
+                 */
+                void select(const textures_in *tex);
+
                 /**
                  * The last function in the managing cycle. It essentially
                  * just disables loosely assigned units.
@@ -354,12 +386,25 @@ namespace macs
 
 
             private:
+                /**
+                 * Finds the least recently used loosely assigned TMU.
+                 *
+                 * @return Index of that unit (-1 if every unit is definitely
+                 *         assigned).
+                 */
+                int victim(void);
+
+
                 /// TMU count
                 int units;
                 /// TMU array
                 tmu *tmus;
                 /// True iff definitely assigned
                 bool *definitely;
+                /// Value of <tt>clock</tt> when each TMU was last used
+                unsigned long *last_use;
+                /// Incremented on every managing cycle
+                unsigned long clock;
         };
 
 
@@ -374,6 +419,19 @@ namespace macs
         /// Central TMU manager.
         extern tmu_manager *tmu_mgr;
 
+        /**
+         * Vertex shader for layered rendering. Pipes input XY to output and
+         * passes the instance ID on as the layer index (NULL if layered
+         * rendering is not supported).
+         */
+        extern shader *layered_vertex_shader;
+        /**
+         * Geometry shader for layered rendering. Sends every primitive to the
+         * layer given by the vertex shader (NULL if layered rendering is not
+         * supported).
+         */
+        extern shader *layered_geometry_shader;
+
 
         /**
          * Draws a quad. Draws a textured quad to the whole framebuffer
@@ -381,6 +439,16 @@ namespace macs
          * identity matrices or a shader is used which circumvents this).
          */
         void draw_quad(void);
+
+        /**
+         * Draws several instances of a quad. Draws the same quad as
+         * <tt>draw_quad(void)</tt>, but as a triangle fan which is
+         * instantiated the given number of times (used for layered
+         * rendering).
+         *
+         * @param instances Number of instances.
+         */
+        void draw_quad(int instances);
     }
 }
 
@@ -14,12 +14,12 @@ namespace macs
 {
     class render;
 
-#ifdef DEBUG
     namespace internals
     {
         class tmu;
+        class tmu_manager;
+        class prg_uniform;
     }
-#endif
 
 
     /**
@@ -137,6 +137,20 @@ namespace macs
                  */
                 t_texture_placebo,
 
+                /**
+                 * Array of 2D textures (layered rendering).
+                 *
+                 * @sa macs::texture_array
+                 */
+                t_texture_array,
+
+                /**
+                 * Single texture from an array of 2D textures.
+                 *
+                 * @sa macs::texture_layer
+                 */
+                t_texture_layer,
+
                 /**
                  * Combined stencil/depth buffer.
                  *
@@ -169,6 +183,24 @@ namespace macs
     /// Represents textures usable as input.
     class textures_in: public in
     {
+        public:
+            /// Basic constructor.
+            textures_in(void):
+                unit(-1)
+            {}
+
+
+            friend class internals::tmu;
+            friend class internals::tmu_manager;
+            friend class internals::prg_uniform;
+
+        protected:
+            /**
+             * Hardware TMU this texture is currently assigned to (-1 if
+             * none). This allows finding the unit of a texture without
+             * searching all TMUs.
+             */
+            mutable int unit;
     };
 
     /// Represents textures usable as output.
@@ -100,8 +100,30 @@ namespace macs
              */
             void display(void);
 
+            /**
+             * Displays the lower left part of this texture's contents,
+             * stretched over the whole screen.
+             *
+             * @param w Width of the part to be displayed.
+             * @param h Height of the part to be displayed.
+             */
+            void display(int w, int h);
+
+
+            /// Returns the width of this texture.
+            int get_width(void) const
+            { return width; }
+
+            /// Returns the height of this texture.
+            int get_height(void) const
+            { return height; }
+
 
             friend class render;
+            friend class reduce;
+            friend class scan;
+            friend class compact;
+            friend class sort;
             friend class internals::tmu;
 
         private:
@@ -146,19 +168,42 @@ namespace macs
      * may consider using an array of textures. This class defines such
      * data structures.
      *
-     * Physically, they represent 3D textures where the R coordinate is used to
-     * index a 2D texture.
+     * In render pass scripts, an array named <tt>x</tt> is accessed by
+     * <tt>x(layer)</tt>, where <tt>layer</tt> is the (integer) index of the
+     * texture to be read. Sampling at arbitrary coordinates is possible through
+     * <tt>texture2DArray(raw_x, vec3(coord, layer))</tt>.
+     *
+     * Physically, they represent 2D array textures, i.e., every layer is a 2D
+     * texture of its own and is addressed by an integer index, so there is no
+     * filtering between layers.
+     *
+     * Texture arrays may be used as output, too. In that case, the render pass
+     * is layered: The render pass script is executed once for every layer and
+     * the current layer index is available as the integer <tt>layer</tt>. All
+     * color outputs of a layered render pass have to be texture arrays with
+     * the same number of layers. Single layers may be used as output of
+     * ordinary render passes through texture_layer objects.
+     *
+     * @note Layered rendering requires OpenGL 3.2.
      */
-    class texture_array: public textures_in
+    class texture_array: public textures_in, public textures_out
     {
         public:
             /**
-             * Creates an empty texture array.
+             * Creates an empty texture array. Every texture's size will be the
+             * one specified during the <tt>macs::init()</tt> call, unless
+             * specified otherwise.
              *
              * @param name Name which is used to denote this array in scripts
              * @param textures Texture count
+             * @param discrete Set this parameter to true to create an array of
+             *                 discrete (unfiltered) textures.
+             * @param width Texture width (defaults to fundamental width)
+             * @param height Texture height (defaults to fundamental height)
+             *
+             * @sa texture::texture(const char *name, bool discrete, int width, int height)
              */
-            texture_array(const char *name, int textures);
+            texture_array(const char *name, int textures, bool discrete = true, int width = -1, int height = -1);
 
             /**
              * Destroys a texture array.
@@ -184,6 +229,24 @@ namespace macs
             /// @overload void texture_array::write(formats::f0123 *src)
             void write(const formats::f0 *src);
 
+            /**
+             * Fills a single texture of this array with data. The other layers
+             * remain unaltered.
+             *
+             * @param layer Index of the texture to be written.
+             * @param src <tt>width * height</tt> formats::rgba objects are read
+             *            from this buffer.
+             */
+            void write(int layer, const formats::f0123 *src);
+            /// @overload void texture_array::write(int layer, formats::f0123 *src)
+            void write(int layer, const formats::f2103 *src);
+            /// @overload void texture_array::write(int layer, formats::f0123 *src)
+            void write(int layer, const formats::f012 *src);
+            /// @overload void texture_array::write(int layer, formats::f0123 *src)
+            void write(int layer, const formats::f210 *src);
+            /// @overload void texture_array::write(int layer, formats::f0123 *src)
+            void write(int layer, const formats::f0 *src);
+
             /**
              * Reads data from a texture array.
              *
@@ -202,19 +265,106 @@ namespace macs
             /// @overload void texture_array::read(formats::f0123 *dst)
             void read(formats::f0 *dst);
 
+            /**
+             * Reads a single texture from this array.
+             *
+             * @param layer Index of the texture to be read.
+             * @param dst <tt>width * height</tt> elements are written to this
+             *            buffer.
+             *
+             * @note On OpenGL versions older than 4.5, this will read the whole
+             *       array into a temporary buffer.
+             */
+            void read(int layer, formats::f0123 *dst);
+            /// @overload void texture_array::read(int layer, formats::f0123 *dst)
+            void read(int layer, formats::f2103 *dst);
+            /// @overload void texture_array::read(int layer, formats::f0123 *dst)
+            void read(int layer, formats::f012 *dst);
+            /// @overload void texture_array::read(int layer, formats::f0123 *dst)
+            void read(int layer, formats::f210 *dst);
+            /// @overload void texture_array::read(int layer, formats::f0123 *dst)
+            void read(int layer, formats::f0 *dst);
+
+
+            /**
+             * Reallocates the texture array with a new size. Layers present
+             * in both sizes keep their contents, scaled (linearly filtered)
+             * to the new width and height; the contents of new layers are
+             * undefined.
+             *
+             * @param textures New texture count
+             * @param width New texture width
+             * @param height New texture height
+             */
+            void resize(int textures, int width, int height);
+
+
+            /// Returns the number of textures in this array.
+            int layers(void) const
+            { return elements; }
+
+            /// Returns the width of every texture in this array.
+            int get_width(void) const
+            { return width; }
+
+            /// Returns the height of every texture in this array.
+            int get_height(void) const
+            { return height; }
+
 
             friend class render;
+            friend class texture_layer;
             friend class internals::tmu;
 
         private:
             /// Subtexture count
             int elements;
 
+            /// Width
+            int width;
+            /// Height
+            int height;
+
             /// OpenGL texture ID
             GLuint id;
     };
 
 
+    /**
+     * Represents a single texture of a texture array as output.
+     *
+     * Render passes may write to a single layer of a texture array by using
+     * such an object as output. The name used in scripts defaults to the
+     * array's name; specify another one if you want to assign the layer to a
+     * texture replacement slot via <tt>render::operator>>()</tt>.
+     */
+    class texture_layer: public textures_out
+    {
+        public:
+            /**
+             * Creates a layer reference.
+             *
+             * @param array Texture array to be referenced.
+             * @param layer Index of the texture in that array.
+             * @param name Name used to denote this layer in scripts (defaults
+             *             to the array's name).
+             */
+            texture_layer(const texture_array *array, int layer, const char *name = NULL);
+
+            /// Basic deconstructor.
+            ~texture_layer(void);
+
+
+            friend class render;
+
+        private:
+            /// Referenced array
+            const texture_array *array;
+            /// Layer index
+            int layer;
+    };
+
+
     /**
      * Represents a combined depth/stencil buffer attachment.
      *
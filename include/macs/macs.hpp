@@ -12,6 +12,8 @@
 #include <exception>
 #include <initializer_list>
 #include <list>
+#include <string>
+#include <vector>
 
 
 #include "macs-exceptions.hpp"
@@ -102,6 +104,20 @@ namespace macs
              *       program (however, the attached objects will already be
              *       defined). This may be changed in future, though.
              *
+             * @note The viewport is derived from the output textures, which
+             *       thus all have to be of the same size (otherwise,
+             *       <tt>execute()</tt> throws <tt>exc::size_mm</tt>). With a
+             *       stencil/depth buffer, they must not be larger than the
+             *       fundamental size.
+             *       <tt>tex_coord</tt> always spans 0 to 1 across the outputs
+             *       and the <tt>vec2</tt> uniform <tt>texel_size</tt> contains
+             *       the size of one output texel in these coordinates.
+             *
+             * @note An empty value for a stencil/depth buffer leaves the
+             *       depth untouched, i.e., the buffer is used for stencil
+             *       and depth testing only. This allows the tests to be
+             *       carried out before the fragment shader runs.
+             *
              * @note It may be impossible to find a correct distribution of
              *       input and output objects among the hardware ressources,
              *       especially, if you specify more input textures than
@@ -119,12 +135,65 @@ namespace macs
                 ...
             );
 
+            /**
+             * Creates a new render pass object from lists built at runtime.
+             *
+             * @param input Input object list.
+             * @param output Output object list.
+             * @param global_src Global RPS source code.
+             * @param shared_src Shared local RPS source code.
+             * @param values Values the output objects shall be set to (one
+             *               per output object).
+             *
+             * @sa render::render(std::initializer_list<const in *> input, std::initializer_list<const out *> output, const char *global_src, const char *shared_src, ...)
+             */
+            render(
+                const std::vector<const in *> &input,
+                const std::vector<const out *> &output,
+                const char *global_src,
+                const char *shared_src,
+                const std::vector<const char *> &values
+            );
+
             /**
              * Frees a render pass object.
              */
             ~render(void);
 
 
+            /**
+             * Switches this render pass to the compute backend. The RPS is
+             * compiled into an OpenGL 4.3 compute shader which writes all
+             * outputs through images. Thus, the number of outputs is not
+             * limited by <tt>max_output_textures()</tt> and outputs may also
+             * be written to at arbitrary positions
+             * (<tt>imageStore(raw_</tt><i>name</i><tt>, ...)</tt>).
+             *
+             * The RPS additionally has access to <tt>texel</tt> (the integer
+             * coordinates of the current output element) and to all compute
+             * shader built-ins, e.g. for using shared memory declared in
+             * <tt>shared_src</tt> together with <tt>barrier()</tt>. The global
+             * work size is given by the size of the first output.
+             * <tt>MACS_COMPUTE</tt> is defined, so the RPS can contain both a
+             * compute specific and a fallback variant.
+             *
+             * @param wg_x Workgroup width.
+             * @param wg_y Workgroup height.
+             * @param shared_src Additional global declarations (e.g., of
+             *                   <tt>shared</tt> variables).
+             *
+             * @return True iff the compute backend is used from now on. If
+             *         compute shaders are not available, depth/stencil
+             *         buffers are attached or the RPS cannot be compiled as a
+             *         compute shader (e.g., because a function in the global
+             *         RPS uses <tt>discard</tt>), false is returned and the
+             *         fragment backend stays in use.
+             *
+             * @note Depth and stencil testing are not available in the compute
+             *       backend, blending is emulated.
+             */
+            bool use_compute(int wg_x = 8, int wg_y = 8, const char *shared_src = "");
+
             /**
              * Prepares this object for usage. This will modify the OpenGL
              * states so this render pass may be executed. If you want to do
@@ -157,6 +226,8 @@ namespace macs
              *       more than one physical render pass, especially if you use
              *       more output textures than physically allowed.
              *
+             * @note The viewport is set to the size of the output textures.
+             *
              * @sa int max_output_textures(void)
              */
             void execute(void);
@@ -327,18 +398,81 @@ namespace macs
             void operator<<(const texture *tex);
             /// Appends a texture to output.
             void operator>>(const texture *tex);
+            /// Appends a texture array to output (layered render passes only).
+            void operator>>(const texture_array *tex);
+            /// Appends a single texture of an array to output.
+            void operator>>(const texture_layer *tex);
             /// Removes a texture.
             void operator-=(const texture *tex);
+            /// Removes a texture array.
+            void operator-=(const texture_array *tex);
+            /// Removes a single texture of an array.
+            void operator-=(const texture_layer *tex);
+
+
+            /**
+             * Returns the input slot belonging to a texture replacement. Every
+             * texture placebo given as input at construction is an input slot,
+             * i.e., a fixed sampler whose texture may be exchanged cheaply
+             * between passes.
+             *
+             * @param name Name of the texture replacement.
+             *
+             * @return Slot index to be used with <tt>bind()</tt>.
+             */
+            int slot(const char *name) const;
+
+            /**
+             * Binds a texture to an input slot. The texture will be available
+             * under the name of the slot's texture replacement. This does not
+             * modify the input object list and takes constant time.
+             *
+             * @param slot Slot index as returned by <tt>slot()</tt>.
+             * @param tex Texture to be bound (NULL to unbind the slot).
+             */
+            void bind(int slot, const texture *tex);
 
 
         private:
+            /// Compiles the RPS and creates the FBOs (used by constructors).
+            void build(const std::vector<const in *> &input, const std::vector<const out *> &output, const char *global_src, const char *shared_src, const std::vector<const char *> &values);
+
             /// Binds an FBO for drawing.
             void bind_fbo(int i);
 
+            /**
+             * Attaches an output object to the attachment point of the
+             * texture replacement with the same name.
+             */
+            void attach(const out *tex);
+
+            /**
+             * Attaches a color output object to the given attachment point of
+             * the currently bound FBO. Texture replacements are not attached
+             * at all.
+             */
+            static void attach_color(int attachment, const out *obj);
+
+            /// Executes this render pass through the compute backend.
+            void execute_compute(void);
+
+            /**
+             * Determines the size of the outputs attached (defaults to the
+             * fundamental size if there are none).
+             *
+             * @param w Width.
+             * @param h Height.
+             * @param d Number of layers (1 for non-layered passes).
+             */
+            void output_size(int &w, int &h, int &d) const;
+
 
             /// Number of FBOs
             int fbos;
 
+            /// Number of layers (0 if this is no layered render pass)
+            int layers;
+
             /// OpenGL FBO IDs
             GLuint *ids;
 
@@ -366,19 +500,482 @@ namespace macs
             /// Blending factor for destination values
             blend_fact bfdst;
 
+            /// Input slot (texture replacement given at construction)
+            struct input_slot
+            {
+                /// Name of the texture replacement
+                const char *name;
+                /// Currently bound texture (NULL if none)
+                const texture *tex;
+                /// Sampler uniform in every program
+                std::vector<internals::prg_uniform> uniforms;
+            };
+
+
             /// Input objects
             std::list<const in *> inp_objs;
+            /// Input slots
+            std::vector<input_slot> slots;
             /// Output objects
             std::list<const out *> out_objs;
 
             /// Generated programs
             internals::program *prgs;
 
+            /// Input declarations of the final source
+            std::string src_inputs;
+            /// Global RPS source code
+            std::string src_global;
+            /// Local RPS source code including the output assignments
+            std::string src_main;
+            /// True iff any input is a texture array
+            bool array_inputs;
+            /// Color outputs by attachment index (NULL for replacements)
+            std::vector<const out *> attached;
+
+            /// Compute program (NULL iff the fragment backend is used)
+            internals::program *cprg;
+            /// Compute workgroup width
+            int wg_w;
+            /// Compute workgroup height
+            int wg_h;
+
             /// True iff that's the case.
             bool freshly_prepared;
     };
 
 
+    /**
+     * GPU reduction. Reduces a texture to a single element by repeatedly
+     * combining blocks of 4x4 elements in render passes (ping-ponging between
+     * two intermediate textures), until only one element remains.
+     *
+     * The operation used for combining two elements must be associative. The
+     * result may be read back synchronously or asynchronously (only the final
+     * element is transferred) or be used as an input texture for further
+     * render passes.
+     */
+    class reduce
+    {
+        public:
+            /// Predefined operations.
+            enum operation
+            {
+                /// Sum of all elements (per channel)
+                sum,
+                /// Minimum of all elements (per channel)
+                min,
+                /// Maximum of all elements (per channel)
+                max,
+                /**
+                 * Minimum of the first channel. The result contains that value
+                 * in the first channel and the X and Y index of the
+                 * (lowest-indexed) element containing it in the second and the
+                 * third channel, respectively.
+                 */
+                argmin,
+                /// Like <tt>argmin</tt>, but for the maximum.
+                argmax
+            };
+
+
+            /**
+             * Creates a reduction object.
+             *
+             * @param op Operation to be carried out.
+             * @param width Maximum width of the textures to be reduced
+             *              (defaults to fundamental width).
+             * @param height Maximum height of the textures to be reduced
+             *               (defaults to fundamental height).
+             */
+            reduce(operation op, int width = -1, int height = -1);
+
+            /**
+             * Creates a per-channel reduction object. Every channel is reduced
+             * by its own operation (only <tt>sum</tt>, <tt>min</tt> and
+             * <tt>max</tt> are allowed).
+             *
+             * @param r Operation for the first channel.
+             * @param g Operation for the second channel.
+             * @param b Operation for the third channel.
+             * @param a Operation for the fourth channel.
+             * @param width Maximum width of the textures to be reduced.
+             * @param height Maximum height of the textures to be reduced.
+             */
+            reduce(operation r, operation g, operation b, operation a, int width = -1, int height = -1);
+
+            /**
+             * Creates a reduction object with a custom operation.
+             *
+             * @param op RPS expression combining the two <tt>vec4</tt> values
+             *           <tt>a</tt> and <tt>b</tt> into one (e.g.,
+             *           <tt>"a * b"</tt>). It must be associative.
+             * @param width Maximum width of the textures to be reduced.
+             * @param height Maximum height of the textures to be reduced.
+             */
+            reduce(const char *op, int width = -1, int height = -1);
+
+            /// Basic destructor.
+            ~reduce(void);
+
+
+            /**
+             * Reduces a texture. All elements of the given texture are
+             * combined, the result is available through <tt>output()</tt>
+             * immediately and through <tt>result()</tt> after the readback
+             * has finished.
+             *
+             * @param tex Texture to be reduced; it must not be larger than
+             *            specified at construction.
+             */
+            void operator()(const texture *tex);
+
+            /**
+             * Returns true iff the result of the last reduction has arrived
+             * in main memory, i.e., iff <tt>result()</tt> will not block
+             * (false if nothing has been reduced yet).
+             */
+            bool ready(void);
+
+            /**
+             * Returns the result of the last reduction. Waits for the readback
+             * to finish, if necessary. Throws exc::inv_exec_order if nothing
+             * has been reduced yet.
+             */
+            formats::f0123 result(void);
+
+            /**
+             * Returns the texture containing the result of the last reduction
+             * in its first element (the texture is named
+             * <tt>reduce_ping</tt> or <tt>reduce_pong</tt>).
+             */
+            const texture *output(void) const
+            { return last; }
+
+
+        private:
+            /// Creates intermediate textures and render objects.
+            void setup(const char *combine, const char *element, int width, int height);
+            /// Returns the RPS expression for a per-channel operation.
+            static const char *channel_op(operation op, const char *channel);
+
+
+            /// Intermediate textures
+            texture *ping, *pong;
+            /// Texture containing the result
+            const texture *last;
+
+            /// Reduces the source texture into <tt>ping</tt>.
+            render *first;
+            /// Reduces <tt>ping</tt> into <tt>pong</tt>.
+            render *ping_pong;
+            /// Reduces <tt>pong</tt> into <tt>ping</tt>.
+            render *pong_ping;
+            /// Source texture input slot of <tt>first</tt>
+            int src_slot;
+
+            /// Number of valid elements in the current source texture
+            types::named<types::vec2> src_size;
+            /// Dimensions of the current source texture
+            types::named<types::vec2> src_tex_size;
+
+            /// Pixel buffer object receiving the result (0 if unsupported)
+            GLuint pbo;
+            /// Fence signaled when the result has arrived
+            GLsync fence;
+            /// Result (iff already read back)
+            formats::f0123 value;
+            /// True iff <tt>value</tt> is valid
+            bool have_value;
+    };
+
+
+    /**
+     * Parallel prefix scan. Computes the exclusive prefix sum (per channel) of
+     * a texture, whose elements are taken in row-major order (i.e., element
+     * <tt>(x, y)</tt> has the index <tt>y * width + x</tt>).
+     *
+     * The rows are scanned in parallel first (Hillis-Steele, one render pass
+     * per power of two below the width), followed by a scan of the row totals
+     * and a final pass combining both.
+     */
+    class scan
+    {
+        public:
+            /**
+             * Creates a scan object.
+             *
+             * @param width Width of the textures to be scanned (defaults to
+             *              fundamental width).
+             * @param height Height of the textures to be scanned (defaults to
+             *               fundamental height).
+             */
+            scan(int width = -1, int height = -1);
+
+            /// Basic destructor.
+            ~scan(void);
+
+
+            /**
+             * Scans a texture. The result is available through
+             * <tt>output()</tt> afterwards.
+             *
+             * @param tex Texture to be scanned; it must have exactly the size
+             *            specified at construction.
+             */
+            void operator()(const texture *tex);
+
+            /// Returns the texture containing the exclusive prefix sums (named
+            /// <tt>scanned</tt>).
+            const texture *output(void) const
+            { return result; }
+
+            /**
+             * Returns the sum of all elements of the last texture scanned
+             * (reads back a single element).
+             */
+            formats::f0123 total(void);
+
+            /**
+             * Returns the texture containing the inclusive prefix sums of the
+             * row totals (one element per row; the last one is the sum of all
+             * elements).
+             */
+            const texture *row_offsets(void) const
+            { return col_last; }
+
+
+        private:
+            /**
+             * Runs one Hillis-Steele step from <tt>src</tt> to <tt>dst</tt>
+             * for the given offset and direction.
+             */
+            void step(const texture *src, const texture *dst, int offset, bool vertical);
+
+
+            /// Width and height of the textures to be scanned
+            int width, height;
+
+            /// Intermediate row scan textures
+            texture *row_ping, *row_pong;
+            /// Intermediate row total scan textures
+            texture *col_ping, *col_pong;
+            /// Last row total scan texture written to
+            const texture *col_last;
+            /// Result texture
+            texture *result;
+
+            /// Hillis-Steele step render object
+            render *rnd_step;
+            /// Row total extraction render object
+            render *rnd_totals;
+            /// Final combination render object
+            render *rnd_final;
+
+            /// Input slots of the render objects
+            int step_slot, totals_slot, final_row_slot, final_col_slot;
+
+            /// FBO with the last row total scan texture attached (for
+            /// reading back the total)
+            GLuint total_fbo;
+
+            /// Current Hillis-Steele offset
+            types::named<float> offset;
+            /// Current Hillis-Steele direction
+            types::named<types::vec2> direction;
+            /// Dimensions of the current source texture
+            types::named<types::vec2> src_size;
+            /// Dimensions of the textures to be scanned
+            types::named<types::vec2> size;
+    };
+
+
+    /**
+     * Stream compaction. Evaluates an RPS predicate for every element and
+     * writes a value for every element fulfilling it densely into an output
+     * texture (in row-major order, keeping the original order). Follow-up
+     * passes may then be restricted to the first <tt>count()</tt> elements
+     * of that texture.
+     */
+    class compact
+    {
+        public:
+            /**
+             * Creates a compaction object.
+             *
+             * @param input Input objects used by the predicate and the value.
+             * @param predicate RPS boolean expression; true for elements to be
+             *                  kept.
+             * @param value RPS expression for the <tt>vec4</tt> to be written
+             *              for every element kept. It is evaluated for the
+             *              original element, i.e., <tt>tex_coord</tt> and all
+             *              input textures refer to that element. Defaults to
+             *              the element's texture coordinates
+             *              (<tt>vec4(tex_coord, 0., 1.)</tt>).
+             * @param width Width of the area to be compacted (defaults to
+             *              fundamental width).
+             * @param height Height of the area to be compacted (defaults to
+             *               fundamental height).
+             *
+             * @note Elements of the output texture beyond the last element
+             *       kept are set to zero.
+             */
+            compact(std::initializer_list<const in *> input, const char *predicate, const char *value = NULL, int width = -1, int height = -1);
+
+            /// Basic destructor.
+            ~compact(void);
+
+
+            /// Carries out the compaction.
+            void operator()(void);
+
+            /// Returns the number of elements kept (reads back one element).
+            int count(void);
+
+            /// Returns the compacted texture (named <tt>compacted</tt>).
+            const texture *output(void) const
+            { return result; }
+
+            /**
+             * Returns the predicate flags (1 for elements kept, 0 otherwise;
+             * named <tt>compact_flags</tt>).
+             */
+            const texture *selection(void) const
+            { return flags; }
+
+            /**
+             * Returns the exclusive prefix sum of the predicate flags, i.e.,
+             * every element kept contains its index in the compacted texture
+             * (named <tt>scanned</tt>).
+             */
+            const texture *indices(void) const
+            { return flag_scan->output(); }
+
+
+        private:
+            /// Width and height of the area to be compacted
+            int width, height;
+
+            /// Predicate flags (1 for elements kept)
+            texture *flags;
+            /// Compacted result
+            texture *result;
+
+            /// Scan of the flags
+            scan *flag_scan;
+
+            /// Predicate evaluation render object
+            render *rnd_flags;
+            /// Gathering render object
+            render *rnd_gather;
+
+            /// Input slots of the gathering render object
+            int scan_slot, offsets_slot;
+
+            /// Dimensions of the area to be compacted
+            types::named<types::vec2> size;
+    };
+
+
+    /**
+     * GPU sort. Sorts the elements of a texture by one of their channels (the
+     * key), the other three channels are carried along as payload (e.g., an
+     * index into further textures). The result is stored in row-major order.
+     *
+     * By default, a bitonic sorting network is run as a series of render
+     * passes; after <tt>use_compute()</tt>, an LSD radix sort (4 bits per
+     * pass) is done with compute shaders instead. The latter is stable, the
+     * former is not.
+     */
+    class sort
+    {
+        public:
+            /**
+             * Creates a sort object.
+             *
+             * @param key Index of the key channel (0 to 3).
+             * @param descending Sorts in descending instead of ascending
+             *                   order.
+             * @param width Width of the textures to be sorted (defaults to
+             *              fundamental width).
+             * @param height Height of the textures to be sorted (defaults to
+             *               fundamental height).
+             *
+             * @note Indices are calculated with floating point numbers in the
+             *       bitonic sort, so there may be at most 2^24 elements.
+             */
+            sort(int key = 0, bool descending = false, int width = -1, int height = -1);
+
+            /// Basic destructor.
+            ~sort(void);
+
+
+            /**
+             * Switches to the radix sort on compute shaders.
+             *
+             * @return true iff compute shaders are available (OpenGL 4.3);
+             *         otherwise, the bitonic sort will still be used.
+             */
+            bool use_compute(void);
+
+            /**
+             * Sorts a texture. The result is available through
+             * <tt>output()</tt> afterwards.
+             *
+             * @param tex Texture to be sorted; it must have exactly the size
+             *            specified at construction.
+             */
+            void operator()(const texture *tex);
+
+            /**
+             * Returns the texture containing the sorted elements (named
+             * <tt>sorted</tt>). Which of the intermediate textures this is
+             * depends only on the size and the algorithm used.
+             */
+            const texture *output(void) const
+            { return last; }
+
+
+        private:
+            /// Runs one step of the bitonic sorting network.
+            void bitonic_step(const texture *src, const texture *dst, int k, int j);
+
+            /// Runs the radix sort.
+            void radix(const texture *tex);
+
+
+            /// Width and height of the textures to be sorted
+            int width, height;
+            /// Key channel
+            int key;
+            /// Sorts in descending order
+            bool descending;
+
+            /// Intermediate textures
+            texture *ping, *pong;
+            /// Last texture written to
+            const texture *last;
+
+            /// Bitonic step render object
+            render *rnd_step;
+            /// Input slot of the bitonic step
+            int step_slot;
+
+            /// Current bitonic block size
+            types::named<float> block;
+            /// Current bitonic comparison distance (0 for the mirroring step)
+            types::named<float> distance;
+            /// Dimensions of the textures to be sorted
+            types::named<types::vec2> size;
+
+            /// Radix sort programs (histogram, scan, scatter; NULL when the
+            /// bitonic sort is used)
+            internals::program *histogram, *scan_counts, *scatter;
+            /// Per-work-group digit counts
+            GLuint counts;
+    };
+
+
     /**
      * Allows rendering to screen. You may want to display your result on
      * screen, e.g. via the <tt>texture::display()</tt> function. This function
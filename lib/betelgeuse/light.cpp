@@ -1,3 +1,5 @@
+#include <cstring>
+
 #include <macs/macs.hpp>
 
 #include "betelgeuse.hpp"
@@ -15,11 +17,35 @@ light::light(const char *atten_fnc):
     atten_par("attenuation_parameter", 0.f),
     shade(NULL),
     atten_func(atten_fnc),
-    shadow_map("shadow_map")
+    shadow_map(NULL),
+    shadow_lowres(NULL),
+    static_shadow(NULL),
+    contribution(NULL)
 {
+    is_static = false;
+    static_valid = false;
+
+    rendered = false;
+    contribution_valid = false;
 }
 
 light::~light(void)
 {
     delete shade;
+    delete shadow_map;
+    delete shadow_lowres;
+    delete static_shadow;
+    delete contribution;
+}
+
+
+void light::state(float *dst) const
+{
+    memcpy(&dst[0], (*position).d, sizeof(float) * 4);
+    memcpy(&dst[4], (*direction).d, sizeof(float) * 3);
+    memcpy(&dst[7], (*color).d, sizeof(float) * 3);
+
+    dst[10] = *distr_exp;
+    dst[11] = *limit_angle_cos;
+    dst[12] = *atten_par;
 }
@@ -1,6 +1,9 @@
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <list>
+#include <thread>
+#include <vector>
 
 #include <macs/macs.hpp>
 
@@ -17,23 +20,12 @@ extern void asprintf(char **dst, const char *format, ...);
 
 object::object(const char *min_isct, const char *line_isct, const char *uv, const char *norm, const char *tang):
     isct(NULL),
-    cur_trans("mat_transformation", mat4()),
     cur_inv_trans("mat_inverse_transformation", mat4()),
-    cur_normal("mat_normal", mat3()),
-    cur_ambient_flat_tex("ambient_switch", false),
-    cur_mirror_flat_tex("mirror_switch", false),
-    cur_refract_flat_tex("refract_switch", false),
-    cur_ambient_flat("ambient_flat", vec3()),
-    cur_mirror_flat("mirror_flat", vec3()),
-    cur_refract_flat("refract_flat", vec4()),
-    cur_color0_flat_tex("color0_switch", false),
-    cur_rp0_flat_tex("rp0_switch", false),
-    cur_color0_flat("color0_flat", vec3()),
-    cur_rp0_flat("rp0_flat", vec2()),
-    cur_color1_flat_tex("color1_switch", false),
-    cur_rp1_flat_tex("rp1_switch", false),
-    cur_color1_flat("color1_flat", vec3()),
-    cur_rp1_flat("rp1_flat", vec2()),
+    type_index("object_index", 0.f),
+    inst_count("instance_count", 0.f),
+    inst_rows("instance_rows", 0.f),
+    inst_table(NULL),
+    inst_data(NULL),
     shadow(NULL)
 {
     if (tang != NULL)
@@ -59,6 +51,9 @@ object::~object(void)
 
     delete isct;
     delete shadow;
+
+    delete inst_table;
+    delete[] inst_data;
 }
 
 
@@ -67,6 +62,7 @@ instance *object::instantiate(void)
     instance *i = new instance(this);
 
     i->mat.ambient_texed = i->mat.mirror_texed = i->mat.refract_texed = false;
+    i->mat.n = 1.f;
     i->mat.layer[0].color_texed = i->mat.layer[0].rp_texed = false;
     i->mat.layer[1].color_texed = i->mat.layer[1].rp_texed = false;
 
@@ -87,19 +83,627 @@ instance *object::instantiate(void)
 
 
 instance::instance(object *o):
+    structure(general),
+    material_index(-1),
     cast_shadows(true),
-    obj(o)
+    is_static(false),
+    world_structure(general),
+    obj(o),
+    parent(NULL),
+    root(this),
+    dirty(false),
+    flat_valid(false),
+    pending(false)
 {
 }
 
 instance::~instance(void)
 {
+    set_parent(NULL);
+
+    // The children become roots of their own hierarchies
+    for (auto c: children)
+    {
+        c->parent = NULL;
+        c->set_root(c);
+        c->flat_valid = false;
+        c->invalidate_world();
+    }
+
     obj->insts.remove(this);
 }
 
 void instance::update_transformation(void)
 {
-    inv_trans = trans.inv();
-    normal = mat3(inv_trans.transposed());
+    if ((parent == NULL) && children.empty())
+        compute_world();
+    else
+        invalidate_world();
+}
+
+void instance::scale(const vec3 &v)
+{
+    trans.scale(v);
+
+    transform_structure s = affine;
+
+    if ((v.x == v.y) && (v.y == v.z))
+        s = (v.x == 1.f) ? rigid : uniform_scale;
+
+    if (s > structure)
+        structure = s;
+}
+
+
+/**
+ * Computes the inverse and the normal matrix (transposed inverse) of m with
+ * the cheapest formula that is exact for the given structure.
+ */
+static void invert(const mat4 &m, instance::transform_structure s, mat4 &inv, mat3 &normal)
+{
+    if (s == instance::general)
+    {
+        inv = m.inv();
+        normal = mat3(inv.transposed());
+        return;
+    }
+
+
+    const float *a = m.d;
+    float *b = inv.d;
+
+    if (s == instance::affine)
+    {
+        // The rows of the inverse 3x3 matrix are the cross products of its
+        // columns divided by the determinant
+        float x[9] = {
+            a[5] * a[10] - a[ 6] * a[9], a[ 6] * a[8] - a[4] * a[10], a[4] * a[9] - a[5] * a[8],
+            a[9] * a[ 2] - a[10] * a[1], a[10] * a[0] - a[8] * a[ 2], a[8] * a[1] - a[9] * a[0],
+            a[1] * a[ 6] - a[ 2] * a[5], a[ 2] * a[4] - a[0] * a[ 6], a[0] * a[5] - a[1] * a[4]
+        };
+
+        float det = a[0] * x[0] + a[1] * x[1] + a[2] * x[2];
+
+        if (!det)
+            abort();
+
+        float rdet = 1.f / det;
+
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 3; j++)
+                b[j * 4 + i] = x[i * 3 + j] * rdet;
+    }
+    else
+    {
+        // The 3x3 matrix is a rotation times s, so its inverse is its
+        // transpose divided by s^2
+        float rs2 = (s == instance::rigid) ? 1.f : 1.f / (a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 3; j++)
+                b[j * 4 + i] = a[i * 4 + j] * rs2;
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        b[i * 4 + 3] = 0.f;
+        b[12 + i] = -(b[i] * a[12] + b[4 + i] * a[13] + b[8 + i] * a[14]);
+    }
+
+    b[15] = 1.f;
+
+    for (int c = 0; c < 3; c++)
+        for (int r = 0; r < 3; r++)
+            normal.d[c * 3 + r] = b[r * 4 + c];
+}
+
+void instance::compute_world(void)
+{
+    if (parent != NULL)
+    {
+        world = parent->world * trans;
+        world_structure = std::max(parent->world_structure, structure);
+    }
+    else
+    {
+        world = trans;
+        world_structure = structure;
+    }
+
+    invert(world, world_structure, inv_trans, normal);
+
+    dirty = false;
+}
+
+void instance::invalidate_world(void)
+{
+    dirty = true;
+    root->pending = true;
+}
+
+
+void instance::set_parent(instance *parent_inst)
+{
+    if (parent_inst == parent)
+        return;
+
+    for (instance *p = parent_inst; p != NULL; p = p->parent)
+        if (p == this)
+            abort();
+
+    if (parent != NULL)
+    {
+        parent->children.erase(std::find(parent->children.begin(), parent->children.end(), this));
+        root->flat_valid = false;
+    }
+
+    parent = parent_inst;
+
+    if (parent != NULL)
+        parent->children.push_back(this);
+
+    set_root((parent != NULL) ? parent->root : this);
+
+    root->flat_valid = false;
+    invalidate_world();
+}
+
+void instance::set_root(instance *new_root)
+{
+    root = new_root;
+
+    for (auto c: children)
+        c->set_root(new_root);
+}
+
+void instance::flatten(std::vector<instance *> &order, std::vector<size_t> &end)
+{
+    size_t index = order.size();
+
+    order.push_back(this);
+    end.push_back(0);
+
+    for (auto c: children)
+        c->flatten(order, end);
+
+    end[index] = order.size();
+}
+
+void instance::update_world(void)
+{
+    instance *r = root;
+
+    if (!r->pending)
+        return;
+
+    if (!r->flat_valid)
+    {
+        r->flat.clear();
+        r->flat_end.clear();
+
+        r->flatten(r->flat, r->flat_end);
+
+        r->flat_valid = true;
+    }
+
+    // Parents precede their descendants, so when a dirty instance is found,
+    // its whole subtree (the range up to flat_end) can be recomputed in order
+    for (size_t i = 0; i < r->flat.size();)
+    {
+        if (!r->flat[i]->dirty)
+        {
+            i++;
+            continue;
+        }
+
+        for (size_t end = r->flat_end[i]; i < end; i++)
+            r->flat[i]->compute_world();
+    }
+
+    r->pending = false;
+}
+
+
+/**
+ * Splits [0, count) into ranges of whole groups of four and hands them to
+ * fn(begin, end), one range per thread (the calling thread takes the first).
+ * Returns true if fn returned true for any range.
+ */
+template<typename F> static bool run_batch(size_t count, int threads, F fn)
+{
+    if (threads <= 0)
+        threads = std::thread::hardware_concurrency();
+
+    size_t max_threads = (count + instance::batch_per_thread - 1) / instance::batch_per_thread;
+
+    if ((threads <= 0) || (static_cast<size_t>(threads) > max_threads))
+        threads = max_threads;
+
+    if (threads <= 1)
+        return fn(0, count);
+
+
+    size_t per_thread = ((count + threads - 1) / threads + 3) & ~static_cast<size_t>(3);
+    std::vector<std::thread> workers;
+    std::vector<char> results(threads, false);
+
+    for (size_t begin = per_thread, t = 1; begin < count; begin += per_thread, t++)
+    {
+        size_t end = std::min(begin + per_thread, count);
+        workers.push_back(std::thread([&fn, &results, begin, end, t]() { results[t] = fn(begin, end); }));
+    }
+
+    results[0] = fn(0, std::min(per_thread, count));
+
+    for (auto &w: workers)
+        w.join();
+
+    return std::find(results.begin(), results.end(), true) != results.end();
+}
+
+
+void instance::update_transformations(instance *const *insts, const mat4 *trans, size_t count, int threads)
+{
+    if (run_batch(count, threads, [=](size_t begin, size_t end) { return update_batch(insts, trans, begin, end); }))
+        mark_pending(insts, count);
+}
+
+void instance::update_transformations(instance *const *insts, const vec3 *translation, const vec4 *rotation,
+                                      const vec3 *scale, size_t count, int threads)
+{
+    if (run_batch(count, threads, [=](size_t begin, size_t end) { return update_batch(insts, translation, rotation, scale, begin, end); }))
+        mark_pending(insts, count);
+}
+
+void instance::mark_pending(instance *const *insts, size_t count)
+{
+    // The batch only marks the instances themselves, as their roots may be
+    // shared between threads
+    for (size_t i = 0; i < count; i++)
+        if (insts[i]->dirty)
+            insts[i]->root->pending = true;
 }
 
+
+/// Loads four matrices into a structure of arrays (element x of matrix l is
+/// soa[x][l]).
+static void load_soa(const mat4 *src, float (*soa)[4])
+{
+#ifdef MACS_SIMD
+    for (int c = 0; c < 4; c++)
+    {
+        __m128 c0 = _mm_loadu_ps(&src[0].d[c * 4]), c1 = _mm_loadu_ps(&src[1].d[c * 4]);
+        __m128 c2 = _mm_loadu_ps(&src[2].d[c * 4]), c3 = _mm_loadu_ps(&src[3].d[c * 4]);
+
+        _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+
+        _mm_store_ps(soa[c * 4 + 0], c0);
+        _mm_store_ps(soa[c * 4 + 1], c1);
+        _mm_store_ps(soa[c * 4 + 2], c2);
+        _mm_store_ps(soa[c * 4 + 3], c3);
+    }
+#else
+    for (int l = 0; l < 4; l++)
+        for (int x = 0; x < 16; x++)
+            soa[x][l] = src[l].d[x];
+#endif
+}
+
+/// Stores four matrices from a structure of arrays.
+static inline void store_soa(const float (*soa)[4], mat4 *const *dst)
+{
+#ifdef MACS_SIMD
+    for (int c = 0; c < 4; c++)
+    {
+        __m128 c0 = _mm_load_ps(soa[c * 4 + 0]), c1 = _mm_load_ps(soa[c * 4 + 1]);
+        __m128 c2 = _mm_load_ps(soa[c * 4 + 2]), c3 = _mm_load_ps(soa[c * 4 + 3]);
+
+        _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+
+        _mm_storeu_ps(&dst[0]->d[c * 4], c0);
+        _mm_storeu_ps(&dst[1]->d[c * 4], c1);
+        _mm_storeu_ps(&dst[2]->d[c * 4], c2);
+        _mm_storeu_ps(&dst[3]->d[c * 4], c3);
+    }
+#else
+    for (int l = 0; l < 4; l++)
+        for (int x = 0; x < 16; x++)
+            dst[l]->d[x] = soa[x][l];
+#endif
+}
+
+/// Stores the first lanes matrices from a structure of arrays.
+static void store_soa(const float (*soa)[4], mat4 *const *dst, int lanes)
+{
+    if (lanes == 4)
+    {
+        store_soa(soa, dst);
+        return;
+    }
+
+    for (int l = 0; l < lanes; l++)
+        for (int x = 0; x < 16; x++)
+            dst[l]->d[x] = soa[x][l];
+}
+
+/// Writes the normal matrices (transposed inverses) of the first lanes
+/// instances from their inverses in a structure of arrays.
+static void store_normal_soa(const float (*inv)[4], mat3 *const *dst, int lanes)
+{
+    for (int l = 0; l < lanes; l++)
+        for (int c = 0; c < 3; c++)
+            for (int r = 0; r < 3; r++)
+                dst[l]->d[c * 3 + r] = inv[r * 4 + c][l];
+}
+
+
+void instance::prefetch(const instance *inst)
+{
+#ifdef MACS_SIMD
+    // parent and dirty share cache lines with normal and children
+    _mm_prefetch(reinterpret_cast<const char *>(&inst->trans), _MM_HINT_T0);
+    _mm_prefetch(reinterpret_cast<const char *>(&inst->structure), _MM_HINT_T0);
+    _mm_prefetch(reinterpret_cast<const char *>(&inst->world), _MM_HINT_T0);
+    _mm_prefetch(reinterpret_cast<const char *>(&inst->inv_trans), _MM_HINT_T0);
+    _mm_prefetch(reinterpret_cast<const char *>(&inst->normal), _MM_HINT_T0);
+    _mm_prefetch(reinterpret_cast<const char *>(&inst->children), _MM_HINT_T0);
+#else
+    (void)inst;
+#endif
+}
+
+
+// Element e of lane l (structure of arrays)
+#define e(x) m[x][l]
+#define cof(a1, a2, a3, a4, a5, a6, a7, a8, a9, aA, aB, aC, aD, aE, aF) \
+        (e(a1) * (e(a2) * e(a3) - e(a4) * e(a5)) + \
+         e(a6) * (e(a7) * e(a8) - e(a9) * e(aA)) + \
+         e(aB) * (e(aC) * e(aD) - e(aE) * e(aF)))
+
+bool instance::update_batch(instance *const *insts, const mat4 *trans, size_t begin, size_t end)
+{
+    // Updates insts[0, lanes) from the four matrices src; returns true if
+    // any of them is part of a hierarchy
+    auto group = [](instance *const *g, const mat4 *src, int lanes)
+    {
+        alignas(16) float m[16][4], inv[16][4];
+
+        load_soa(src, m);
+
+        // Cofactors as in mat4::inv() (scalar version)
+        for (int l = 0; l < 4; l++)
+        {
+            inv[ 0][l] = cof( 5, 10, 15, 14, 11,    9, 14,  7,  6, 15,   13,  6, 11, 10,  7);
+            inv[ 1][l] = cof( 1, 14, 11, 10, 15,    9,  2, 15, 14,  3,   13, 10,  3,  2, 11);
+            inv[ 2][l] = cof( 1,  6, 15, 14,  7,    5, 14,  3,  2, 15,   13,  2,  7,  6,  3);
+            inv[ 3][l] = cof( 1, 10,  7,  6, 11,    5,  2, 11, 10,  3,    9,  6,  3,  2,  7);
+            inv[ 4][l] = cof( 4, 14, 11, 10, 15,    8,  6, 15, 14,  7,   12, 10,  7,  6, 11);
+            inv[ 5][l] = cof( 0, 10, 15, 14, 11,    8, 14,  3,  2, 15,   12,  2, 11, 10,  3);
+            inv[ 6][l] = cof( 0, 14,  7,  6, 15,    4,  2, 15, 14,  3,   12,  6,  3,  2,  7);
+            inv[ 7][l] = cof( 0,  6, 11, 10,  7,    4, 10,  3,  2, 11,    8,  2,  7,  6,  3);
+            inv[ 8][l] = cof( 4,  9, 15, 13, 11,    8, 13,  7,  5, 15,   12,  5, 11,  9,  7);
+            inv[ 9][l] = cof( 0, 13, 11,  9, 15,    8,  1, 15, 13,  3,   12,  9,  3,  1, 11);
+            inv[10][l] = cof( 0,  5, 15, 13,  7,    4, 13,  3,  1, 15,   12,  1,  7,  5,  3);
+            inv[11][l] = cof( 0,  9,  7,  5, 11,    4,  1, 11,  9,  3,    8,  5,  3,  1,  7);
+            inv[12][l] = cof( 4, 13, 10,  9, 14,    8,  5, 14, 13,  6,   12,  9,  6,  5, 10);
+            inv[13][l] = cof( 0,  9, 14, 13, 10,    8, 13,  2,  1, 14,   12,  1, 10,  9,  2);
+            inv[14][l] = cof( 0, 13,  6,  5, 14,    4,  1, 14, 13,  2,   12,  5,  2,  1,  6);
+            inv[15][l] = cof( 0,  5, 10,  9,  6,    4,  9,  2,  1, 10,    8,  1,  6,  5,  2);
+        }
+
+        alignas(16) float rdet[4];
+
+        for (int l = 0; l < 4; l++)
+            rdet[l] = e(0) * inv[0][l] + e(4) * inv[1][l] + e(8) * inv[2][l] + e(12) * inv[3][l];
+
+        // One branch for the whole group
+        if ((rdet[0] == 0.f) | (rdet[1] == 0.f) | (rdet[2] == 0.f) | (rdet[3] == 0.f))
+            abort();
+
+        for (int l = 0; l < 4; l++)
+            rdet[l] = 1.f / rdet[l];
+
+        for (int x = 0; x < 16; x++)
+            for (int l = 0; l < 4; l++)
+                inv[x][l] *= rdet[l];
+
+
+        mat4 *dst_inv[4];
+        mat3 *dst_normal[4];
+        bool hierarchy = false;
+
+        for (int l = 0; l < lanes; l++)
+        {
+            instance *inst = g[l];
+
+            inst->trans = inst->world = src[l];
+            inst->structure = inst->world_structure = general;
+
+            dst_inv[l] = &inst->inv_trans;
+            dst_normal[l] = &inst->normal;
+
+            // Treated as a root here; update_world() fixes it up
+            if ((inst->parent != NULL) || !inst->children.empty())
+                hierarchy = inst->dirty = true;
+        }
+
+        store_soa(inv, dst_inv, lanes);
+        store_normal_soa(inv, dst_normal, lanes);
+
+        return hierarchy;
+    };
+
+
+    bool hierarchy = false;
+    size_t i = begin;
+
+    for (; end - i >= 4; i += 4)
+    {
+        if (end - i >= 8)
+            for (int l = 4; l < 8; l++)
+                prefetch(insts[i + l]);
+
+        hierarchy |= group(&insts[i], &trans[i], 4);
+    }
+
+    if (i < end)
+    {
+        // Pad the last group with identities
+        mat4 pad[4];
+
+        std::copy(&trans[i], &trans[end], pad);
+        hierarchy |= group(&insts[i], pad, end - i);
+    }
+
+    return hierarchy;
+}
+
+#undef cof
+#undef e
+
+bool instance::update_batch(instance *const *insts, const vec3 *translation, const vec4 *rotation,
+                            const vec3 *scale, size_t begin, size_t end)
+{
+    // Updates insts[0, lanes) from the four components t/q/s; returns true
+    // if any of them is part of a hierarchy
+    auto group = [](instance *const *g, const vec3 *tv, const vec4 *qv, const vec3 *sv, int lanes)
+    {
+        float t[3][4], q[4][4], s[3][4];
+
+        for (int l = 0; l < 4; l++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                t[c][l] = tv[l].d[c];
+                s[c][l] = sv[l].d[c];
+            }
+
+            for (int c = 0; c < 4; c++)
+                q[c][l] = qv[l].d[c];
+        }
+
+        // One branch for the whole group
+        bool zero = false;
+
+        for (int c = 0; c < 3; c++)
+            for (int l = 0; l < 4; l++)
+                zero |= (s[c][l] == 0.f);
+
+        if (zero)
+            abort();
+
+
+        // Rotation matrix R (column-major) and reciprocal scale
+        float rm[9][4], rs[3][4];
+
+        for (int l = 0; l < 4; l++)
+        {
+            float x = q[0][l], y = q[1][l], z = q[2][l], w = q[3][l];
+
+            rm[0][l] = 1.f - 2.f * (y * y + z * z);
+            rm[1][l] =       2.f * (x * y + w * z);
+            rm[2][l] =       2.f * (x * z - w * y);
+            rm[3][l] =       2.f * (x * y - w * z);
+            rm[4][l] = 1.f - 2.f * (x * x + z * z);
+            rm[5][l] =       2.f * (y * z + w * x);
+            rm[6][l] =       2.f * (x * z + w * y);
+            rm[7][l] =       2.f * (y * z - w * x);
+            rm[8][l] = 1.f - 2.f * (x * x + y * y);
+
+            rs[0][l] = 1.f / s[0][l];
+            rs[1][l] = 1.f / s[1][l];
+            rs[2][l] = 1.f / s[2][l];
+        }
+
+        // M = T * R * S: column c is R's column c times s[c].
+        // M^-1 = S^-1 * R^T * T^-1: row c is R's column c divided by s[c].
+        alignas(16) float m[16][4], inv[16][4];
+
+        for (int c = 0; c < 3; c++)
+        {
+            for (int r = 0; r < 3; r++)
+                for (int l = 0; l < 4; l++)
+                {
+                    m[c * 4 + r][l] = rm[c * 3 + r][l] * s[c][l];
+                    inv[r * 4 + c][l] = rm[c * 3 + r][l] * rs[c][l];
+                }
+
+            for (int l = 0; l < 4; l++)
+            {
+                m[c * 4 + 3][l] = inv[c * 4 + 3][l] = 0.f;
+                m[12 + c][l] = t[c][l];
+                inv[12 + c][l] = -(rm[c * 3][l] * t[0][l] + rm[c * 3 + 1][l] * t[1][l] + rm[c * 3 + 2][l] * t[2][l]) * rs[c][l];
+            }
+        }
+
+        for (int l = 0; l < 4; l++)
+            m[15][l] = inv[15][l] = 1.f;
+
+
+        mat4 *dst_trans[4], *dst_world[4], *dst_inv[4];
+        mat3 *dst_normal[4];
+        bool hierarchy = false;
+
+        for (int l = 0; l < lanes; l++)
+        {
+            instance *inst = g[l];
+
+            if ((s[0][l] == s[1][l]) && (s[1][l] == s[2][l]))
+                inst->structure = (s[0][l] == 1.f) ? rigid : uniform_scale;
+            else
+                inst->structure = affine;
+
+            inst->world_structure = inst->structure;
+
+            dst_trans[l] = &inst->trans;
+            dst_world[l] = &inst->world;
+            dst_inv[l] = &inst->inv_trans;
+            dst_normal[l] = &inst->normal;
+
+            // Treated as a root here; update_world() fixes it up
+            if ((inst->parent != NULL) || !inst->children.empty())
+                hierarchy = inst->dirty = true;
+        }
+
+        store_soa(m, dst_trans, lanes);
+        store_soa(m, dst_world, lanes);
+        store_soa(inv, dst_inv, lanes);
+        store_normal_soa(inv, dst_normal, lanes);
+
+        return hierarchy;
+    };
+
+
+    bool hierarchy = false;
+    size_t i = begin;
+
+    for (; end - i >= 4; i += 4)
+    {
+        if (end - i >= 8)
+            for (int l = 4; l < 8; l++)
+                prefetch(insts[i + l]);
+
+        hierarchy |= group(&insts[i], &translation[i], &rotation[i], &scale[i], 4);
+    }
+
+    if (i < end)
+    {
+        // Pad the last group with identities
+        vec3 pad_t[4], pad_s[4];
+        vec4 pad_q[4];
+
+        for (int l = 0; l < 4; l++)
+        {
+            pad_s[l] = vec3(1.f, 1.f, 1.f);
+            pad_q[l] = vec4(0.f, 0.f, 0.f, 1.f);
+        }
+
+        std::copy(&translation[i], &translation[end], pad_t);
+        std::copy(&rotation[i], &rotation[end], pad_q);
+        std::copy(&scale[i], &scale[end], pad_s);
+
+        hierarchy |= group(&insts[i], pad_t, pad_q, pad_s, end - i);
+    }
+
+    return hierarchy;
+}
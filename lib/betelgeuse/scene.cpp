@@ -1,4 +1,10 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
 #include <list>
+#include <string>
+#include <vector>
 
 #include <macs/macs.hpp>
 #include <macs/macs-internals.hpp>
@@ -15,7 +21,63 @@ extern void asprintf(char **dst, const char *format, ...);
 #endif
 
 
-scene::scene(void):
+/**
+ * Layout of one instance table row: the transformation matrix (four columns),
+ * its inverse (four columns), the normal matrix (three columns, the W
+ * component of the first one is 1 iff the instance casts shadows) and the
+ * material (see scene::pack_material()).
+ */
+#define INSTANCE_FIELDS 18
+/// Number of instance table elements used by a material.
+#define MATERIAL_FIELDS 7
+
+
+/// Instance table access functions for the intersection RPS.
+static const char *instance_table_src =
+    "vec4 instance_field(float inst, float field)\n"
+    "{\n"
+    "    return texture2D(raw_instance_table, vec2((field + .5) / 18., (inst + .5) / instance_rows));\n"
+    "}\n\n"
+    "vec4 material_channel(vec4 flat, float layer, vec2 uv)\n"
+    "{\n"
+    "    return (layer < 0.) ? flat : texture2DArray(raw_material_textures, vec3(uv, layer));\n"
+    "}\n";
+
+
+/// Names of the G-buffer textures (see scene::gbuffer).
+static const char *gbuffer_names[] = {
+    "global_intersection", "normal_map", "tangent_map", "ambient_map", "mirror_map", "refract_map", "uv_map",
+    "color0_map", "color1_map", "rp_map", "stencil"
+};
+
+/// Indices of some G-buffer textures.
+enum
+{
+    gbuffer_isct = 0,
+    gbuffer_normal = 1,
+    gbuffer_ambient = 3,
+    gbuffer_mirror = 4,
+    gbuffer_refract = 5,
+    gbuffer_stencil = 10
+};
+
+
+/// Returns element i of the Halton sequence with the given base.
+static float halton(int i, int base)
+{
+    float f = 1.f, r = 0.f;
+
+    for (; i > 0; i /= base)
+    {
+        f /= base;
+        r += f * (i % base);
+    }
+
+    return r;
+}
+
+
+scene::scene(int mat_textures, int mat_res):
     output("output"),
 
     aspect(1.f),
@@ -35,18 +97,100 @@ scene::scene(void):
     color0_map("color0_map"), color1_map("color1_map"), rp_map("rp_map"),
     asten("stencil"),
 
-    cur_light_pos("light_pos", vec4())
+    invalid(true),
+    shadows_invalid(true),
+
+    cur_light_pos("light_pos", vec4()),
+
+    static_stale(NULL),
+    rnd_static_stale(NULL), rnd_static_clear(NULL), rnd_shadow_init(NULL),
+
+    shadow_stats(false),
+    shadow_saved(0),
+
+    shadow_interleaved(false),
+    shadow_shared(NULL), shadow_shared_lowres(NULL),
+
+    shadow_div(1),
+    shadow_size("shadow_size", vec2()),
+    shadow_scale("shadow_scale", vec2()),
+    shadow_isct(NULL), shadow_norm(NULL), shadow_asten(NULL),
+    rnd_shadow_down(NULL), rnd_shadow_up(NULL),
+
+    res_scale(1.f), res_target(0.f), res_min(.5f), res_max(1.f),
+    render_w(0), render_h(0),
+    view_scale("view_scale", vec2(1.f, 1.f)),
+    render_size("render_size", vec2()),
+    shadow_limit("shadow_limit", vec2()),
+
+    accum_max(0), accum_threshold(0.f), accum_samples(0), accum_converged(false),
+    view_jitter("view_jitter", vec2()),
+    accum_count("accum_count", 0.f),
+    accum_sum(NULL), accum_delta(NULL),
+    rnd_accum(NULL), rnd_accum_delta(NULL), rnd_accum_avg(NULL),
+    accum_reduce(NULL),
+    accum_reduce_pending(false),
+
+    aa_samples(0), aa_list_height(0), aa_list_rows(0),
+    aa_depth_threshold("aa_depth_threshold", .05f),
+    aa_normal_threshold("aa_normal_threshold", .9f),
+    aa_edges(NULL), aa_ray_stt(NULL), aa_ray_dir(NULL), aa_shadow(NULL), aa_color(NULL),
+    rnd_aa_edges(NULL), aa_compact(NULL), rnd_aa_rays(NULL), rnd_aa_resolve(NULL),
+
+    sec_depth(0), sec_queue_height(0),
+    sec_threshold("sec_threshold", 0.f),
+    sec_parent_size("sec_parent_size", vec2()),
+    sec_parent_limit("sec_parent_limit", vec2()),
+    sec_parent_count("sec_parent_count", 0.f),
+    sec_primary("sec_primary", 0.f),
+    sec_cand_origin(NULL), sec_cand_dir(NULL), sec_cand_info(NULL),
+    sec_ray_stt(NULL), sec_ray_dir(NULL), sec_shadow(NULL),
+    rnd_sec_spawn(NULL), sec_compact(NULL), rnd_sec_map(NULL), rnd_sec_rays(NULL), rnd_sec_resolve(NULL),
+
+    shading_cache_limit(0),
+
+    material_res(mat_res),
+    material_textures("material_textures", (mat_textures > 0) ? mat_textures : 1, false, 1, 1)
 
 {
+    memset(rendered_view, 0, sizeof(rendered_view));
+
+    GLint max_res;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_res);
+
+    if (material_res <= 0)
+        material_res = default_material_res;
+    material_res = std::min(material_res, static_cast<int>(max_res));
+
+    const macs::texture *gbuf[] = { &glob_isct, &norm_map, &tang_map, &ambient_map, &mirror_map, &refract_map, &uv_map,
+                                    &color0_map, &color1_map, &rp_map, &asten };
+    memcpy(gbuffer, gbuf, sizeof(gbuffer));
+
+    for (int i = 0; i < gbuffer_size; i++)
+        aa_gbuffer[i] = sec_gbuffer[i] = NULL;
+
+    static_isct[0] = static_isct[1] = NULL;
+
+    frame_timer = 0;
+    frame_timer_pending = false;
+
+    // Timer queries are core since OpenGL 3.3
+    if ((macs::internals::ogl_maj > 3) || ((macs::internals::ogl_maj == 3) && (macs::internals::ogl_min >= 3)))
+        glGenQueries(1, &frame_timer);
+
+    update_render_size();
+
+
+    // The view rays are spread over the rendered area only
     rnd_view = new macs::render(
-        { &cam_pos, &cam_fwd, &cam_rgt, &cam_up, &yfov, &xfov },
+        { &cam_pos, &cam_fwd, &cam_rgt, &cam_up, &yfov, &xfov, &view_scale, &view_jitter },
         { &ray_stt, &ray_dir, &asten, &sd },
         "", "",
         "cam_pos",
         "vec4(\n"
         "    normalize(\n"
-        "        (tex_coord.x * 2. - 1.) * xfov * cam_rgt +\n"
-        "        (tex_coord.y * 2. - 1.) * yfov * cam_up  +\n"
+        "        ((tex_coord.x + view_jitter.x) * view_scale.x * 2. - 1.) * xfov * cam_rgt +\n"
+        "        ((tex_coord.y + view_jitter.y) * view_scale.y * 2. - 1.) * yfov * cam_up  +\n"
         "        cam_fwd\n"
         "    ),\n"
         "    0.\n"
@@ -58,9 +202,12 @@ scene::scene(void):
     rnd_view->use_depth(true, render::always);
 
 
+    // Used for the output and for the edge anti-aliasing
+    texture_placebo amb_plac("ambient_map"), amb_sten_plac("stencil"), amb_out_plac("output");
+
     rnd_ambient = new macs::render(
-        { &ambient_map, &asten },
-        { &output },
+        { &amb_plac, &amb_sten_plac },
+        { &amb_out_plac },
         "",
         "if (stencil.x < .5)\n"
         "    discard;",
@@ -69,11 +216,105 @@ scene::scene(void):
     );
 
     rnd_ambient->blend_func(render::use, render::use);
+
+
+    texture_placebo src_plac("source"), dst_plac("resampled");
+
+    rnd_resample = new macs::render({ &src_plac }, { &dst_plac }, "", "", "source");
+
+    resample_slot = rnd_resample->slot("source");
+
+
+    texture_placebo contrib_plac("contribution");
+
+    rnd_combine = new macs::render({ &contrib_plac }, { &output }, "", "", "contribution");
+
+    rnd_combine->blend_func(render::use, render::use);
+
+    combine_slot = rnd_combine->slot("contribution");
+
+
+    // All of these work at the shadow resolution, so everything is bound
+    // through slots and placebos
+    texture_placebo stale_isct_plac("global_intersection"), stale_sten_plac("stencil"), stale_prev_plac("static_intersection");
+    texture_placebo stale_plac("static_stale"), update_plac("static_update");
+
+    rnd_static_stale = new macs::render(
+        { &stale_isct_plac, &stale_sten_plac, &stale_prev_plac },
+        { &stale_plac, &update_plac },
+        "",
+        "vec4 cur = vec4(global_intersection.xyz, stencil.x);\n"
+        "bool stale = (cur.w > .5) && (cur != static_intersection);",
+
+        "stale ? vec4(1., 0., 0., 0.) : vec4(0., 0., 0., 0.)",
+        "cur"
+    );
+
+
+    texture_placebo clear_sten_plac("stencil"), clear_map_plac("shadow_map");
+
+    rnd_static_clear = new macs::render(
+        { &clear_sten_plac },
+        { &clear_map_plac },
+        "",
+        "if (stencil.x < .5)\n"
+        "    discard;",
+
+        "vec4(0., 0., 0., 0.)"
+    );
+
+
+    // Marks the static shadows in the stencil buffer, just like the shadow
+    // passes do
+    texture_placebo init_src_plac("static_shadow"), init_map_plac("shadow_map");
+
+    rnd_shadow_init = new macs::render(
+        { &init_src_plac },
+        { &init_map_plac, &sd },
+        "",
+        "if (static_shadow.x < .5)\n"
+        "    discard;",
+
+        "vec4(1., 0., 0., 0.)", ""
+    );
+
+    rnd_shadow_init->use_stencil(true);
 }
 
 scene::~scene(void)
 {
     delete rnd_view;
+    delete rnd_resample;
+    delete rnd_combine;
+
+    delete rnd_shadow_down;
+    delete rnd_shadow_up;
+    delete shadow_isct;
+    delete shadow_norm;
+    delete shadow_asten;
+
+    delete shadow_shared;
+    delete shadow_shared_lowres;
+
+    delete rnd_static_stale;
+    delete rnd_static_clear;
+    delete rnd_shadow_init;
+    delete static_isct[0];
+    delete static_isct[1];
+    delete static_stale;
+
+    if (frame_timer)
+        glDeleteQueries(1, &frame_timer);
+
+    for (auto &q: shadow_queries)
+        glDeleteQueries(1, &q.first);
+
+    if (!shadow_query_pool.empty())
+        glDeleteQueries(shadow_query_pool.size(), shadow_query_pool.data());
+
+    set_progressive(0);
+    set_edge_aa(0);
+    set_secondary_rays(0);
 }
 
 
@@ -92,30 +333,50 @@ void scene::new_object_type(object *obj)
 {
     objs.push_back(obj);
 
-    texture_placebo amb_plac("ambient_tex"), mir_plac("mirror_tex"), ref_plac("refract_tex");
-    texture_placebo co0_plac("color0_tex"), rp0_plac("rp0_tex"), co1_plac("color1_tex"), rp1_plac("rp1_tex");
+    *obj->type_index = objs.size();
+
+    invalid = true;
+
+
+    // Rays and G-buffer are either the screen's or the edge rays' ones
+    texture_placebo inst_plac("instance_table"), stt_plac("ray_starting_points"), dir_plac("ray_directions");
+    texture_placebo *gbuf_plac[gbuffer_size];
+
+    std::vector<const in *> isct_in({ &stt_plac, &dir_plac, &zfar, &obj->type_index, &obj->inst_count, &obj->inst_rows,
+                                      &material_textures, &inst_plac });
+    std::vector<const out *> isct_out;
+
+    for (int i = 0; i < gbuffer_size; i++)
+        isct_out.push_back(gbuf_plac[i] = new texture_placebo(gbuffer_names[i]));
+
+    isct_out.push_back(&sd);
 
     obj->isct = new macs::render(
-        { &ray_stt, &ray_dir, &zfar, &obj->cur_trans, &obj->cur_inv_trans, &obj->cur_normal,
-          &obj->cur_ambient_flat_tex, &obj->cur_mirror_flat_tex, &obj->cur_refract_flat_tex,
-          &obj->cur_color0_flat_tex, &obj->cur_rp0_flat_tex,
-          &obj->cur_color1_flat_tex, &obj->cur_rp1_flat_tex,
-          &obj->cur_ambient_flat, &obj->cur_mirror_flat, &obj->cur_refract_flat,
-          &obj->cur_color0_flat, &obj->cur_rp0_flat,
-          &obj->cur_color1_flat, &obj->cur_rp1_flat,
-          &amb_plac, &mir_plac, &ref_plac, &co0_plac, &rp0_plac, &co1_plac, &rp1_plac },
-        { &glob_isct, &norm_map, &tang_map, &ambient_map, &mirror_map, &refract_map, &uv_map,
-          &color0_map, &color1_map, &rp_map, &asten, &sd },
-
-        obj->global_src,
+        isct_in, isct_out,
+
+        (std::string(obj->global_src) + instance_table_src).c_str(),
 
         "vec4 start = ray_starting_points;\n"
         "vec4 dir   = ray_directions;\n\n"
+        "float par = -1., inst = 0.;\n\n"
+        "for (int i = 0; i < int(instance_count); i++)\n"
+        "{\n"
+        "    float fi = float(i);\n"
+        "    mat4 inv = mat4(instance_field(fi, 4.), instance_field(fi, 5.), instance_field(fi, 6.), instance_field(fi, 7.));\n\n"
+        "    float p = min_intersection((inv * start).xyz, (inv * dir).xyz);\n\n"
+        "    if ((p >= .01) && ((par < 0.) || (p < par)))\n"
+        "    {\n"
+        "        par = p;\n"
+        "        inst = fi;\n"
+        "    }\n"
+        "}\n\n"
+        "if (par < 0.)\n"
+        "    discard;\n\n"
+        "mat4 mat_transformation = mat4(instance_field(inst, 0.), instance_field(inst, 1.), instance_field(inst, 2.), instance_field(inst, 3.));\n"
+        "mat4 mat_inverse_transformation = mat4(instance_field(inst, 4.), instance_field(inst, 5.), instance_field(inst, 6.), instance_field(inst, 7.));\n"
+        "mat3 mat_normal = mat3(instance_field(inst, 8.).xyz, instance_field(inst, 9.).xyz, instance_field(inst, 10.).xyz);\n\n"
         "vec3 lstart = (mat_inverse_transformation * start).xyz;\n"
         "vec3 ldir   = (mat_inverse_transformation * dir  ).xyz;\n\n"
-        "float par = min_intersection(lstart, ldir);\n\n"
-        "if (par < .01)\n"
-        "    discard;\n\n"
         "vec4 global_coord = start + par * dir;\n"
         "vec3 local_coord = lstart + par * ldir;\n\n"
         "vec3 n = normalize(mat_normal * get_normal(local_coord));\n"
@@ -130,46 +391,67 @@ void scene::new_object_type(object *obj)
         "else if (ndy < 0.)\n"
         "    n = -n;\n\n"
         "vec2 uv = get_uv(local_coord);\n\n"
-        "vec3 point_ambient = ambient_switch ? texture2D(raw_ambient_tex, uv).xyz : ambient_flat;\n"
-        "vec3 point_mirror  = mirror_switch  ? texture2D(raw_mirror_tex,  uv).xyz : mirror_flat;\n"
-        "vec4 point_refract = refract_switch ? texture2D(raw_refract_tex, uv)     : refract_flat;\n"
-        "vec3 point_color0  = color0_switch  ? texture2D(raw_color0_tex,  uv).xyz : color0_flat;\n"
-        "vec2 point_rp0     = rp0_switch     ? texture2D(raw_rp0_tex,     uv).xy  : rp0_flat;\n"
-        "vec3 point_color1  = color1_switch  ? texture2D(raw_color1_tex,  uv).xyz : color1_flat;\n"
-        "vec2 point_rp1     = rp1_switch     ? texture2D(raw_rp1_tex,     uv).xy  : rp1_flat;",
-
-        "global_coord", "vec4(n, ndy)", "vec4(t, 0.)",
-        "vec4(point_ambient, 0.)",
-        "vec4(point_mirror, 0.)",
-        "     point_refract",
-        "vec4(uv, 0., 0.)",
-        "vec4(point_color0, 0.)",
-        "vec4(point_color1, 0.)",
-        "vec4(point_rp0, point_rp1)",
-        "vec4(1., 0., 0., 0.)", "par / zfar"
+        "vec4 m_ambient = instance_field(inst, 11.);\n"
+        "vec4 m_mirror  = instance_field(inst, 12.);\n"
+        "vec4 m_refract = instance_field(inst, 13.);\n"
+        "vec4 m_layers  = instance_field(inst, 14.);\n"
+        "vec4 m_color0  = instance_field(inst, 15.);\n"
+        "vec4 m_color1  = instance_field(inst, 16.);\n"
+        "vec4 m_rp      = instance_field(inst, 17.);\n\n"
+        "vec3 point_ambient = material_channel(vec4(m_ambient.xyz, 0.), m_ambient.w, uv).xyz;\n"
+        "vec3 point_mirror  = material_channel(vec4(m_mirror.xyz,  0.), m_mirror.w,  uv).xyz;\n"
+        "vec4 point_refract = material_channel(m_refract,               m_layers.x,  uv);\n"
+        "vec3 point_color0  = material_channel(vec4(m_color0.xyz,  0.), m_layers.y,  uv).xyz;\n"
+        "vec2 point_rp0     = material_channel(vec4(m_rp.xy, 0., 0.),   m_layers.z,  uv).xy;\n"
+        "vec3 point_color1  = material_channel(vec4(m_color1.xyz,  0.), m_layers.w,  uv).xyz;\n"
+        "vec2 point_rp1     = material_channel(vec4(m_rp.zw, 0., 0.),   m_color0.w,  uv).xy;",
+
+        { "global_coord", "vec4(n, ndy)", "vec4(t, 0.)",
+          "vec4(point_ambient, 0.)",
+          "vec4(point_mirror, m_color1.w)",
+          "     point_refract",
+          "vec4(uv, object_index, inst)",
+          "vec4(point_color0, 0.)",
+          "vec4(point_color1, 0.)",
+          "vec4(point_rp0, point_rp1)",
+          "vec4(1., 0., 0., 0.)", "par / zfar" }
     );
 
+    for (int i = 0; i < gbuffer_size; i++)
+        delete gbuf_plac[i];
+
     obj->isct->use_depth(true);
 
+    obj->inst_slot = obj->isct->slot("instance_table");
+
 
-    texture_placebo shadow_map_plac("shadow_map");
+    // Intersection points and stencil are either the full resolution ones or
+    // their downsampled versions (see set_shadow_resolution()). Only pixels
+    // in shadow are written, and they are marked in the real stencil buffer,
+    // so later passes for the same light skip them (the depth is left alone
+    // to keep that test ahead of the shader).
+    texture_placebo shadow_map_plac("shadow_map"), isct_plac("global_intersection"), asten_plac("stencil");
 
     obj->shadow = new macs::render(
-        { &glob_isct, &cur_light_pos, &asten, &obj->cur_inv_trans },
-        { &shadow_map_plac },
+        { &isct_plac, &cur_light_pos, &asten_plac, &obj->cur_inv_trans },
+        { &shadow_map_plac, &sd },
 
         obj->global_shadow_src,
 
         "if (stencil.x < .5)\n"
         "    discard;\n\n" // nobody cares anyway
-        "vec4 dir_vec = global_intersection - light_pos;\n",
+        "vec4 dir_vec = global_intersection - light_pos;\n\n"
+        "if (!line_intersects((mat_inverse_transformation * light_pos).xyz,\n"
+        "                     (mat_inverse_transformation * dir_vec).xyz * .95))\n" // FIXME
+        "    discard;",
 
-        "line_intersects((mat_inverse_transformation * light_pos).xyz,"
-                        "(mat_inverse_transformation * dir_vec).xyz * .95)" // FIXME
-                        "? vec4(1.f, 0.f, 0.f, 0.f) : vec4(0.f, 0.f, 0.f, 0.f)"
+        "vec4(1., 0., 0., 0.)", ""
     );
 
-    obj->shadow->blend_func(render::use, render::use);
+    obj->shadow->use_stencil(true);
+
+    obj->shadow_isct_slot = obj->shadow->slot("global_intersection");
+    obj->shadow_stencil_slot = obj->shadow->slot("stencil");
 }
 
 void scene::add_light(light *lgt)
@@ -179,11 +461,23 @@ void scene::add_light(light *lgt)
     char *global_src;
     asprintf(&global_src, "float attenuation(float distance)\n{\n%s\n}", lgt->atten_func);
 
+    // Renders either into the output, into the light's contribution or into
+    // the edge rays' color, using the respective G-buffer
+    texture_placebo target_plac("output"), dir_plac("ray_directions"), shadow_plac("shadow_map");
+    texture_placebo *gbuf_plac[gbuffer_size];
+
+    std::vector<const in *> shade_in;
+
+    for (int i = 0; i < gbuffer_size; i++)
+        shade_in.push_back(gbuf_plac[i] = new texture_placebo(gbuffer_names[i]));
+
+    shade_in.insert(shade_in.end(), { &dir_plac, &shadow_plac, &lgt->position, &lgt->direction, &lgt->color,
+                                      &lgt->distr_exp, &lgt->limit_angle_cos, &lgt->atten_par });
+
+    std::vector<const out *> shade_out({ &target_plac });
+
     lgt->shade = new macs::render(
-        { &glob_isct, &ray_dir, &norm_map, &tang_map, &ambient_map, &mirror_map, &refract_map, &uv_map,
-          &color0_map, &color1_map, &rp_map, &asten, &lgt->shadow_map, &lgt->position, &lgt->direction,
-          &lgt->color, &lgt->distr_exp, &lgt->limit_angle_cos, &lgt->atten_par },
-        { &output },
+        shade_in, shade_out,
 
         global_src,
 
@@ -248,151 +542,1935 @@ void scene::add_light(light *lgt)
         "vec3 weight1 = color1_map.xyz + (vec3(1., 1., 1.) - color1_map.xyz) * fresnel_appr;\n\n"
         "vec3 brdf = weight0 * l0 + (vec3(1., 1., 1.) - weight0) * weight1 * l1;",
 
-        "vec4(point_color * brdf, 0.) * ndotx + vec4(ambient_map.xyz, 0.)"
+        { "vec4(point_color * brdf, 0.) * ndotx + vec4(ambient_map.xyz, 0.)" }
     );
 
+    for (int i = 0; i < gbuffer_size; i++)
+        delete gbuf_plac[i];
+
     lgt->shade->blend_func(render::use, render::use);
 
     free(global_src);
 }
 
 
-void scene::render(void)
+void scene::set_shading_cache(size_t max_bytes)
 {
-    render_view();
-    render_intersection();
-    render_shadows();
-    render_shading();
-    render_ambient();
+    shading_cache_limit = max_bytes;
 }
 
+void scene::set_resolution_scale(float scale)
+{
+    res_target = 0.f;
+    res_scale = (scale > 1.f) ? 1.f : scale;
 
-void scene::render_view(void)
+    update_render_size();
+}
+
+void scene::set_dynamic_resolution(float frame_ms, float min_scale, float max_scale)
 {
-    rnd_view->prepare();
-    rnd_view->bind_input();
-    rnd_view->execute();
+    res_target = (frame_ms > 0.f) ? frame_ms : 0.f;
+
+    res_max = (max_scale > 1.f) ? 1.f : max_scale;
+    res_min = (min_scale > res_max) ? res_max : min_scale;
+
+    if (res_scale < res_min)
+        res_scale = res_min;
+    else if (res_scale > res_max)
+        res_scale = res_max;
+
+    update_render_size();
 }
 
-void scene::render_intersection(void)
+float scene::resolution_scale(void) const
 {
-    for (auto obj: objs)
-    {
-        obj->isct->prepare();
+    return res_scale;
+}
 
-        for (auto i: obj->insts)
-        {
-            *obj->cur_trans = i->trans;
-            *obj->cur_inv_trans = i->inv_trans;
-            *obj->cur_normal = i->normal;
+void scene::update_dynamic_resolution(void)
+{
+    if (!frame_timer_pending)
+        return;
 
-            if (i->mat.ambient_texed)           *obj->isct << i->mat.ambient.tex;
-            else                                *obj->cur_ambient_flat = i->mat.ambient.flat;
+    GLint available;
+    glGetQueryObjectiv(frame_timer, GL_QUERY_RESULT_AVAILABLE, &available);
 
-            if (i->mat.mirror_texed)            *obj->isct << i->mat.mirror.tex;
-            else                                *obj->cur_mirror_flat = i->mat.mirror.flat;
+    // Never wait for the GPU, the next frame will be measured instead
+    if (!available)
+        return;
 
-            if (i->mat.refract_texed)           *obj->isct << i->mat.refract.tex;
-            else                                *obj->cur_refract_flat = i->mat.refract.flat;
+    GLuint64 ns;
+    glGetQueryObjectui64v(frame_timer, GL_QUERY_RESULT, &ns);
 
-            if (i->mat.layer[0].color_texed)    *obj->isct << i->mat.layer[0].color.tex;
-            else                                *obj->cur_color0_flat = i->mat.layer[0].color.flat;
+    frame_timer_pending = false;
 
-            if (i->mat.layer[0].rp_texed)       *obj->isct << i->mat.layer[0].rp.tex;
-            else                                *obj->cur_rp0_flat = i->mat.layer[0].rp.flat;
+    if ((res_target <= 0.f) || !ns)
+        return;
 
-            if (i->mat.layer[1].color_texed)    *obj->isct << i->mat.layer[1].color.tex;
-            else                                *obj->cur_color1_flat = i->mat.layer[1].color.flat;
 
-            if (i->mat.layer[1].rp_texed)       *obj->isct << i->mat.layer[1].rp.tex;
-            else                                *obj->cur_rp1_flat = i->mat.layer[1].rp.flat;
+    // The frame time is proportional to the number of pixels, i.e., to the
+    // square of the scale. Only go halfway there to damp the measurement
+    // noise.
+    float scale = res_scale * sqrtf(res_target / (ns / 1000000.f));
+    scale = res_scale + (scale - res_scale) * .5f;
 
-            *obj->cur_ambient_flat_tex = i->mat.ambient_texed;
-            *obj->cur_mirror_flat_tex = i->mat.mirror_texed;
-            *obj->cur_refract_flat_tex = i->mat.refract_texed;
-            *obj->cur_color0_flat_tex = i->mat.layer[0].color_texed;
-            *obj->cur_rp0_flat_tex = i->mat.layer[0].rp_texed;
-            *obj->cur_color1_flat_tex = i->mat.layer[1].color_texed;
-            *obj->cur_rp1_flat_tex = i->mat.layer[1].rp_texed;
+    if (scale < res_min)
+        scale = res_min;
+    else if (scale > res_max)
+        scale = res_max;
 
-            obj->isct->bind_input();
-            obj->isct->execute();
+    // Every change requires rendering everything again, so ignore small ones
+    if (fabsf(scale - res_scale) < .02f * res_scale)
+        return;
 
-            if (i->mat.ambient_texed)           *obj->isct -= i->mat.ambient.tex;
-            if (i->mat.mirror_texed)            *obj->isct -= i->mat.mirror.tex;
-            if (i->mat.refract_texed)           *obj->isct -= i->mat.refract.tex;
-            if (i->mat.layer[0].color_texed)    *obj->isct -= i->mat.layer[0].color.tex;
-            if (i->mat.layer[0].rp_texed)       *obj->isct -= i->mat.layer[0].rp.tex;
-            if (i->mat.layer[1].color_texed)    *obj->isct -= i->mat.layer[1].color.tex;
-            if (i->mat.layer[1].rp_texed)       *obj->isct -= i->mat.layer[1].rp.tex;
-        }
-    }
+    dbgprintf("%.2f ms per frame, resolution scale %.3f -> %.3f\n", ns / 1000000.f, res_scale, scale);
+
+    res_scale = scale;
+
+    update_render_size();
 }
 
-void scene::render_shadows(void)
+void scene::update_render_size(void)
 {
-    bool first_instance = true;
+    int w = static_cast<int>(ceilf(macs::internals::width  * res_scale));
+    int h = static_cast<int>(ceilf(macs::internals::height * res_scale));
 
-    for (auto obj: objs)
+    if (w < 1)
+        w = 1;
+    if (h < 1)
+        h = 1;
+
+    if ((w != render_w) || (h != render_h))
+        invalid = true;
+
+    render_w = w;
+    render_h = h;
+
+    *view_scale = vec2(static_cast<float>(macs::internals::width) / w, static_cast<float>(macs::internals::height) / h);
+    *render_size = vec2(w, h);
+    *shadow_limit = vec2((w + shadow_div - 1) / shadow_div - 1, (h + shadow_div - 1) / shadow_div - 1);
+}
+
+void scene::scissor_render_size(int divisor)
+{
+    glScissor(0, 0, (render_w + divisor - 1) / divisor, (render_h + divisor - 1) / divisor);
+}
+
+
+void scene::set_progressive(int max_samples, float threshold)
+{
+    invalid = true;
+
+    accum_threshold = threshold;
+
+    if (max_samples >= 2)
     {
-        obj->shadow->prepare();
-        obj->shadow->bind_input();
+        accum_max = max_samples;
 
-        for (auto i: obj->insts)
-        {
-            if (!i->cast_shadows)
-                continue;
+        if (rnd_accum)
+            return;
 
-            for (auto lgt: lgts)
-            {
-                *obj->shadow >> &lgt->shadow_map;
 
-                if (first_instance)
-                    obj->shadow->clear_output({ 0.f, 0.f, 0.f, 0.f });
+        accum_sum   = new macs::texture("accum_sum");
+        accum_delta = new macs::texture("accum_delta");
 
-                *cur_light_pos = *lgt->position;
-                *obj->cur_inv_trans = i->inv_trans;
+        rnd_accum = new macs::render({ &output }, { accum_sum }, "", "", "output");
+        rnd_accum->blend_func(render::use, render::use);
 
-                obj->shadow->execute();
+        // The average changes by (sample - new average) / (samples - 1)
+        rnd_accum_delta = new macs::render(
+            { &output, accum_sum, &accum_count },
+            { accum_delta },
+            "",
+            "vec3 d = abs(output.xyz - accum_sum.xyz / accum_count) / (accum_count - 1.);",
+            "vec4(max(max(d.x, d.y), d.z), 0., 0., 0.)"
+        );
 
-                *obj->shadow -= &lgt->shadow_map;
-            }
+        rnd_accum_avg = new macs::render({ accum_sum, &accum_count }, { &output }, "", "", "accum_sum / accum_count");
 
-            first_instance = false;
-        }
+        accum_reduce = new macs::reduce(macs::reduce::sum);
+
+        return;
     }
+
+
+    accum_max = 0;
+    accum_reduce_pending = false;
+
+    *view_jitter = vec2();
+
+    delete rnd_accum;
+    delete rnd_accum_delta;
+    delete rnd_accum_avg;
+    delete accum_reduce;
+    delete accum_sum;
+    delete accum_delta;
+
+    rnd_accum = rnd_accum_delta = rnd_accum_avg = NULL;
+    accum_reduce = NULL;
+    accum_sum = accum_delta = NULL;
 }
 
-void scene::render_shading(void)
+int scene::progressive_samples(void) const
 {
-    bool first_light = true;
+    return accum_max ? accum_samples : 1;
+}
 
-    for (auto lgt: lgts)
-    {
-        lgt->shade->prepare();
-        lgt->shade->bind_input();
+bool scene::progressive_done(void) const
+{
+    return !accum_max || accum_converged || (accum_samples >= accum_max);
+}
 
-        if (first_light)
+void scene::update_progressive(void)
+{
+    if (!accum_reduce_pending || !accum_reduce->ready())
+        return;
+
+    accum_reduce_pending = false;
+
+    float mean = accum_reduce->result().r / (render_w * render_h);
+
+    if (mean < accum_threshold)
+        accum_converged = true;
+}
+
+void scene::accumulate(void)
+{
+    *accum_count = ++accum_samples;
+
+    rnd_accum->prepare();
+    rnd_accum->bind_input();
+
+    if (accum_samples == 1)
+        rnd_accum->clear_output({ 0.f, 0.f, 0.f, 0.f });
+
+    rnd_accum->execute();
+
+    if (accum_samples == 1)
+    {
+        // Outside of the rendered area, there may still be values from a
+        // larger one
+        if (accum_threshold > 0.f)
         {
-            lgt->shade->clear_output({ 0.f, 0.f, 0.f, 0.f });
-            first_light = false;
+            glDisable(GL_SCISSOR_TEST);
+
+            rnd_accum_delta->prepare();
+            rnd_accum_delta->clear_output({ 0.f, 0.f, 0.f, 0.f });
+
+            glEnable(GL_SCISSOR_TEST);
         }
 
-        lgt->shade->execute();
+        return;
+    }
+
+
+    // Only one measurement at a time, so it never has to be waited for
+    if ((accum_threshold > 0.f) && !accum_reduce_pending)
+    {
+        rnd_accum_delta->prepare();
+        rnd_accum_delta->bind_input();
+        rnd_accum_delta->execute();
+
+        (*accum_reduce)(accum_delta);
+        accum_reduce_pending = true;
     }
+
+    rnd_accum_avg->prepare();
+    rnd_accum_avg->bind_input();
+    rnd_accum_avg->execute();
 }
 
-void scene::render_ambient(void)
+
+void scene::set_edge_aa(int samples, float max_edges, float depth_threshold, float normal_threshold)
 {
-    rnd_ambient->prepare();
-    rnd_ambient->bind_input();
-    rnd_ambient->execute();
+    invalid = true;
+
+    *aa_depth_threshold = depth_threshold;
+    *aa_normal_threshold = normal_threshold;
+
+
+    delete rnd_aa_edges;
+    delete aa_compact;
+    delete rnd_aa_rays;
+    delete rnd_aa_resolve;
+
+    delete aa_edges;
+    delete aa_ray_stt;
+    delete aa_ray_dir;
+    delete aa_shadow;
+    delete aa_color;
+
+    for (int i = 0; i < gbuffer_size; i++)
+    {
+        delete aa_gbuffer[i];
+        aa_gbuffer[i] = NULL;
+    }
+
+    rnd_aa_edges = rnd_aa_rays = rnd_aa_resolve = NULL;
+    aa_compact = NULL;
+    aa_edges = aa_ray_stt = aa_ray_dir = aa_shadow = aa_color = NULL;
+
+    aa_samples = (samples > 0) ? samples : 0;
+    aa_list_rows = 0;
+
+    if (!aa_samples)
+        return;
+
+
+    int w = macs::internals::width, h = macs::internals::height;
+
+    aa_list_height = static_cast<int>(ceilf(h * max_edges * aa_samples));
+
+    if (aa_list_height < 1)
+        aa_list_height = 1;
+    else if (aa_list_height > h)
+        aa_list_height = h;
+
+    // All list textures are named like the full resolution ones they replace
+    aa_edges   = new macs::texture("aa_edges");
+    aa_ray_stt = new macs::texture("ray_starting_points", true, w, aa_list_height);
+    aa_ray_dir = new macs::texture("ray_directions", true, w, aa_list_height);
+    aa_shadow  = new macs::texture("shadow_map", true, w, aa_list_height);
+    aa_color   = new macs::texture("output", true, w, aa_list_height);
+
+    for (int i = 0; i < gbuffer_size; i++)
+        aa_gbuffer[i] = new macs::texture(gbuffer_names[i], true, w, aa_list_height);
+
+
+    // A pixel is an edge pixel if any of its four neighbors differs
+    rnd_aa_edges = new macs::render(
+        { &glob_isct, &norm_map, &uv_map, &asten, &cam_pos, &render_size, &aa_depth_threshold, &aa_normal_threshold },
+        { aa_edges },
+        "",
+
+        "vec2 px = floor(gl_FragCoord.xy);\n"
+        "float edge = 0.;\n\n"
+        "if (all(lessThan(px, render_size)))\n"
+        "{\n"
+        "    bool covered = stencil.x > .5;\n"
+        "    vec3 n = normal_map.xyz;\n"
+        "    vec2 id = uv_map.zw;\n"
+        "    float d = length(global_intersection.xyz - cam_pos.xyz);\n\n"
+        "    for (int i = 0; i < 4; i++)\n"
+        "    {\n"
+        "        vec2 q = px + ((i < 2) ? vec2(float(i * 2 - 1), 0.) : vec2(0., float(i * 2 - 5)));\n\n"
+        "        if (any(lessThan(q, vec2(0., 0.))) || any(greaterThanEqual(q, render_size)))\n"
+        "            continue;\n\n"
+        "        vec2 c = (q + .5) * texel_size;\n\n"
+        "        if ((texture2D(raw_stencil, c).x > .5) != covered)\n"
+        "            edge = 1.;\n"
+        "        else if (covered)\n"
+        "        {\n"
+        "            float qd = length(texture2D(raw_global_intersection, c).xyz - cam_pos.xyz);\n\n"
+        "            if ((texture2D(raw_uv_map, c).zw != id) || (abs(qd - d) > aa_depth_threshold * d) ||\n"
+        "                (dot(texture2D(raw_normal_map, c).xyz, n) < aa_normal_threshold))\n"
+        "                edge = 1.;\n"
+        "        }\n"
+        "    }\n"
+        "}",
+
+        "vec4(edge, 0., 0., 0.)"
+    );
+
+    aa_compact = new macs::compact({ aa_edges }, "aa_edges.x > .5");
+
+
+    // 106 characters of text plus five integers of up to 11 characters
+    char defs[192];
+    snprintf(defs, sizeof(defs), "#define AA_SAMPLES %i\n#define AA_WIDTH %i.\n#define AA_HEIGHT %i.\n#define AA_LIST_HEIGHT %i.\n"
+             "#define AA_CAPACITY %i.\n", aa_samples, w, h, aa_list_height, w * aa_list_height / aa_samples);
+
+    // List element e is sample e % AA_SAMPLES of edge pixel e / AA_SAMPLES;
+    // the samples are distributed along a Halton (2, 3) sequence. Elements
+    // beyond the last edge pixel get a depth making them fail every
+    // intersection.
+    rnd_aa_rays = new macs::render(
+        { aa_compact->output(), &cam_pos, &cam_fwd, &cam_rgt, &cam_up, &yfov, &xfov, &view_scale },
+        { aa_ray_stt, aa_ray_dir, aa_gbuffer[gbuffer_stencil], &sd },
+
+        (std::string(defs) +
+         "float halton(float i, float base)\n"
+         "{\n"
+         "    float f = 1., r = 0.;\n\n"
+         "    for (int j = 0; j < 16; j++)\n"
+         "    {\n"
+         "        if (i <= 0.)\n"
+         "            break;\n\n"
+         "        float q = floor((i + .5) / base);\n\n"
+         "        f /= base;\n"
+         "        r += f * (i - q * base);\n"
+         "        i = q;\n"
+         "    }\n\n"
+         "    return r;\n"
+         "}\n").c_str(),
+
+        "float e = floor(gl_FragCoord.y) * AA_WIDTH + floor(gl_FragCoord.x);\n"
+        "float k = floor((e + .5) / float(AA_SAMPLES));\n"
+        "float s = e - k * float(AA_SAMPLES);\n"
+        "float row = floor((k + .5) / AA_WIDTH);\n\n"
+        "vec4 px = texture2D(raw_compacted, vec2(k - row * AA_WIDTH + .5, row + .5) / vec2(AA_WIDTH, AA_HEIGHT));\n"
+        "vec2 coord = px.xy + (vec2(halton(s + 1., 2.), halton(s + 1., 3.)) - .5) / vec2(AA_WIDTH, AA_HEIGHT);",
+
+        "cam_pos",
+        "vec4(\n"
+        "    normalize(\n"
+        "        (coord.x * view_scale.x * 2. - 1.) * xfov * cam_rgt +\n"
+        "        (coord.y * view_scale.y * 2. - 1.) * yfov * cam_up  +\n"
+        "        cam_fwd\n"
+        "    ),\n"
+        "    0.\n"
+        ")",
+        "vec4(0., 0., 0., 0.)",
+        "(px.w > .5) ? 1. : 0."
+    );
+
+    rnd_aa_rays->use_depth(true, render::always);
+
+
+    texture_placebo color_plac("aa_color");
+
+    rnd_aa_resolve = new macs::render(
+        { aa_compact->selection(), aa_compact->indices(), &color_plac },
+        { &output },
+
+        defs,
+
+        "if ((compact_flags.x < .5) || (scanned.x >= AA_CAPACITY))\n"
+        "    discard;\n\n"
+        "vec4 sum = vec4(0., 0., 0., 0.);\n\n"
+        "for (int s = 0; s < AA_SAMPLES; s++)\n"
+        "{\n"
+        "    float e = scanned.x * float(AA_SAMPLES) + float(s);\n"
+        "    float row = floor((e + .5) / AA_WIDTH);\n\n"
+        "    sum += texture2D(raw_aa_color, vec2(e - row * AA_WIDTH + .5, row + .5) / vec2(AA_WIDTH, AA_LIST_HEIGHT));\n"
+        "}",
+
+        "sum / float(AA_SAMPLES)"
+    );
+
+    aa_resolve_slot = rnd_aa_resolve->slot("aa_color");
 }
 
-void scene::display(void)
+
+void scene::set_secondary_rays(int depth, float max_rays, float threshold)
 {
-    render_to_screen(_dbl_buf);
+    invalid = true;
 
-    output.display();
-}
+    *sec_threshold = threshold;
+
+
+    delete rnd_sec_spawn;
+    delete sec_compact;
+    delete rnd_sec_map;
+    delete rnd_sec_rays;
+    delete rnd_sec_resolve;
+
+    delete sec_cand_origin;
+    delete sec_cand_dir;
+    delete sec_cand_info;
+    delete sec_ray_stt;
+    delete sec_ray_dir;
+    delete sec_shadow;
+
+    for (int i = 0; i < gbuffer_size; i++)
+    {
+        delete sec_gbuffer[i];
+        sec_gbuffer[i] = NULL;
+    }
+
+    for (size_t i = 0; i < sec_maps.size(); i++)
+    {
+        delete sec_maps[i];
+        delete sec_infos[i];
+        delete sec_colors[i];
+    }
+
+    sec_maps.clear();
+    sec_infos.clear();
+    sec_colors.clear();
+
+    rnd_sec_spawn = rnd_sec_map = rnd_sec_rays = rnd_sec_resolve = NULL;
+    sec_compact = NULL;
+    sec_cand_origin = sec_cand_dir = sec_cand_info = sec_ray_stt = sec_ray_dir = sec_shadow = NULL;
+
+    sec_depth = (depth > 0) ? depth : 0;
+
+    if (!sec_depth)
+        return;
+
+
+    int w = macs::internals::width, h = macs::internals::height;
+
+    // The queues share the stencil/depth buffer and thus cannot be higher
+    // than the screen
+    sec_queue_height = static_cast<int>(ceilf(h * max_rays));
+
+    if (sec_queue_height < 1)
+        sec_queue_height = 1;
+    else if (sec_queue_height > h)
+        sec_queue_height = h;
+
+    // Candidate element (x, y) is the reflection, element (x, y + h) the
+    // refraction of the parent ray at (x, y)
+    sec_cand_origin = new macs::texture("sec_origin", true, w, 2 * h);
+    sec_cand_dir    = new macs::texture("sec_direction", true, w, 2 * h);
+    sec_cand_info   = new macs::texture("sec_candidate", true, w, 2 * h);
+
+    // All queue textures are named like the full resolution ones they replace
+    sec_ray_stt = new macs::texture("ray_starting_points", true, w, sec_queue_height);
+    sec_ray_dir = new macs::texture("ray_directions", true, w, sec_queue_height);
+    sec_shadow  = new macs::texture("shadow_map", true, w, sec_queue_height);
+
+    for (int i = 0; i < gbuffer_size; i++)
+        sec_gbuffer[i] = new macs::texture(gbuffer_names[i], true, w, sec_queue_height);
+
+    for (int i = 0; i < sec_depth; i++)
+    {
+        sec_maps.push_back(new macs::texture("sec_map", true, w, 2 * h));
+        sec_infos.push_back(new macs::texture("sec_info", true, w, sec_queue_height));
+        sec_colors.push_back(new macs::texture("output", true, w, sec_queue_height));
+    }
+
+
+    // 91 characters of text plus four integers of up to 11 characters
+    char defs[160];
+    snprintf(defs, sizeof(defs), "#define SEC_WIDTH %i.\n#define SEC_HEIGHT %i.\n#define SEC_QUEUE_HEIGHT %i.\n#define SEC_CAPACITY %i.\n",
+             w, h, sec_queue_height, w * sec_queue_height);
+
+    // The parents are either the camera rays or the previous level's queue;
+    // the normal faces the parent ray, its W component is positive iff the
+    // ray enters the surface. The contribution is the product of all
+    // coefficients along the path (maximum over the channels).
+    texture_placebo isct_plac("global_intersection"), norm_plac("normal_map"), mirror_plac("mirror_map");
+    texture_placebo refract_plac("refract_map"), sten_plac("stencil"), dir_plac("ray_directions"), info_plac("sec_info");
+
+    rnd_sec_spawn = new macs::render(
+        { &isct_plac, &norm_plac, &mirror_plac, &refract_plac, &sten_plac, &dir_plac, &info_plac,
+          &sec_parent_size, &sec_parent_limit, &sec_parent_count, &sec_primary },
+        { sec_cand_origin, sec_cand_dir, sec_cand_info },
+
+        defs,
+
+        "vec2 px = floor(gl_FragCoord.xy);\n"
+        "bool refracted = px.y >= SEC_HEIGHT;\n"
+        "vec2 parent = refracted ? px - vec2(0., SEC_HEIGHT) : px;\n"
+        "vec2 pc = (parent + .5) / sec_parent_size;\n\n"
+        "vec3 origin = vec3(0., 0., 0.), dir = vec3(0., 0., 0.), coef = vec3(0., 0., 0.);\n"
+        "float contrib = 0.;\n\n"
+        "if (all(lessThan(parent, sec_parent_limit)) && (parent.y * SEC_WIDTH + parent.x < sec_parent_count) &&\n"
+        "    (texture2D(raw_stencil, pc).x > .5))\n"
+        "{\n"
+        "    vec3 d = normalize(texture2D(raw_ray_directions, pc).xyz);\n"
+        "    vec4 n = texture2D(raw_normal_map, pc);\n"
+        "    vec4 mirror = texture2D(raw_mirror_map, pc);\n\n"
+        "    origin = texture2D(raw_global_intersection, pc).xyz;\n"
+        "    contrib = (sec_primary > .5) ? 1. : texture2D(raw_sec_info, pc).w;\n\n"
+        "    if (refracted)\n"
+        "    {\n"
+        "        vec4 refract_col = texture2D(raw_refract_map, pc);\n"
+        "        float ior = mirror.w * refract_col.a;\n\n"
+        "        if (ior <= 0.)\n"
+        "            ior = 1.;\n\n"
+        "        coef = refract_col.rgb;\n"
+        "        dir = refract(d, n.xyz, (n.w > 0.) ? 1. / ior : ior);\n\n"
+        "        if (dot(dir, dir) == 0.)\n"
+        "            dir = reflect(d, n.xyz);\n"
+        "    }\n"
+        "    else\n"
+        "    {\n"
+        "        coef = mirror.rgb;\n"
+        "        dir = reflect(d, n.xyz);\n"
+        "    }\n\n"
+        "    contrib *= max(coef.r, max(coef.g, coef.b));\n"
+        "}",
+
+        "vec4(origin, 1.)",
+        "vec4(dir, 0.)",
+        "vec4(coef, contrib)"
+    );
+
+    sec_compact = new macs::compact({ sec_cand_info, &sec_threshold }, "sec_candidate.w > sec_threshold", NULL, w, 2 * h);
+
+    texture_placebo map_plac("sec_map");
+
+    rnd_sec_map = new macs::render(
+        { sec_compact->selection(), sec_compact->indices() },
+        { &map_plac },
+
+        defs,
+        "",
+
+        "((compact_flags.x > .5) && (scanned.x < SEC_CAPACITY)) ? vec4(scanned.x + 1., 0., 0., 0.) : vec4(0., 0., 0., 0.)"
+    );
+
+    // Queue element e is compacted element e, which is at the same position
+    // (the compacted texture is as wide as the queue). Elements beyond the
+    // last ray get a depth making them fail every intersection.
+    rnd_sec_rays = new macs::render(
+        { sec_compact->output(), sec_cand_origin, sec_cand_dir, sec_cand_info },
+        { sec_ray_stt, sec_ray_dir, &info_plac, sec_gbuffer[gbuffer_stencil], &sd },
+
+        defs,
+
+        "vec4 px = texture2D(raw_compacted, (floor(gl_FragCoord.xy) + .5) / vec2(SEC_WIDTH, 2. * SEC_HEIGHT));",
 
+        "texture2D(raw_sec_origin, px.xy)",
+        "texture2D(raw_sec_direction, px.xy)",
+        "texture2D(raw_sec_candidate, px.xy)",
+        "vec4(0., 0., 0., 0.)",
+        "(px.w > .5) ? 1. : 0."
+    );
+
+    rnd_sec_rays->use_depth(true, render::always);
+
+
+    // Every parent gathers its (up to) two children
+    texture_placebo color_plac("sec_color"), target_plac("output");
+
+    rnd_sec_resolve = new macs::render(
+        { &map_plac, &info_plac, &color_plac },
+        { &target_plac },
+
+        defs,
+
+        "vec2 px = floor(gl_FragCoord.xy);\n"
+        "vec3 sum = vec3(0., 0., 0.);\n"
+        "bool any_child = false;\n\n"
+        "for (int i = 0; i < 2; i++)\n"
+        "{\n"
+        "    float e = texture2D(raw_sec_map, (px + vec2(.5, float(i) * SEC_HEIGHT + .5)) / vec2(SEC_WIDTH, 2. * SEC_HEIGHT)).x - 1.;\n\n"
+        "    if (e < 0.)\n"
+        "        continue;\n\n"
+        "    float row = floor((e + .5) / SEC_WIDTH);\n"
+        "    vec2 c = vec2(e - row * SEC_WIDTH + .5, row + .5) / vec2(SEC_WIDTH, SEC_QUEUE_HEIGHT);\n\n"
+        "    sum += texture2D(raw_sec_info, c).rgb * texture2D(raw_sec_color, c).rgb;\n"
+        "    any_child = true;\n"
+        "}\n\n"
+        "if (!any_child)\n"
+        "    discard;",
+
+        "vec4(sum, 0.)"
+    );
+
+    rnd_sec_resolve->blend_func(render::use, render::use);
+}
+
+
+void scene::set_shadow_resolution(int divisor)
+{
+    if (divisor < 1)
+        divisor = 1;
+
+    if (divisor == shadow_div)
+        return;
+
+    shadow_div = divisor;
+    shadows_invalid = true;
+
+    update_render_size();
+
+
+    delete rnd_shadow_down;
+    delete rnd_shadow_up;
+    delete shadow_isct;
+    delete shadow_norm;
+    delete shadow_asten;
+
+    rnd_shadow_down = rnd_shadow_up = NULL;
+    shadow_isct = shadow_norm = shadow_asten = NULL;
+
+    for (auto lgt: lgts)
+    {
+        delete lgt->shadow_lowres;
+        delete lgt->static_shadow;
+        lgt->shadow_lowres = lgt->static_shadow = NULL;
+    }
+
+    // Reallocated at the new resolution by update_shadow_maps() and
+    // update_static_shadows()
+    delete shadow_shared_lowres;
+    delete static_isct[0];
+    delete static_isct[1];
+    delete static_stale;
+
+    shadow_shared_lowres = static_isct[0] = static_isct[1] = static_stale = NULL;
+
+    if (divisor == 1)
+        return;
+
+
+    int w = (macs::internals::width  + divisor - 1) / divisor;
+    int h = (macs::internals::height + divisor - 1) / divisor;
+
+    *shadow_size = vec2(w, h);
+    *shadow_scale = vec2(static_cast<float>(macs::internals::width) / divisor, static_cast<float>(macs::internals::height) / divisor);
+
+    shadow_isct  = new macs::texture("shadow_intersection", true, w, h);
+    shadow_norm  = new macs::texture("shadow_normal", true, w, h);
+    shadow_asten = new macs::texture("shadow_stencil", true, w, h);
+
+    char defs[64];
+    sprintf(defs, "#define SHADOW_DIV %i\n", divisor);
+
+    // Every block is represented by its intersection point nearest to the
+    // camera
+    rnd_shadow_down = new macs::render(
+        { &glob_isct, &norm_map, &asten, &cam_pos, &shadow_scale, &render_size },
+        { shadow_isct, shadow_norm, shadow_asten },
+
+        defs,
+
+        "vec2 full_texel = vec2(1., 1.) / (shadow_scale * float(SHADOW_DIV));\n"
+        "vec2 base = floor(gl_FragCoord.xy) * float(SHADOW_DIV);\n"
+        "vec4 best = vec4(0., 0., 0., 0.);\n"
+        "vec3 best_n = vec3(0., 0., 0.);\n"
+        "float best_d = -1.;\n\n"
+        "for (int y = 0; y < SHADOW_DIV; y++)\n"
+        "{\n"
+        "    for (int x = 0; x < SHADOW_DIV; x++)\n"
+        "    {\n"
+        "        vec2 texel = base + vec2(float(x), float(y));\n"
+        "        vec2 c = (texel + .5) * full_texel;\n\n"
+        "        if (any(greaterThanEqual(texel, render_size)) || (texture2D(raw_stencil, c).x < .5))\n"
+        "            continue;\n\n"
+        "        vec4 p = texture2D(raw_global_intersection, c);\n"
+        "        float d = length(p.xyz - cam_pos.xyz);\n\n"
+        "        if ((best_d < 0.) || (d < best_d))\n"
+        "        {\n"
+        "            best = vec4(p.xyz, 1.);\n"
+        "            best_n = texture2D(raw_normal_map, c).xyz;\n"
+        "            best_d = d;\n"
+        "        }\n"
+        "    }\n"
+        "}",
+
+        "best", "vec4(best_n, 0.)", "vec4(best.w, 0., 0., 0.)"
+    );
+
+
+    // Weights of the (up to) four nearest reduced resolution samples combine
+    // bilinear interpolation with the distance between the intersection
+    // points (relative to the distance to the camera) and the similarity of
+    // the normals. If no sample is similar at all, the nearest one is used.
+    texture_placebo lowres_plac("shadow_lowres"), map_plac("shadow_map");
+
+    rnd_shadow_up = new macs::render(
+        { &glob_isct, &norm_map, &asten, &cam_pos, shadow_isct, shadow_norm, &lowres_plac, &shadow_size, &shadow_scale, &shadow_limit },
+        { &map_plac },
+
+        "#define SHADOW_DEPTH_SIGMA .05\n"
+        "#define SHADOW_NORMAL_EXP 8.\n",
+
+        "if (stencil.x < .5)\n"
+        "    discard;\n\n"
+        "vec3 p = global_intersection.xyz;\n"
+        "vec3 n = normal_map.xyz;\n"
+        "float sigma = SHADOW_DEPTH_SIGMA * length(p - cam_pos.xyz);\n\n"
+        "vec2 lc = tex_coord * shadow_scale - .5;\n"
+        "vec2 base = floor(lc), f = lc - base;\n\n"
+        "float sum = 0., wsum = 0.;\n\n"
+        "for (int j = 0; j < 2; j++)\n"
+        "{\n"
+        "    for (int i = 0; i < 2; i++)\n"
+        "    {\n"
+        "        vec2 c = (clamp(base + vec2(float(i), float(j)), vec2(0., 0.), shadow_limit) + .5) / shadow_size;\n"
+        "        vec4 q = texture2D(raw_shadow_intersection, c);\n\n"
+        "        if (q.w < .5)\n"
+        "            continue;\n\n"
+        "        vec3 dq = (q.xyz - p) / sigma;\n"
+        "        float wb = (i > 0 ? f.x : 1. - f.x) * (j > 0 ? f.y : 1. - f.y) + .001;\n"
+        "        float wn = pow(max(dot(n, texture2D(raw_shadow_normal, c).xyz), 0.), SHADOW_NORMAL_EXP);\n"
+        "        float w = wb * wn * exp(-dot(dq, dq));\n\n"
+        "        sum += w * min(texture2D(raw_shadow_lowres, c).x, 1.);\n"
+        "        wsum += w;\n"
+        "    }\n"
+        "}\n\n"
+        "float mask = (wsum > 1e-6) ? sum / wsum\n"
+        "           : min(texture2D(raw_shadow_lowres, (clamp(floor(lc + .5), vec2(0., 0.), shadow_limit) + .5) / shadow_size).x, 1.);",
+
+        "vec4(mask, 0., 0., 0.)"
+    );
+
+    shadow_up_slot = rnd_shadow_up->slot("shadow_lowres");
+}
+
+void scene::set_interleaved_shadows(bool enable)
+{
+    if (enable == shadow_interleaved)
+        return;
+
+    shadow_interleaved = enable;
+
+    // The lights' own shadow maps are not allocated yet, or no longer needed
+    shadows_invalid = true;
+}
+
+
+void scene::render(void)
+{
+    // May change the render size and thus invalidate everything
+    update_dynamic_resolution();
+    update_progressive();
+    update_shadow_statistics(false);
+
+    // Both have to be updated in any case
+    bool view_changed = update_view_state();
+    bool geometry_changed = update_instance_tables();
+    bool static_changed = update_static_occluders();
+
+    bool geometry = invalid || view_changed || geometry_changed;
+
+    // Otherwise, the static shadows are only redone where the visible
+    // surface has changed
+    bool static_invalid = invalid || view_changed || static_changed || shadows_invalid;
+
+    invalid = false;
+
+
+    bool sample = false;
+
+    if (accum_max)
+    {
+        bool lights_changed = false;
+
+        for (auto lgt: lgts)
+        {
+            float state[light::state_size];
+            lgt->state(state);
+
+            if (!lgt->rendered || memcmp(state, lgt->rendered_state, sizeof(state)))
+                lights_changed = true;
+        }
+
+        // Any change starts the accumulation over
+        if (geometry || lights_changed)
+        {
+            accum_samples = 0;
+            accum_converged = false;
+            accum_reduce_pending = false;
+        }
+
+        // Every sample requires new (jittered) camera rays; the first one is
+        // taken at the pixel center
+        if (!progressive_done())
+        {
+            float jx = accum_samples ? halton(accum_samples, 2) - .5f : 0.f;
+            float jy = accum_samples ? halton(accum_samples, 3) - .5f : 0.f;
+
+            *view_jitter = vec2(jx / macs::internals::width, jy / macs::internals::height);
+
+            geometry = true;
+            sample = true;
+        }
+    }
+
+
+    std::list<light *> dirty_shadows, dirty_shading;
+    bool shading = geometry;
+
+    for (auto lgt: lgts)
+    {
+        float state[light::state_size];
+        lgt->state(state);
+
+        bool changed = !lgt->rendered || memcmp(state, lgt->rendered_state, sizeof(state));
+
+        // Only the position affects the shadow map
+        bool moved = !lgt->rendered || memcmp(state, lgt->rendered_state, sizeof(float) * 4);
+
+        if (static_invalid || moved)
+            lgt->static_valid = false;
+
+        if (geometry || shadows_invalid || moved)
+        {
+            dirty_shadows.push_back(lgt);
+            changed = true;
+        }
+
+        if (changed)
+        {
+            memcpy(lgt->rendered_state, state, sizeof(state));
+            lgt->rendered = true;
+
+            dirty_shading.push_back(lgt);
+            shading = true;
+        }
+    }
+
+    shadows_invalid = false;
+
+
+    // Only frames rendered from scratch are representative
+    bool timed = geometry && (res_target > 0.f) && frame_timer && !frame_timer_pending;
+
+    if (timed)
+        glBeginQuery(GL_TIME_ELAPSED, frame_timer);
+
+    glEnable(GL_SCISSOR_TEST);
+    scissor_render_size(1);
+
+    if (geometry)
+    {
+        render_view();
+        render_intersection(&ray_stt, &ray_dir, gbuffer);
+    }
+
+    update_shadow_maps();
+
+    if (!shadow_interleaved && !dirty_shadows.empty())
+        render_shadows(dirty_shadows, geometry);
+
+    if (shading)
+    {
+        // The shadow maps are rendered by render_shading() then
+        if (shadow_interleaved)
+            prepare_shadows(dirty_shadows, geometry);
+
+        render_shading(dirty_shading);
+        render_ambient(gbuffer, &output);
+
+        if (aa_samples && !accum_max)
+            render_edge_aa(geometry);
+
+        if (sec_depth)
+            render_secondary();
+    }
+
+    if (sample)
+        accumulate();
+
+    glDisable(GL_SCISSOR_TEST);
+
+    if (timed)
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        frame_timer_pending = true;
+    }
+}
+
+void scene::invalidate(void)
+{
+    invalid = true;
+}
+
+
+bool scene::update_view_state(void)
+{
+    float state[view_state_size];
+
+    memcpy(&state[0], (*cam_pos).d, sizeof(float) * 4);
+    memcpy(&state[4], (*cam_fwd).d, sizeof(float) * 3);
+    memcpy(&state[7], (*cam_rgt).d, sizeof(float) * 3);
+    memcpy(&state[10], (*cam_up).d, sizeof(float) * 3);
+
+    state[13] = *xfov;
+    state[14] = *yfov;
+    state[15] = *zfar;
+
+    if (!memcmp(state, rendered_view, sizeof(state)))
+        return false;
+
+    memcpy(rendered_view, state, sizeof(state));
+
+    return true;
+}
+
+bool scene::update_instance_tables(void)
+{
+    bool changed = false;
+
+    for (auto obj: objs)
+    {
+        int count = obj->insts.size();
+
+        if (count != *obj->inst_count)
+        {
+            *obj->inst_count = count;
+            changed = true;
+        }
+
+        if (!count)
+            continue;
+
+        if (count > *obj->inst_rows)
+        {
+            int rows = (*obj->inst_rows > 0.f) ? *obj->inst_rows : 1;
+
+            while (rows < count)
+                rows *= 2;
+
+            delete obj->inst_table;
+            delete[] obj->inst_data;
+
+            obj->inst_table = new macs::texture("instance_table", true, INSTANCE_FIELDS, rows);
+            obj->inst_data = new formats::f0123[INSTANCE_FIELDS * rows];
+
+            // f0123's default constructor does not initialize anything
+            std::fill(obj->inst_data, obj->inst_data + INSTANCE_FIELDS * rows, formats::f0123({ 0.f, 0.f, 0.f, 0.f }));
+
+            obj->isct->bind(obj->inst_slot, obj->inst_table);
+
+            *obj->inst_rows = rows;
+        }
+
+
+        formats::f0123 *row = obj->inst_data, packed[INSTANCE_FIELDS];
+        bool table_changed = false;
+
+        for (auto i: obj->insts)
+        {
+            i->update_world();
+
+            memcpy(&packed[0], i->world.d, sizeof(float) * 16);
+            memcpy(&packed[4], i->inv_trans.d, sizeof(float) * 16);
+
+            for (int c = 0; c < 3; c++)
+                packed[8 + c] = formats::f0123({ i->normal.d[c * 3], i->normal.d[c * 3 + 1], i->normal.d[c * 3 + 2], 0.f });
+
+            packed[8].a = i->cast_shadows ? 1.f : 0.f;
+
+            if (i->material_index >= static_cast<int>(materials.size() / MATERIAL_FIELDS))
+                throw macs::exc::inv_index;
+
+            if (i->material_index >= 0)
+                memcpy(&packed[11], &materials[i->material_index * MATERIAL_FIELDS], sizeof(formats::f0123) * MATERIAL_FIELDS);
+            else
+                pack_material(i->mat, &packed[11]);
+
+            if (memcmp(row, packed, sizeof(packed)))
+            {
+                memcpy(row, packed, sizeof(packed));
+                table_changed = true;
+            }
+
+            row += INSTANCE_FIELDS;
+        }
+
+        if (table_changed)
+        {
+            obj->inst_table->write(obj->inst_data);
+            changed = true;
+        }
+    }
+
+    return changed;
+}
+
+bool scene::update_static_occluders(void)
+{
+    std::vector<float> state;
+
+    for (auto obj: objs)
+    {
+        for (auto i: obj->insts)
+            if (i->is_static && i->cast_shadows)
+                state.insert(state.end(), i->inv_trans.d, i->inv_trans.d + 16);
+
+        // Keeps instances of different objects apart
+        state.push_back(*obj->type_index);
+    }
+
+    if (state == static_occluders)
+        return false;
+
+    static_occluders.swap(state);
+
+    return true;
+}
+
+
+void scene::render_view(void)
+{
+    rnd_view->prepare();
+    rnd_view->bind_input();
+    rnd_view->execute();
+}
+
+void scene::render_intersection(const macs::texture *stt, const macs::texture *dir, const macs::texture *const *gbuf)
+{
+    for (auto obj: objs)
+    {
+        if (*obj->inst_count < 1.f)
+            continue;
+
+        obj->isct->bind(obj->isct->slot("ray_starting_points"), stt);
+        obj->isct->bind(obj->isct->slot("ray_directions"), dir);
+
+        for (int i = 0; i < gbuffer_size; i++)
+            *obj->isct >> gbuf[i];
+
+        obj->isct->prepare();
+        obj->isct->bind_input();
+        obj->isct->execute();
+
+        for (int i = 0; i < gbuffer_size; i++)
+            *obj->isct -= gbuf[i];
+    }
+}
+
+void scene::render_shadows(const std::list<light *> &dirty, bool geometry)
+{
+    prepare_shadows(dirty, geometry);
+
+    for (auto lgt: dirty)
+        render_shadow_map(lgt, lgt->shadow_map, lgt->shadow_lowres);
+}
+
+void scene::prepare_shadows(const std::list<light *> &dirty, bool geometry)
+{
+    const macs::texture *isct = &glob_isct, *sten = &asten;
+
+    if (shadow_div > 1)
+    {
+        scissor_render_size(shadow_div);
+
+        render_shadow_downsample();
+
+        isct = shadow_isct;
+        sten = shadow_asten;
+    }
+
+
+    // The intersection points cached for the static shadows are undefined
+    // after allocation
+    bool fresh = !static_stale;
+
+    if (update_static_shadows())
+        render_static_shadows(dirty, geometry || fresh, isct, sten);
+
+    scissor_render_size(1);
+}
+
+void scene::render_shadow_map(light *lgt, const macs::texture *map, const macs::texture *lowres)
+{
+    // Static lights already have the static instances' shadows
+    caster_set casters = lgt->static_shadow ? dynamic_casters : all_casters;
+
+    if (shadow_div == 1)
+    {
+        render_light_shadows(lgt, map, &glob_isct, &asten, lgt->static_shadow, true, casters);
+        return;
+    }
+
+    scissor_render_size(shadow_div);
+
+    render_light_shadows(lgt, lowres, shadow_isct, shadow_asten, lgt->static_shadow, true, casters);
+
+    scissor_render_size(1);
+
+    render_shadow_upsample(map, lowres);
+}
+
+const macs::texture *scene::shading_shadow_map(light *lgt)
+{
+    if (!shadow_interleaved)
+        return lgt->shadow_map;
+
+    // A light is not dirty just because it has become static or because
+    // instances have become (non-)static, but its static shadow is still
+    // needed to shade it
+    if (lgt->static_shadow && !lgt->static_valid)
+    {
+        scissor_render_size(shadow_div);
+
+        if (shadow_div > 1)
+            render_static_shadows({ lgt }, false, shadow_isct, shadow_asten);
+        else
+            render_static_shadows({ lgt }, false, &glob_isct, &asten);
+
+        scissor_render_size(1);
+    }
+
+    render_shadow_map(lgt, shadow_shared, shadow_shared_lowres);
+
+    return shadow_shared;
+}
+
+void scene::update_shadow_maps(void)
+{
+    int w = (macs::internals::width  + shadow_div - 1) / shadow_div;
+    int h = (macs::internals::height + shadow_div - 1) / shadow_div;
+
+    bool own = !shadow_interleaved, lowres = (shadow_div > 1);
+
+    for (auto lgt: lgts)
+    {
+        if (own && !lgt->shadow_map)
+            lgt->shadow_map = new macs::texture("shadow_map");
+        else if (!own && lgt->shadow_map)
+        {
+            delete lgt->shadow_map;
+            lgt->shadow_map = NULL;
+        }
+
+        bool own_lowres = own && lowres;
+
+        if (own_lowres && !lgt->shadow_lowres)
+            lgt->shadow_lowres = new macs::texture("shadow_map", true, w, h);
+        else if (!own_lowres && lgt->shadow_lowres)
+        {
+            delete lgt->shadow_lowres;
+            lgt->shadow_lowres = NULL;
+        }
+    }
+
+
+    bool shared = shadow_interleaved, shared_lowres = shadow_interleaved && lowres;
+
+    if (shared && !shadow_shared)
+        shadow_shared = new macs::texture("shadow_map");
+    else if (!shared && shadow_shared)
+    {
+        delete shadow_shared;
+        shadow_shared = NULL;
+    }
+
+    if (shared_lowres && !shadow_shared_lowres)
+        shadow_shared_lowres = new macs::texture("shadow_map", true, w, h);
+    else if (!shared_lowres && shadow_shared_lowres)
+    {
+        delete shadow_shared_lowres;
+        shadow_shared_lowres = NULL;
+    }
+}
+
+void scene::render_static_shadows(const std::list<light *> &dirty, bool geometry,
+                                  const macs::texture *isct, const macs::texture *sten)
+{
+    if (geometry)
+    {
+        rnd_static_stale->bind(rnd_static_stale->slot("global_intersection"), isct);
+        rnd_static_stale->bind(rnd_static_stale->slot("stencil"), sten);
+        rnd_static_stale->bind(rnd_static_stale->slot("static_intersection"), static_isct[0]);
+
+        *rnd_static_stale >> static_stale;
+        *rnd_static_stale >> static_isct[1];
+
+        rnd_static_stale->prepare();
+        rnd_static_stale->bind_input();
+        rnd_static_stale->execute();
+
+        *rnd_static_stale -= static_stale;
+        *rnd_static_stale -= static_isct[1];
+
+        std::swap(static_isct[0], static_isct[1]);
+    }
+
+
+    int clear_slot = rnd_static_clear->slot("stencil");
+
+    for (auto lgt: dirty)
+    {
+        if (!lgt->static_shadow || (lgt->static_valid && !geometry))
+            continue;
+
+        // Either everything or only the pixels with a new visible surface
+        if (lgt->static_valid)
+        {
+            *rnd_static_clear >> lgt->static_shadow;
+            rnd_static_clear->bind(clear_slot, static_stale);
+
+            rnd_static_clear->prepare();
+            rnd_static_clear->bind_input();
+            rnd_static_clear->execute();
+
+            *rnd_static_clear -= lgt->static_shadow;
+
+            render_light_shadows(lgt, lgt->static_shadow, isct, static_stale, NULL, false, static_casters);
+        }
+        else
+            render_light_shadows(lgt, lgt->static_shadow, isct, sten, NULL, true, static_casters);
+
+        lgt->static_valid = true;
+    }
+
+    rnd_static_clear->bind(clear_slot, NULL);
+}
+
+void scene::render_light_shadows(light *lgt, const macs::texture *map, const macs::texture *isct,
+                                 const macs::texture *sten, const macs::texture *init, bool clear,
+                                 caster_set casters)
+{
+    // Largest shadows first (judging by the instances' scale and their
+    // distance to the light), so the later passes can skip most pixels
+    std::vector<std::pair<float, instance *>> order;
+
+    for (auto obj: objs)
+    {
+        for (auto i: obj->insts)
+        {
+            if (!i->cast_shadows || ((casters == static_casters) && !i->is_static) ||
+                ((casters == dynamic_casters) && i->is_static))
+                continue;
+
+            const float *m = i->world.d, *l = (*lgt->position).d;
+
+            float scale = 0.f;
+
+            for (int c = 0; c < 3; c++)
+                scale = fmaxf(scale, m[c * 4] * m[c * 4] + m[c * 4 + 1] * m[c * 4 + 1] + m[c * 4 + 2] * m[c * 4 + 2]);
+
+            float dist = (m[12] - l[0]) * (m[12] - l[0]) + (m[13] - l[1]) * (m[13] - l[1]) + (m[14] - l[2]) * (m[14] - l[2]);
+
+            order.push_back(std::make_pair(-scale / fmaxf(dist, 1e-6f), i));
+        }
+    }
+
+    std::stable_sort(order.begin(), order.end(),
+                     [](const std::pair<float, instance *> &a, const std::pair<float, instance *> &b) { return a.first < b.first; });
+
+
+    std::vector<GLuint> queries;
+
+    int init_slot = rnd_shadow_init->slot("static_shadow");
+
+    *rnd_shadow_init >> map;
+    rnd_shadow_init->bind(init_slot, init);
+
+    rnd_shadow_init->prepare();
+
+    if (clear)
+        rnd_shadow_init->clear_output({ 0.f, 0.f, 0.f, 0.f });
+
+    rnd_shadow_init->clear_stencil(0);
+
+    if (init)
+    {
+        rnd_shadow_init->bind_input();
+
+        execute_shadow_pass(rnd_shadow_init, queries);
+    }
+
+    rnd_shadow_init->bind(init_slot, NULL);
+    *rnd_shadow_init -= map;
+
+
+    *cur_light_pos = *lgt->position;
+
+    object *cur = NULL;
+
+    for (auto &o: order)
+    {
+        instance *i = o.second;
+
+        if (i->obj != cur)
+        {
+            if (cur)
+                *cur->shadow -= map;
+
+            cur = i->obj;
+
+            cur->shadow->bind(cur->shadow_isct_slot, isct);
+            cur->shadow->bind(cur->shadow_stencil_slot, sten);
+
+            *cur->shadow >> map;
+
+            cur->shadow->prepare();
+            cur->shadow->bind_input();
+        }
+
+        *cur->cur_inv_trans = i->inv_trans;
+
+        execute_shadow_pass(cur->shadow, queries);
+    }
+
+    if (cur)
+        *cur->shadow -= map;
+
+
+    // Every fragment passed (i.e., found in shadow) is skipped by all
+    // following passes
+    for (size_t q = 0; q < queries.size(); q++)
+        shadow_queries.push_back(std::make_pair(queries[q], static_cast<int>(queries.size() - q - 1)));
+}
+
+void scene::execute_shadow_pass(macs::render *rnd, std::vector<GLuint> &queries)
+{
+    if (!shadow_stats)
+    {
+        rnd->execute();
+        return;
+    }
+
+
+    GLuint q;
+
+    if (shadow_query_pool.empty())
+        glGenQueries(1, &q);
+    else
+    {
+        q = shadow_query_pool.back();
+        shadow_query_pool.pop_back();
+    }
+
+    glBeginQuery(GL_SAMPLES_PASSED, q);
+    rnd->execute();
+    glEndQuery(GL_SAMPLES_PASSED);
+
+    queries.push_back(q);
+}
+
+void scene::update_shadow_statistics(bool wait)
+{
+    // Results become available in order
+    size_t done = 0;
+
+    for (auto &q: shadow_queries)
+    {
+        GLuint passed;
+
+        if (!wait)
+        {
+            GLint available;
+            glGetQueryObjectiv(q.first, GL_QUERY_RESULT_AVAILABLE, &available);
+
+            if (!available)
+                break;
+        }
+
+        glGetQueryObjectuiv(q.first, GL_QUERY_RESULT, &passed);
+
+        shadow_saved += static_cast<unsigned long long>(passed) * q.second;
+        shadow_query_pool.push_back(q.first);
+
+        done++;
+    }
+
+    shadow_queries.erase(shadow_queries.begin(), shadow_queries.begin() + done);
+}
+
+void scene::set_shadow_statistics(bool enable)
+{
+    update_shadow_statistics(true);
+
+    shadow_stats = enable;
+    shadow_saved = 0;
+}
+
+unsigned long long scene::shadow_fragments_saved(void)
+{
+    update_shadow_statistics(true);
+
+    return shadow_saved;
+}
+
+bool scene::update_static_shadows(void)
+{
+    int w = macs::internals::width, h = macs::internals::height;
+
+    if (shadow_div > 1)
+    {
+        w = (w + shadow_div - 1) / shadow_div;
+        h = (h + shadow_div - 1) / shadow_div;
+    }
+
+
+    bool any = false;
+
+    for (auto lgt: lgts)
+    {
+        if (lgt->is_static && !lgt->static_shadow)
+        {
+            lgt->static_shadow = new macs::texture("shadow_map", true, w, h);
+            lgt->static_valid = false;
+        }
+        else if (!lgt->is_static && lgt->static_shadow)
+        {
+            delete lgt->static_shadow;
+            lgt->static_shadow = NULL;
+        }
+
+        any |= lgt->is_static;
+    }
+
+
+    if (any && !static_stale)
+    {
+        static_stale  = new macs::texture("static_stale", true, w, h);
+        static_isct[0] = new macs::texture("static_update", true, w, h);
+        static_isct[1] = new macs::texture("static_update", true, w, h);
+    }
+    else if (!any && static_stale)
+    {
+        delete static_isct[0];
+        delete static_isct[1];
+        delete static_stale;
+
+        static_isct[0] = static_isct[1] = static_stale = NULL;
+    }
+
+    return any;
+}
+
+void scene::render_shadow_downsample(void)
+{
+    rnd_shadow_down->prepare();
+    rnd_shadow_down->bind_input();
+    rnd_shadow_down->execute();
+}
+
+void scene::render_shadow_upsample(const macs::texture *map, const macs::texture *lowres)
+{
+    *rnd_shadow_up >> map;
+    rnd_shadow_up->bind(shadow_up_slot, lowres);
+
+    rnd_shadow_up->prepare();
+    rnd_shadow_up->bind_input();
+    rnd_shadow_up->execute();
+
+    rnd_shadow_up->bind(shadow_up_slot, NULL);
+    *rnd_shadow_up -= map;
+}
+
+void scene::render_shading(const std::list<light *> &dirty)
+{
+    if (!update_shading_cache())
+    {
+        bool first_light = true;
+
+        for (auto lgt: lgts)
+        {
+            shade_light(lgt, gbuffer, &ray_dir, shading_shadow_map(lgt), &output, first_light);
+            first_light = false;
+        }
+
+        return;
+    }
+
+
+    for (auto lgt: dirty)
+        lgt->contribution_valid = false;
+
+    for (auto lgt: lgts)
+    {
+        if (lgt->contribution_valid)
+            continue;
+
+        shade_light(lgt, gbuffer, &ray_dir, shading_shadow_map(lgt), lgt->contribution, true);
+
+        lgt->contribution_valid = true;
+    }
+
+
+    // Adding up the contributions in the same order as the shading itself
+    // does gives exactly the same result
+    bool first_light = true;
+
+    for (auto lgt: lgts)
+    {
+        rnd_combine->bind(combine_slot, lgt->contribution);
+
+        rnd_combine->prepare();
+        rnd_combine->bind_input();
+
+        if (first_light)
+        {
+            rnd_combine->clear_output({ 0.f, 0.f, 0.f, 0.f });
+            first_light = false;
+        }
+
+        rnd_combine->execute();
+    }
+
+    rnd_combine->bind(combine_slot, NULL);
+}
+
+bool scene::update_shading_cache(void)
+{
+    size_t per_light = static_cast<size_t>(macs::internals::width) * macs::internals::height * sizeof(formats::f0123);
+    bool cached = shading_cache_limit && (lgts.size() * per_light <= shading_cache_limit);
+
+    for (auto lgt: lgts)
+    {
+        if (cached && !lgt->contribution)
+        {
+            lgt->contribution = new macs::texture("output");
+            lgt->contribution_valid = false;
+        }
+        else if (!cached && lgt->contribution)
+        {
+            delete lgt->contribution;
+            lgt->contribution = NULL;
+        }
+    }
+
+    return cached;
+}
+
+void scene::shade_light(light *lgt, const macs::texture *const *gbuf, const macs::texture *dir,
+                        const macs::texture *shadow, const macs::texture *target, bool clear)
+{
+    for (int i = 0; i < gbuffer_size; i++)
+        lgt->shade->bind(lgt->shade->slot(gbuffer_names[i]), gbuf[i]);
+
+    lgt->shade->bind(lgt->shade->slot("ray_directions"), dir);
+    lgt->shade->bind(lgt->shade->slot("shadow_map"), shadow);
+
+    *lgt->shade >> target;
+
+    lgt->shade->prepare();
+    lgt->shade->bind_input();
+
+    if (clear)
+        lgt->shade->clear_output({ 0.f, 0.f, 0.f, 0.f });
+
+    lgt->shade->execute();
+
+    *lgt->shade -= target;
+}
+
+void scene::render_ambient(const macs::texture *const *gbuf, const macs::texture *target)
+{
+    rnd_ambient->bind(rnd_ambient->slot("ambient_map"), gbuf[gbuffer_ambient]);
+    rnd_ambient->bind(rnd_ambient->slot("stencil"), gbuf[gbuffer_stencil]);
+
+    *rnd_ambient >> target;
+
+    rnd_ambient->prepare();
+    rnd_ambient->bind_input();
+    rnd_ambient->execute();
+
+    *rnd_ambient -= target;
+}
+
+void scene::render_edge_aa(bool geometry)
+{
+    if (geometry)
+    {
+        // Edge detection and compaction cover the whole texture (the edge
+        // detection itself ignores everything outside the rendered area)
+        glDisable(GL_SCISSOR_TEST);
+
+        rnd_aa_edges->prepare();
+        rnd_aa_edges->bind_input();
+        rnd_aa_edges->execute();
+
+        (*aa_compact)();
+
+        int edges = aa_compact->count();
+        int capacity = macs::internals::width * aa_list_height / aa_samples;
+
+        if (edges > capacity)
+            edges = capacity;
+
+        aa_list_rows = (edges * aa_samples + macs::internals::width - 1) / macs::internals::width;
+
+        glEnable(GL_SCISSOR_TEST);
+    }
+
+    if (!aa_list_rows)
+        return;
+
+
+    // Only the part of the list actually used is processed
+    glScissor(0, 0, macs::internals::width, aa_list_rows);
+
+    if (geometry)
+    {
+        rnd_aa_rays->prepare();
+        rnd_aa_rays->bind_input();
+        rnd_aa_rays->execute();
+
+        render_intersection(aa_ray_stt, aa_ray_dir, aa_gbuffer);
+    }
+
+    // One light after another, so a single shadow map suffices
+    bool first_light = true;
+
+    for (auto lgt: lgts)
+    {
+        render_light_shadows(lgt, aa_shadow, aa_gbuffer[gbuffer_isct], aa_gbuffer[gbuffer_stencil], NULL, true, all_casters);
+
+        shade_light(lgt, aa_gbuffer, aa_ray_dir, aa_shadow, aa_color, first_light);
+        first_light = false;
+    }
+
+    render_ambient(aa_gbuffer, aa_color);
+
+
+    scissor_render_size(1);
+
+    rnd_aa_resolve->bind(aa_resolve_slot, aa_color);
+
+    rnd_aa_resolve->prepare();
+    rnd_aa_resolve->bind_input();
+    rnd_aa_resolve->execute();
+
+    rnd_aa_resolve->bind(aa_resolve_slot, NULL);
+}
+
+void scene::render_secondary(void)
+{
+    int w = macs::internals::width;
+
+    // Rows used per level
+    std::vector<int> rows;
+
+    for (int level = 0; level < sec_depth; level++)
+    {
+        const macs::texture *const *gbuf = level ? sec_gbuffer : gbuffer;
+
+        rnd_sec_spawn->bind(rnd_sec_spawn->slot("global_intersection"), gbuf[gbuffer_isct]);
+        rnd_sec_spawn->bind(rnd_sec_spawn->slot("normal_map"), gbuf[gbuffer_normal]);
+        rnd_sec_spawn->bind(rnd_sec_spawn->slot("mirror_map"), gbuf[gbuffer_mirror]);
+        rnd_sec_spawn->bind(rnd_sec_spawn->slot("refract_map"), gbuf[gbuffer_refract]);
+        rnd_sec_spawn->bind(rnd_sec_spawn->slot("stencil"), gbuf[gbuffer_stencil]);
+        rnd_sec_spawn->bind(rnd_sec_spawn->slot("ray_directions"), level ? sec_ray_dir : &ray_dir);
+        rnd_sec_spawn->bind(rnd_sec_spawn->slot("sec_info"), sec_infos[level ? level - 1 : 0]);
+
+        if (!level)
+        {
+            *sec_parent_size = vec2(w, macs::internals::height);
+            *sec_parent_limit = *render_size;
+            *sec_parent_count = static_cast<float>(w * macs::internals::height);
+            *sec_primary = 1.f;
+        }
+        else
+        {
+            *sec_primary = 0.f;
+        }
+
+        // Spawning and compaction cover the whole texture
+        glDisable(GL_SCISSOR_TEST);
+
+        rnd_sec_spawn->prepare();
+        rnd_sec_spawn->bind_input();
+        rnd_sec_spawn->execute();
+
+        (*sec_compact)();
+
+        int count = sec_compact->count();
+
+        if (count > w * sec_queue_height)
+            count = w * sec_queue_height;
+
+        if (!count)
+        {
+            glEnable(GL_SCISSOR_TEST);
+            break;
+        }
+
+        *rnd_sec_map >> sec_maps[level];
+
+        rnd_sec_map->prepare();
+        rnd_sec_map->bind_input();
+        rnd_sec_map->execute();
+
+        *rnd_sec_map -= sec_maps[level];
+
+
+        // Only the part of the queue actually used is processed
+        rows.push_back((count + w - 1) / w);
+
+        glEnable(GL_SCISSOR_TEST);
+        glScissor(0, 0, w, rows.back());
+
+        *rnd_sec_rays >> sec_infos[level];
+
+        rnd_sec_rays->prepare();
+        rnd_sec_rays->bind_input();
+        rnd_sec_rays->execute();
+
+        *rnd_sec_rays -= sec_infos[level];
+
+        render_intersection(sec_ray_stt, sec_ray_dir, sec_gbuffer);
+
+        // One light after another, so a single shadow map suffices
+        bool first_light = true;
+
+        for (auto lgt: lgts)
+        {
+            render_light_shadows(lgt, sec_shadow, sec_gbuffer[gbuffer_isct], sec_gbuffer[gbuffer_stencil], NULL, true, all_casters);
+
+            shade_light(lgt, sec_gbuffer, sec_ray_dir, sec_shadow, sec_colors[level], first_light);
+            first_light = false;
+        }
+
+        render_ambient(sec_gbuffer, sec_colors[level]);
+
+        *sec_parent_size = vec2(w, sec_queue_height);
+        *sec_parent_limit = vec2(w, rows.back());
+        *sec_parent_count = static_cast<float>(count);
+    }
+
+
+    // Bottom-up, so every level is complete when it is added to its parent
+    int map_slot = rnd_sec_resolve->slot("sec_map");
+    int info_slot = rnd_sec_resolve->slot("sec_info");
+    int color_slot = rnd_sec_resolve->slot("sec_color");
+
+    for (int level = static_cast<int>(rows.size()) - 1; level >= 0; level--)
+    {
+        const macs::texture *target = level ? sec_colors[level - 1] : &output;
+
+        if (level)
+            glScissor(0, 0, w, rows[level - 1]);
+        else
+            scissor_render_size(1);
+
+        rnd_sec_resolve->bind(map_slot, sec_maps[level]);
+        rnd_sec_resolve->bind(info_slot, sec_infos[level]);
+        rnd_sec_resolve->bind(color_slot, sec_colors[level]);
+
+        *rnd_sec_resolve >> target;
+
+        rnd_sec_resolve->prepare();
+        rnd_sec_resolve->bind_input();
+        rnd_sec_resolve->execute();
+
+        *rnd_sec_resolve -= target;
+    }
+
+    rnd_sec_resolve->bind(map_slot, NULL);
+    rnd_sec_resolve->bind(info_slot, NULL);
+    rnd_sec_resolve->bind(color_slot, NULL);
+
+    scissor_render_size(1);
+}
+
+void scene::display(void)
+{
+    render_to_screen(_dbl_buf);
+
+    if ((render_w < macs::internals::width) || (render_h < macs::internals::height))
+        output.display(render_w, render_h);
+    else
+        output.display();
+}
+
+
+int scene::add_material(const material &mat)
+{
+    int index = materials.size() / MATERIAL_FIELDS;
+
+    materials.resize(materials.size() + MATERIAL_FIELDS);
+    pack_material(mat, &materials[index * MATERIAL_FIELDS]);
+
+    return index;
+}
+
+void scene::update_material(int index, const material &mat)
+{
+    if ((index < 0) || (index >= static_cast<int>(materials.size() / MATERIAL_FIELDS)))
+        throw macs::exc::inv_index;
+
+    pack_material(mat, &materials[index * MATERIAL_FIELDS]);
+}
+
+void scene::refresh_material_texture(const macs::texture *tex)
+{
+    auto layer = material_layers.find(tex);
+
+    if (layer != material_layers.end())
+    {
+        copy_material_texture(tex, layer->second);
+        invalid = true;
+    }
+}
+
+
+void scene::forget_material_texture(const macs::texture *tex)
+{
+    auto known = material_layers.find(tex);
+
+    if (known == material_layers.end())
+        return;
+
+    float layer = known->second;
+
+    free_material_layers.push_back(known->second);
+    material_layers.erase(known);
+
+    // Registered materials lose the texture (see pack_material())
+    static const int layer_fields[][2] = { { 0, 3 }, { 1, 3 }, { 3, 0 }, { 3, 1 }, { 3, 2 }, { 3, 3 }, { 4, 3 } };
+
+    for (size_t m = 0; m < materials.size(); m += MATERIAL_FIELDS)
+        for (auto &f: layer_fields)
+            if (materials[m + f[0]]._f[f[1]] == layer)
+                materials[m + f[0]]._f[f[1]] = -1.f;
+}
+
+
+int scene::material_layer(const macs::texture *tex)
+{
+    auto known = material_layers.find(tex);
+
+    if (known != material_layers.end())
+        return known->second;
+
+
+    int layer;
+
+    if (!free_material_layers.empty())
+    {
+        layer = free_material_layers.back();
+        free_material_layers.pop_back();
+    }
+    else
+        layer = material_layers.size();
+
+    int layers = material_textures.layers();
+    int w = std::max(material_textures.get_width(),  std::min(tex->get_width(),  material_res));
+    int h = std::max(material_textures.get_height(), std::min(tex->get_height(), material_res));
+
+    if (layer >= layers)
+    {
+        GLint max_layers;
+        glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+
+        if (layer >= max_layers)
+            throw macs::exc::rsrc_lim_exc;
+
+        layers = std::min(2 * layers, static_cast<int>(max_layers));
+    }
+
+    // The known layers are rescaled from their current contents (the
+    // textures they came from may be gone by now)
+    if ((layers != material_textures.layers()) || (w != material_textures.get_width()) ||
+        (h != material_textures.get_height()))
+    {
+        material_textures.resize(layers, w, h);
+        invalid = true;
+    }
+
+    copy_material_texture(tex, layer);
+
+    material_layers[tex] = layer;
+
+    return layer;
+}
+
+void scene::copy_material_texture(const macs::texture *tex, int layer)
+{
+    macs::texture_layer dst(&material_textures, layer, "resampled");
+
+    *rnd_resample >> &dst;
+    rnd_resample->bind(resample_slot, tex);
+
+    rnd_resample->prepare();
+    rnd_resample->bind_input();
+    rnd_resample->execute();
+
+    rnd_resample->bind(resample_slot, NULL);
+    *rnd_resample -= &dst;
+}
+
+void scene::pack_material(const material &mat, formats::f0123 *dst)
+{
+    float ambient_layer = mat.ambient_texed          ? material_layer(mat.ambient.tex)        : -1.f;
+    float mirror_layer  = mat.mirror_texed           ? material_layer(mat.mirror.tex)         : -1.f;
+    float refract_layer = mat.refract_texed          ? material_layer(mat.refract.tex)        : -1.f;
+    float color0_layer  = mat.layer[0].color_texed   ? material_layer(mat.layer[0].color.tex) : -1.f;
+    float rp0_layer     = mat.layer[0].rp_texed      ? material_layer(mat.layer[0].rp.tex)    : -1.f;
+    float color1_layer  = mat.layer[1].color_texed   ? material_layer(mat.layer[1].color.tex) : -1.f;
+    float rp1_layer     = mat.layer[1].rp_texed      ? material_layer(mat.layer[1].rp.tex)    : -1.f;
+
+    // forget_material_texture() knows where the layers are
+    dst[0] = formats::f0123({ mat.ambient.flat.r, mat.ambient.flat.g, mat.ambient.flat.b, ambient_layer });
+    dst[1] = formats::f0123({ mat.mirror.flat.r, mat.mirror.flat.g, mat.mirror.flat.b, mirror_layer });
+    dst[2] = formats::f0123({ mat.refract.flat.r, mat.refract.flat.g, mat.refract.flat.b, mat.refract.flat.a });
+    dst[3] = formats::f0123({ refract_layer, color0_layer, rp0_layer, color1_layer });
+    dst[4] = formats::f0123({ mat.layer[0].color.flat.r, mat.layer[0].color.flat.g, mat.layer[0].color.flat.b, rp1_layer });
+    dst[5] = formats::f0123({ mat.layer[1].color.flat.r, mat.layer[1].color.flat.g, mat.layer[1].color.flat.b, mat.n });
+    dst[6] = formats::f0123({ mat.layer[0].rp.flat.x, mat.layer[0].rp.flat.y, mat.layer[1].rp.flat.x, mat.layer[1].rp.flat.y });
+}
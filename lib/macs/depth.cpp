@@ -25,7 +25,7 @@ texture *stencildepth::depth_to_texture(const char *name)
 {
     macs::texture *t = new macs::texture(name);
 
-    (*internals::tmu_mgr)[0] = t;
+    internals::tmu_mgr->select(t);
 
     // Of course this is slow, but there's a reason we warn the user about just that.
     glCopyTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, 0, 0, internals::width, internals::height, 0);
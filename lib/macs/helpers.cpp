@@ -14,6 +14,23 @@ void macs::internals::draw_quad(void)
     glEnd();
 }
 
+void macs::internals::draw_quad(int instances)
+{
+    static const float vertices[] = {
+        -1.f,  1.f,
+        -1.f, -1.f,
+         1.f, -1.f,
+         1.f,  1.f
+    };
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(2, GL_FLOAT, 0, vertices);
+
+    glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, instances);
+
+    glDisableClientState(GL_VERTEX_ARRAY);
+}
+
 
 void macs::opengl_version(int &major, int &minor)
 {
@@ -10,6 +10,36 @@
 using namespace macs;
 using namespace macs::internals;
 
+
+/**
+ * Loads and compiles an optional shader. Returns NULL on failure.
+ */
+static shader *load_optional_shader(shader::type t, const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+    {
+        dbgprintf("Could not load %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    shader *sh = new shader(t);
+    sh->load(fp);
+
+    fclose(fp);
+
+
+    if (!sh->compile())
+    {
+        dbgprintf("Could not compile %s.\n", path);
+        delete sh;
+        return NULL;
+    }
+
+    return sh;
+}
+
+
 bool macs::init(int width, int height)
 {
 #ifdef __WIN32
@@ -157,6 +187,25 @@ bool macs::init(int width, int height)
 
 
 
+    // Layered rendering (geometry shaders and instancing) requires OpenGL 3.2
+    if ((ogl_maj > 3) || ((ogl_maj == 3) && (ogl_min >= 2)))
+    {
+        internals::layered_vertex_shader = load_optional_shader(internals::shader::vertex, "shaders/layered-vertex.glsl");
+        internals::layered_geometry_shader = load_optional_shader(internals::shader::geometry, "shaders/layered-geometry.glsl");
+
+        if ((internals::layered_vertex_shader == NULL) || (internals::layered_geometry_shader == NULL))
+        {
+            delete internals::layered_vertex_shader;
+            delete internals::layered_geometry_shader;
+
+            internals::layered_vertex_shader = internals::layered_geometry_shader = NULL;
+        }
+    }
+
+    dbgprintf("Layered rendering is %ssupported.\n", (internals::layered_vertex_shader != NULL) ? "" : "not ");
+
+
+
     glViewport(0, 0, width, height);
 
 
@@ -0,0 +1,286 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "macs.hpp"
+#include "macs-internals.hpp"
+
+using namespace macs;
+using namespace macs::types;
+
+
+/// Edge length of the blocks combined into one element per pass.
+#define REDUCE_BLOCK 4
+
+
+reduce::reduce(operation op, int w, int h):
+    src_size("reduce_size", vec2()),
+    src_tex_size("reduce_tex_size", vec2())
+{
+    switch (op)
+    {
+        case sum:
+            setup("a + b", "v", w, h);
+            break;
+
+        case min:
+            setup("min(a, b)", "v", w, h);
+            break;
+
+        case max:
+            setup("max(a, b)", "v", w, h);
+            break;
+
+        // On ties, b always has the higher index
+        case argmin:
+            setup("(b.x < a.x) ? b : a", "vec4(v.x, idx, 0.)", w, h);
+            break;
+
+        case argmax:
+            setup("(b.x > a.x) ? b : a", "vec4(v.x, idx, 0.)", w, h);
+            break;
+    }
+}
+
+reduce::reduce(operation r, operation g, operation b, operation a, int w, int h):
+    src_size("reduce_size", vec2()),
+    src_tex_size("reduce_tex_size", vec2())
+{
+    std::string combine = std::string("vec4(") + channel_op(r, "x") + ", " + channel_op(g, "y") + ", " +
+                          channel_op(b, "z") + ", " + channel_op(a, "w") + ")";
+
+    setup(combine.c_str(), "v", w, h);
+}
+
+reduce::reduce(const char *op, int w, int h):
+    src_size("reduce_size", vec2()),
+    src_tex_size("reduce_tex_size", vec2())
+{
+    setup(op, "v", w, h);
+}
+
+reduce::~reduce(void)
+{
+    delete first;
+    delete ping_pong;
+    delete pong_ping;
+
+    delete ping;
+    delete pong;
+
+    if (fence)
+        glDeleteSync(fence);
+
+    if (pbo)
+        glDeleteBuffers(1, &pbo);
+}
+
+
+const char *reduce::channel_op(operation op, const char *channel)
+{
+    static const char *ops[3][4] = {
+        { "a.x + b.x", "a.y + b.y", "a.z + b.z", "a.w + b.w" },
+        { "min(a.x, b.x)", "min(a.y, b.y)", "min(a.z, b.z)", "min(a.w, b.w)" },
+        { "max(a.x, b.x)", "max(a.y, b.y)", "max(a.z, b.z)", "max(a.w, b.w)" }
+    };
+
+    if ((op != sum) && (op != min) && (op != max))
+        throw exc::inv_type;
+
+    return ops[op][channel[0] == 'w' ? 3 : channel[0] - 'x'];
+}
+
+
+void reduce::setup(const char *combine, const char *element, int w, int h)
+{
+    if (w <= 0)
+        w = internals::width;
+    if (h <= 0)
+        h = internals::height;
+
+    int rw = (w + REDUCE_BLOCK - 1) / REDUCE_BLOCK, rh = (h + REDUCE_BLOCK - 1) / REDUCE_BLOCK;
+
+    ping = new texture("reduce_ping", true, rw, rh);
+    pong = new texture("reduce_pong", true, rw, rh);
+    last = ping;
+
+
+    char tmp[16];
+    sprintf(tmp, "%i", REDUCE_BLOCK);
+
+    std::string global = std::string(
+        "vec4 combine(vec4 a, vec4 b)\n"
+        "{\n"
+        "    return ") + combine + ";\n"
+        "}\n\n"
+        "vec4 element(vec2 idx)\n"
+        "{\n"
+        "    vec4 v = texture2D(REDUCE_SOURCE, (idx + .5) / reduce_tex_size);\n"
+        "    return " + element + ";\n"
+        "}\n";
+
+    std::string local = std::string(
+        "vec2 base = floor(gl_FragCoord.xy) * ") + tmp + ".;\n"
+        "vec4 acc = element(base);\n\n"
+        "for (int j = 0; j < " + tmp + "; j++)\n"
+        "{\n"
+        "    for (int i = 0; i < " + tmp + "; i++)\n"
+        "    {\n"
+        "        vec2 idx = base + vec2(float(i), float(j));\n\n"
+        "        if ((i + j > 0) && all(lessThan(idx, reduce_size)))\n"
+        "            acc = combine(acc, element(idx));\n"
+        "    }\n"
+        "}";
+
+
+    texture_placebo src_plac("reduce_src");
+
+    first = new render({ &src_plac, &src_size, &src_tex_size }, { ping }, ("#define REDUCE_SOURCE raw_reduce_src\n" + global).c_str(), local.c_str(), "acc");
+    src_slot = first->slot("reduce_src");
+
+    // Later passes do not have to map the elements anymore
+    global = std::string(
+        "vec4 combine(vec4 a, vec4 b)\n"
+        "{\n"
+        "    return ") + combine + ";\n"
+        "}\n\n"
+        "vec4 element(vec2 idx)\n"
+        "{\n"
+        "    return texture2D(REDUCE_SOURCE, (idx + .5) / reduce_tex_size);\n"
+        "}\n";
+
+    ping_pong = new render({ ping, &src_size, &src_tex_size }, { pong }, ("#define REDUCE_SOURCE raw_reduce_ping\n" + global).c_str(), local.c_str(), "acc");
+    pong_ping = new render({ pong, &src_size, &src_tex_size }, { ping }, ("#define REDUCE_SOURCE raw_reduce_pong\n" + global).c_str(), local.c_str(), "acc");
+
+
+    pbo = 0;
+    fence = 0;
+    have_value = false;
+
+    // Asynchronous readback requires PBOs and sync objects
+    if ((internals::ogl_maj > 3) || ((internals::ogl_maj == 3) && (internals::ogl_min >= 2)))
+    {
+        glGenBuffers(1, &pbo);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, sizeof(formats::f0123), NULL, GL_STREAM_READ);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+}
+
+
+void reduce::operator()(const texture *tex)
+{
+    if ((tex->width > ping->width * REDUCE_BLOCK) || (tex->height > ping->height * REDUCE_BLOCK))
+        throw exc::rsrc_lim_exc;
+
+
+    // Only the lower left part of the intermediate textures is used after the
+    // first pass
+    GLint scissor[4];
+    GLboolean scissored = glIsEnabled(GL_SCISSOR_TEST);
+    glGetIntegerv(GL_SCISSOR_BOX, scissor);
+
+    glEnable(GL_SCISSOR_TEST);
+
+
+    int w = tex->width, h = tex->height;
+
+    render *rnd = first;
+    first->bind(src_slot, tex);
+
+    *src_tex_size = vec2(w, h);
+
+    do
+    {
+        *src_size = vec2(w, h);
+
+        w = (w + REDUCE_BLOCK - 1) / REDUCE_BLOCK;
+        h = (h + REDUCE_BLOCK - 1) / REDUCE_BLOCK;
+
+        glScissor(0, 0, w, h);
+
+        rnd->prepare();
+        rnd->bind_input();
+        rnd->execute();
+
+        if (rnd == ping_pong)
+        {
+            last = pong;
+            rnd = pong_ping;
+        }
+        else
+        {
+            last = ping;
+            rnd = ping_pong;
+        }
+
+        *src_tex_size = vec2(ping->width, ping->height);
+    }
+    while ((w > 1) || (h > 1));
+
+    first->bind(src_slot, NULL);
+
+
+    // The last render object's FBO is still bound
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+
+    if (pbo)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+        glReadPixels(0, 0, 1, 1, GL_RGBA, GL_FLOAT, NULL);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        if (fence)
+            glDeleteSync(fence);
+
+        fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+        have_value = false;
+    }
+    else
+    {
+        glReadPixels(0, 0, 1, 1, GL_RGBA, GL_FLOAT, &value);
+        have_value = true;
+    }
+
+
+    glScissor(scissor[0], scissor[1], scissor[2], scissor[3]);
+
+    if (!scissored)
+        glDisable(GL_SCISSOR_TEST);
+}
+
+
+bool reduce::ready(void)
+{
+    if (have_value)
+        return true;
+
+    // Nothing has been reduced yet
+    if (!fence)
+        return false;
+
+    GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+
+    return (status == GL_ALREADY_SIGNALED) || (status == GL_CONDITION_SATISFIED);
+}
+
+
+formats::f0123 reduce::result(void)
+{
+    if (have_value)
+        return value;
+
+    if (!fence)
+        throw exc::inv_exec_order;
+
+    while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+    glGetBufferSubData(GL_PIXEL_PACK_BUFFER, 0, sizeof(value), &value);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    have_value = true;
+
+    return value;
+}
@@ -1,6 +1,8 @@
 #include <cstdarg>
 #include <cstdint>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <initializer_list>
 #include <list>
 #include <string>
@@ -12,7 +14,52 @@ using namespace macs;
 using namespace macs::types;
 
 
-render::render(std::initializer_list<const in *> input, std::initializer_list<const out *> output, const char *global_src, const char *shared_src, ...)
+void render::attach_color(int attachment, const out *obj)
+{
+    switch (obj->o_type)
+    {
+        case out::t_texture:
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + attachment, GL_TEXTURE_2D, static_cast<const texture *>(obj)->id, 0);
+            break;
+
+        case out::t_texture_array:
+            glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + attachment, static_cast<const texture_array *>(obj)->id, 0);
+            break;
+
+        case out::t_texture_layer:
+        {
+            const texture_layer *tl = static_cast<const texture_layer *>(obj);
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + attachment, tl->array->id, 0, tl->layer);
+            break;
+        }
+    }
+}
+
+
+render::render(std::initializer_list<const in *> input, std::initializer_list<const out *> output, const char *global_src, const char *shared_src, ...):
+    cprg(NULL)
+{
+    std::vector<const char *> values;
+
+    va_list va;
+    va_start(va, shared_src);
+
+    for (size_t i = 0; i < output.size(); i++)
+        values.push_back(va_arg(va, const char *));
+
+    va_end(va);
+
+
+    build(input, output, global_src, shared_src, values);
+}
+
+render::render(const std::vector<const in *> &input, const std::vector<const out *> &output, const char *global_src, const char *shared_src, const std::vector<const char *> &values):
+    cprg(NULL)
+{
+    build(input, output, global_src, shared_src, values);
+}
+
+void render::build(const std::vector<const in *> &input, const std::vector<const out *> &output, const char *global_src, const char *shared_src, const std::vector<const char *> &values)
 {
     de = se = false;
 
@@ -28,10 +75,37 @@ render::render(std::initializer_list<const in *> input, std::initializer_list<co
 
 
     fbos = 0;
+    layers = 0;
+
     for (auto obj: output)
-        if (obj->o_type == out::t_texture)
+    {
+        if (obj->o_type != out::t_stencildepth)
             fbos++;
 
+        if (obj->o_type == out::t_texture_array)
+        {
+            int l = static_cast<const texture_array *>(obj)->elements;
+
+            if (layers && (layers != l))
+                throw exc::inv_type;
+
+            layers = l;
+        }
+    }
+
+    // Layered FBOs must not have any non-layered attachments
+    if (layers)
+    {
+        for (auto obj: output)
+            if (obj->o_type != out::t_texture_array)
+                throw exc::inv_type;
+
+        if (internals::layered_vertex_shader == NULL)
+            throw exc::rsrc_lim_exc;
+
+        dbgprintf("[rnd?] Layered rendering to %i layers.\n", layers);
+    }
+
 
     fbos = (fbos + internals::out_units - 1) / internals::out_units;
 
@@ -53,7 +127,24 @@ render::render(std::initializer_list<const in *> input, std::initializer_list<co
 
     std::string *final_src = new std::string[fbos];
 
-    final_src[0] = "varying vec2 tex_coord;\n";
+    final_src[0] = "";
+
+    array_inputs = false;
+
+    for (auto obj: input)
+    {
+        if (obj->i_type == in::t_texture_array)
+        {
+            final_src[0] += "#extension GL_EXT_texture_array: enable\n";
+            array_inputs = true;
+            break;
+        }
+    }
+
+    final_src[0] += "varying vec2 tex_coord;\nuniform vec2 texel_size;\n";
+
+    if (layers)
+        final_src[0] += "varying float out_layer;\n#define layer int(out_layer + .5)\n";
 
 
     for (auto obj: input)
@@ -64,38 +155,35 @@ render::render(std::initializer_list<const in *> input, std::initializer_list<co
         {
             case in::t_texture:
             case in::t_texture_placebo:
-                final_src[0] += std::string("uniform sampler2D raw_") + name + ";\n";
-                final_src[0] += "#define " + name + " texture2D(raw_" + name + ", tex_coord)\n";
+                src_inputs += std::string("uniform sampler2D raw_") + name + ";\n";
+                src_inputs += "#define " + name + " texture2D(raw_" + name + ", tex_coord)\n";
                 break;
 
             case in::t_texture_array:
-            {
-                char layers[6]; // FIXME: Overflow
-                sprintf(layers, "%i", static_cast<const texture_array *>(obj)->elements);
-                final_src[0] += std::string("uniform sampler3D raw_") + name + ";\n#define " + name + "(layer) texture3D(raw_" + name + ", vec3(tex_coord, float(layer) / " + layers + ".0))\n";
+                src_inputs += std::string("uniform sampler2DArray raw_") + name + ";\n";
+                src_inputs += "#define " + name + "(layer) texture2DArray(raw_" + name + ", vec3(tex_coord, float(layer)))\n";
                 break;
-            }
 
             case in::t_vec2:
-                final_src[0] += std::string("uniform vec2 ") + name + ";\n";
+                src_inputs += std::string("uniform vec2 ") + name + ";\n";
                 break;
 
             case in::t_vec3:
-                // final_src[0] += std::string("#define ") + name + " " + static_cast<std::string>(**static_cast<const named<vec3> *>(obj)) + "\n";
-                final_src[0] += std::string("uniform vec3 ") + name + ";\n";
+                // src_inputs += std::string("#define ") + name + " " + static_cast<std::string>(**static_cast<const named<vec3> *>(obj)) + "\n";
+                src_inputs += std::string("uniform vec3 ") + name + ";\n";
                 break;
 
             case in::t_vec4:
-                // final_src[0] += std::string("#define ") + name + " " + static_cast<std::string>(**static_cast<const named<vec4> *>(obj)) + "\n";
-                final_src[0] += std::string("uniform vec4 ") + name + ";\n";
+                // src_inputs += std::string("#define ") + name + " " + static_cast<std::string>(**static_cast<const named<vec4> *>(obj)) + "\n";
+                src_inputs += std::string("uniform vec4 ") + name + ";\n";
                 break;
 
             case in::t_mat3:
-                final_src[0] += std::string("uniform mat3 ") + name + ";\n";
+                src_inputs += std::string("uniform mat3 ") + name + ";\n";
                 break;
 
             case in::t_mat4:
-                final_src[0] += std::string("uniform mat4 ") + name + ";\n";
+                src_inputs += std::string("uniform mat4 ") + name + ";\n";
                 break;
 
             case in::t_float:
@@ -103,14 +191,14 @@ render::render(std::initializer_list<const in *> input, std::initializer_list<co
                 /*
                 char float_val[16]; // FIXME
                 sprintf(float_val, "%f", **static_cast<const named<float> *>(obj));
-                final_src[0] += std::string("#define ") + name + " " + float_val + "\n";
+                src_inputs += std::string("#define ") + name + " " + float_val + "\n";
                 */
-                final_src[0] += std::string("uniform float ") + name + ";\n";
+                src_inputs += std::string("uniform float ") + name + ";\n";
                 break;
             }
 
             case in::t_bool:
-                final_src[0] += std::string("uniform bool ") + name + ";\n";
+                src_inputs += std::string("uniform bool ") + name + ";\n";
                 break;
 
             default: // This should never happen
@@ -119,6 +207,8 @@ render::render(std::initializer_list<const in *> input, std::initializer_list<co
         }
     }
 
+    final_src[0] += src_inputs;
+
 
     for (int i = 1; i < fbos; i++)
         final_src[i] = final_src[0];
@@ -133,25 +223,9 @@ render::render(std::initializer_list<const in *> input, std::initializer_list<co
         switch (obj->o_type)
         {
             case out::t_texture:
-            {
-                if (i == internals::out_units)
-                {
-                    i = 0;
-                    glBindFramebuffer(GL_FRAMEBUFFER, ids[++cur_fbo_i]);
-                }
-
-                dbgprintf("[rnd%u] texture “%s” is on attachment %i.\n", ids[cur_fbo_i], obj->o_name, i);
-
-                glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, static_cast<const texture *>(obj)->id, 0);
-
-                char tmp[6]; // FIXME: Overflow
-                sprintf(tmp, "%i", i++);
-                final_src[cur_fbo_i] += std::string("#define ") + obj->o_name + " gl_FragData[" + tmp + "]\n";
-
-                break;
-            }
-
             case out::t_texture_placebo:
+            case out::t_texture_array:
+            case out::t_texture_layer:
             {
                 if (i == internals::out_units)
                 {
@@ -159,7 +233,10 @@ render::render(std::initializer_list<const in *> input, std::initializer_list<co
                     glBindFramebuffer(GL_FRAMEBUFFER, ids[++cur_fbo_i]);
                 }
 
-                dbgprintf("[rnd%u] Incomplete texture “%s” is on attachment %i.\n", ids[cur_fbo_i], obj->o_name, i);
+                dbgprintf("[rnd%u] %s “%s” is on attachment %i.\n", ids[cur_fbo_i], (obj->o_type == out::t_texture_placebo) ? "Incomplete texture" : "Texture", obj->o_name, i);
+
+                attach_color(i, obj);
+                attached.push_back((obj->o_type == out::t_texture_placebo) ? NULL : obj);
 
                 char tmp[6]; // FIXME: Overflow
                 sprintf(tmp, "%i", i++);
@@ -192,24 +269,31 @@ render::render(std::initializer_list<const in *> input, std::initializer_list<co
     for (i = 0; i < fbos; i++)
         final_src[i] += std::string(global_src) + "\nvoid main(void)\n{\n" + shared_src + "\n";
 
+    src_global = global_src;
+    src_main = std::string(shared_src) + "\n";
 
-    va_list va;
-    va_start(va, shared_src);
 
     i = 0;
-    int j = 0;
+    int j = 0, v = 0;
     for (auto obj: output)
     {
         if (obj->o_type == out::t_stencildepth)
         {
-            const char *val = va_arg(va, const char *);
+            const char *val = values[v++];
+
+            // Writing the depth would prevent early fragment tests
+            if (!*val)
+                continue;
 
             for (int k = 0; k < fbos; k++)
                 final_src[k] += std::string(obj->o_name) + " = " + val + ";\n";
         }
         else
         {
-            final_src[j] += std::string(obj->o_name) + " = " + va_arg(va, const char *) + ";\n";
+            const char *val = values[v++];
+
+            final_src[j] += std::string(obj->o_name) + " = " + val + ";\n";
+            src_main += std::string(obj->o_name) + " = " + val + ";\n";
 
             if (++i == internals::out_units)
             {
@@ -219,9 +303,6 @@ render::render(std::initializer_list<const in *> input, std::initializer_list<co
         }
     }
 
-    va_end(va);
-
-
     for (j = 0; j < fbos; j++)
     {
         final_src[j] += "}\n";
@@ -243,7 +324,14 @@ render::render(std::initializer_list<const in *> input, std::initializer_list<co
         }
 
 
-        prgs[j].attach(internals::basic_vertex_shader);
+        if (layers)
+        {
+            prgs[j].attach(internals::layered_vertex_shader);
+            prgs[j].attach(internals::layered_geometry_shader);
+        }
+        else
+            prgs[j].attach(internals::basic_vertex_shader);
+
         prgs[j].attach(sh);
 
         if (!prgs[j].link())
@@ -261,8 +349,22 @@ render::render(std::initializer_list<const in *> input, std::initializer_list<co
 
 
     for (auto in: input)
+    {
         if (in->i_type != in::t_texture_placebo)
             inp_objs.push_back(in);
+        else
+        {
+            input_slot slot;
+
+            slot.name = strdup(in->i_name);
+            slot.tex = NULL;
+
+            for (j = 0; j < fbos; j++)
+                slot.uniforms.push_back(prgs[j].uniform((std::string("raw_") + in->i_name).c_str()));
+
+            slots.push_back(slot);
+        }
+    }
 
     for (auto out: output)
         out_objs.push_back((out->o_type == out::t_texture_placebo) ? new texture_placebo(out->o_name) : out);
@@ -284,6 +386,10 @@ render::~render(void)
 
     delete[] ids;
     delete[] prgs;
+    delete cprg;
+
+    for (auto &slot: slots)
+        free(const_cast<char *>(slot.name));
 }
 
 
@@ -328,6 +434,19 @@ void render::prepare(void)
     dbgprintf("[rnd%u..] Preparing.\n", ids[0]);
 
 
+    if (cprg != NULL)
+    {
+        dbgprintf("[rnd%u] Putting compute shader into use.\n", ids[0]);
+
+        cprg->use();
+
+        // Clearing will have to bind the FBO
+        freshly_prepared = false;
+
+        return;
+    }
+
+
     bind_fbo(0);
 
 
@@ -370,22 +489,25 @@ void render::prepare(void)
 
 void render::bind_input(void)
 {
-    bool *assigned = new bool[inp_objs.size()];
-
-
     internals::tmu_mgr->loosen();
 
-    int i = 0;
+    // Keep textures which are still assigned to a unit where they are first,
+    // so the following loop only evicts units not used by this pass
     for (auto obj: inp_objs)
         if ((obj->i_type == in::t_texture) || (obj->i_type == in::t_texture_array))
-            assigned[i++] = *internals::tmu_mgr &= static_cast<const textures_in *>(obj);
+            *internals::tmu_mgr &= static_cast<const textures_in *>(obj);
+
+    for (auto &slot: slots)
+        if (slot.tex != NULL)
+            *internals::tmu_mgr &= slot.tex;
 
-    i = 0;
     for (auto obj: inp_objs)
-        if (((obj->i_type == in::t_texture) || (obj->i_type == in::t_texture_array)) && !assigned[i++])
+        if (((obj->i_type == in::t_texture) || (obj->i_type == in::t_texture_array)) && !(*internals::tmu_mgr &= static_cast<const textures_in *>(obj)))
             *internals::tmu_mgr += static_cast<const textures_in *>(obj);
 
-    delete[] assigned;
+    for (auto &slot: slots)
+        if ((slot.tex != NULL) && !(*internals::tmu_mgr &= slot.tex))
+            *internals::tmu_mgr += slot.tex;
 
     internals::tmu_mgr->update();
 }
@@ -393,6 +515,18 @@ void render::bind_input(void)
 
 void render::execute(void)
 {
+    if (cprg != NULL)
+    {
+        execute_compute();
+        return;
+    }
+
+    int w, h, d;
+    output_size(w, h, d);
+
+    glViewport(0, 0, w, h);
+
+
 #ifdef DEBUG
     if (fbos > 1)
     {
@@ -427,9 +561,23 @@ void render::execute(void)
                 prgs[i].uniform(obj->i_name) = obj;
         }
 
+        for (auto &slot: slots)
+            if (slot.tex != NULL)
+                slot.uniforms[i] = slot.tex;
+
+        prgs[i].uniform("texel_size").set(1.f / w, 1.f / h);
 
-        dbgprintf("[rnd%u] Drawing quad.\n", ids[i]);
-        internals::draw_quad();
+
+        if (layers)
+        {
+            dbgprintf("[rnd%u] Drawing quad into %i layers.\n", ids[i], layers);
+            internals::draw_quad(layers);
+        }
+        else
+        {
+            dbgprintf("[rnd%u] Drawing quad.\n", ids[i]);
+            internals::draw_quad();
+        }
     }
 
 
@@ -438,6 +586,260 @@ void render::execute(void)
 }
 
 
+bool render::use_compute(int wg_x, int wg_y, const char *shared_src)
+{
+    if ((internals::ogl_maj < 4) || ((internals::ogl_maj == 4) && (internals::ogl_min < 3)))
+    {
+        dbgprintf("[rnd%u] Compute shaders are not supported.\n", ids[0]);
+        return false;
+    }
+
+    for (auto obj: out_objs)
+    {
+        if (obj->o_type == out::t_stencildepth)
+        {
+            dbgprintf("[rnd%u] Depth/stencil buffers require the fragment backend.\n", ids[0]);
+            return false;
+        }
+    }
+
+
+    char tmp[64];
+
+    std::string src = "#version 430 compatibility\n#define MACS_COMPUTE\n";
+
+    if (array_inputs)
+        src += "#extension GL_EXT_texture_array: enable\n";
+
+    sprintf(tmp, "layout(local_size_x = %i, local_size_y = %i) in;\n", wg_x, wg_y);
+    src += tmp;
+
+    src += "vec2 tex_coord;\nivec2 texel;\nuniform vec2 texel_size;\n";
+
+    if (layers)
+        src += "#define layer int(gl_GlobalInvocationID.z)\n";
+
+    src += src_inputs;
+
+    src += "uniform ivec2 macs_out_size;\n"
+           "uniform bool macs_blend;\n"
+           "uniform int macs_blend_src, macs_blend_dst;\n"
+           "vec4 macs_blend_factor(int f, vec4 s, vec4 d)\n"
+           "{\n"
+           "    if (f == 0x0300) return s;\n"
+           "    if (f == 0x0301) return vec4(1.) - s;\n"
+           "    if (f == 0x0302) return vec4(s.a);\n"
+           "    if (f == 0x0303) return vec4(1. - s.a);\n"
+           "    if (f == 0x0304) return vec4(d.a);\n"
+           "    if (f == 0x0305) return vec4(1. - d.a);\n"
+           "    if (f == 0x0306) return d;\n"
+           "    if (f == 0x0307) return vec4(1.) - d;\n"
+           "    return vec4(float(f));\n" // GL_ZERO and GL_ONE
+           "}\n";
+
+    std::string locals, stores;
+    int i = 0;
+
+    for (auto obj: out_objs)
+    {
+        // Replacements are always listed before any texture attached to them
+        if (i >= static_cast<int>(attached.size()))
+            break;
+
+        const char *image_type = layers ? "image2DArray" : "image2D";
+        const char *coord = layers ? "ivec3(texel, layer)" : "texel";
+
+        sprintf(tmp, "layout(rgba32f, binding = %i) uniform ", i++);
+        src += std::string(tmp) + image_type + " raw_" + obj->o_name + ";\n";
+
+        locals += std::string("vec4 ") + obj->o_name + " = vec4(0., 0., 0., 0.);\n";
+
+        stores += std::string("    if (macs_blend)\n") +
+                  "    {\n" +
+                  "        vec4 old = imageLoad(raw_" + obj->o_name + ", " + coord + ");\n" +
+                  "        " + obj->o_name + " = " + obj->o_name + " * macs_blend_factor(macs_blend_src, " + obj->o_name + ", old) + " +
+                  "old * macs_blend_factor(macs_blend_dst, " + obj->o_name + ", old);\n" +
+                  "    }\n" +
+                  "    imageStore(raw_" + obj->o_name + ", " + coord + ", " + obj->o_name + ");\n";
+    }
+
+    src += std::string(shared_src) + "\n" + src_global + "\n"
+           "#define discard return\n"
+           "void main(void)\n"
+           "{\n"
+           "texel = ivec2(gl_GlobalInvocationID.xy);\n"
+           "tex_coord = (vec2(texel) + .5) / vec2(macs_out_size);\n" +
+           locals + src_main +
+           "if (all(lessThan(texel, macs_out_size)))\n"
+           "{\n" + stores + "}\n"
+           "}\n";
+
+    dbgprintf("[rnd%u] Compute source:\n%s\n", ids[0], src.c_str());
+
+
+    internals::shader *sh = new internals::shader(internals::shader::compute);
+    sh->load(src.c_str());
+
+    if (!sh->compile())
+    {
+        delete sh;
+
+        dbgprintf("[rnd%u] Falling back to the fragment backend.\n", ids[0]);
+        return false;
+    }
+
+    internals::program *prg = new internals::program;
+    prg->attach(sh);
+
+    bool linked = prg->link();
+
+    delete sh;
+
+    if (!linked)
+    {
+        delete prg;
+
+        dbgprintf("[rnd%u] Falling back to the fragment backend.\n", ids[0]);
+        return false;
+    }
+
+
+    delete cprg;
+    cprg = prg;
+
+    wg_w = wg_x;
+    wg_h = wg_y;
+
+    // The compute program's sampler uniforms follow those of the FBO programs
+    for (auto &slot: slots)
+    {
+        slot.uniforms.erase(slot.uniforms.begin() + fbos, slot.uniforms.end());
+        slot.uniforms.push_back(cprg->uniform((std::string("raw_") + slot.name).c_str()));
+    }
+
+    return true;
+}
+
+
+void render::output_size(int &w, int &h, int &d) const
+{
+    bool sized = false;
+
+    w = internals::width;
+    h = internals::height;
+    d = 1;
+
+    for (auto obj: attached)
+    {
+        if (obj == NULL)
+            continue;
+
+        int ow, oh, od = 1;
+
+        switch (obj->o_type)
+        {
+            case out::t_texture:
+                ow = static_cast<const texture *>(obj)->width;
+                oh = static_cast<const texture *>(obj)->height;
+                break;
+
+            case out::t_texture_array:
+                ow = static_cast<const texture_array *>(obj)->width;
+                oh = static_cast<const texture_array *>(obj)->height;
+                od = static_cast<const texture_array *>(obj)->elements;
+                break;
+
+            case out::t_texture_layer:
+                ow = static_cast<const texture_layer *>(obj)->array->width;
+                oh = static_cast<const texture_layer *>(obj)->array->height;
+                break;
+
+            default:
+                continue;
+        }
+
+        if (!sized)
+        {
+            w = ow; h = oh; d = od;
+            sized = true;
+        }
+        else if ((ow != w) || (oh != h))
+            throw exc::size_mm;
+    }
+
+    // Depth/stencil buffers always have the fundamental size, the outputs
+    // must fit into them
+    for (auto obj: out_objs)
+        if ((obj->o_type == out::t_stencildepth) && ((w > internals::width) || (h > internals::height)))
+            throw exc::size_mm;
+}
+
+
+void render::execute_compute(void)
+{
+    int w, h, d;
+    output_size(w, h, d);
+
+    for (size_t i = 0; i < attached.size(); i++)
+    {
+        const out *obj = attached[i];
+
+        if (obj == NULL)
+            continue;
+
+        switch (obj->o_type)
+        {
+            case out::t_texture:
+                glBindImageTexture(i, static_cast<const texture *>(obj)->id, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+                break;
+
+            case out::t_texture_array:
+                glBindImageTexture(i, static_cast<const texture_array *>(obj)->id, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA32F);
+                break;
+
+            case out::t_texture_layer:
+            {
+                const texture_layer *tl = static_cast<const texture_layer *>(obj);
+                glBindImageTexture(i, tl->array->id, 0, GL_FALSE, tl->layer, GL_READ_WRITE, GL_RGBA32F);
+                break;
+            }
+
+            default:
+                break;
+        }
+    }
+
+
+    dbgprintf("[rnd%u] Assigning uniforms.\n", ids[0]);
+
+    for (auto obj: inp_objs)
+    {
+        if ((obj->i_type == in::t_texture) || (obj->i_type == in::t_texture_array))
+            cprg->uniform((std::string("raw_") + obj->i_name).c_str()) = obj;
+        else
+            cprg->uniform(obj->i_name) = obj;
+    }
+
+    for (auto &slot: slots)
+        if (slot.tex != NULL)
+            slot.uniforms[fbos] = slot.tex;
+
+    cprg->uniform("macs_out_size").set(w, h);
+    cprg->uniform("texel_size").set(1.f / w, 1.f / h);
+    cprg->uniform("macs_blend").set((bfsrc != use) || (bfdst != discard));
+    cprg->uniform("macs_blend_src").set(bfsrc);
+    cprg->uniform("macs_blend_dst").set(bfdst);
+
+
+    dbgprintf("[rnd%u] Dispatching %ix%ix%i elements.\n", ids[0], w, h, d);
+
+    glDispatchCompute((w + wg_w - 1) / wg_w, (h + wg_h - 1) / wg_h, d);
+
+    // Results may be used in any way afterwards
+    glMemoryBarrier(GL_ALL_BARRIER_BITS);
+}
+
+
 void render::clear_output(formats::f0123 value)
 {
     glClearColor(value.r, value.g, value.b, value.a);
@@ -506,6 +908,21 @@ void render::operator<<(const texture *tex)
 }
 
 void render::operator>>(const texture *tex)
+{
+    attach(tex);
+}
+
+void render::operator>>(const texture_array *tex)
+{
+    attach(tex);
+}
+
+void render::operator>>(const texture_layer *tex)
+{
+    attach(tex);
+}
+
+void render::attach(const out *tex)
 {
     bool found = false;
 
@@ -517,8 +934,14 @@ void render::operator>>(const texture *tex)
         {
             found = true;
 
+            // An FBO is either layered or not, the replacement has to match
+            if ((tex->o_type == out::t_texture_array) != (layers != 0))
+                throw exc::inv_type;
+
             glBindFramebuffer(GL_FRAMEBUFFER, ids[i / internals::out_units]);
-            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + (i % internals::out_units), GL_TEXTURE_2D, tex->id, 0);
+            attach_color(i % internals::out_units, tex);
+
+            attached[i] = tex;
 
             if (i % internals::out_units)
                 freshly_prepared = false;
@@ -539,10 +962,51 @@ void render::operator>>(const texture *tex)
 
 void render::operator-=(const texture *tex)
 {
+    for (auto &obj: attached)
+        if (obj == tex)
+            obj = NULL;
+
     inp_objs.remove(tex);
     out_objs.remove(tex);
 }
 
+void render::operator-=(const texture_array *tex)
+{
+    for (auto &obj: attached)
+        if (obj == tex)
+            obj = NULL;
+
+    inp_objs.remove(tex);
+    out_objs.remove(tex);
+}
+
+void render::operator-=(const texture_layer *tex)
+{
+    for (auto &obj: attached)
+        if (obj == tex)
+            obj = NULL;
+
+    out_objs.remove(tex);
+}
+
+
+int render::slot(const char *name) const
+{
+    for (size_t i = 0; i < slots.size(); i++)
+        if (!strcmp(slots[i].name, name))
+            return i;
+
+    throw exc::tex_nd;
+}
+
+void render::bind(int slot, const texture *tex)
+{
+    if ((slot < 0) || (slot >= static_cast<int>(slots.size())))
+        throw exc::tex_nd;
+
+    slots[slot].tex = tex;
+}
+
 
 
 void macs::render_to_screen(bool backbuffer)
@@ -0,0 +1,312 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "macs.hpp"
+#include "macs-internals.hpp"
+
+using namespace macs;
+using namespace macs::types;
+
+
+/// Returns the number of steps a binary search over n elements takes.
+static int search_steps(int n)
+{
+    int steps = 1;
+
+    while ((1 << (steps - 1)) < n)
+        steps++;
+
+    return steps;
+}
+
+
+scan::scan(int w, int h):
+    offset("scan_offset", 0.f),
+    direction("scan_dir", vec2()),
+    src_size("scan_src_size", vec2()),
+    size("scan_size", vec2())
+{
+    width  = (w <= 0) ? internals::width  : w;
+    height = (h <= 0) ? internals::height : h;
+
+    *size = vec2(width, height);
+
+    // The intermediate textures are only ever used through input slots, thus
+    // they all share the name of the placebo output they replace
+    row_ping = new texture("scan_dst", true, width, height);
+    row_pong = new texture("scan_dst", true, width, height);
+    col_ping = new texture("scan_dst", true, 1, height);
+    col_pong = new texture("scan_dst", true, 1, height);
+    result   = new texture("scanned", true, width, height);
+
+    // The row totals are extracted into col_ping; every column step swaps
+    col_last = col_ping;
+    for (int off = 1; off < height; off *= 2)
+        col_last = (col_last == col_ping) ? col_pong : col_ping;
+
+
+    texture_placebo src_plac("scan_src"), rows_plac("scan_rows"), cols_plac("scan_cols"), dst_plac("scan_dst");
+
+
+    rnd_step = new render({ &src_plac, &offset, &direction, &src_size }, { &dst_plac }, "",
+        "vec2 pos = floor(gl_FragCoord.xy);\n"
+        "vec2 prev = pos - scan_dir * scan_offset;\n"
+        "vec4 v = texture2D(raw_scan_src, (pos + .5) / scan_src_size);\n\n"
+        "if (all(greaterThanEqual(prev, vec2(0., 0.))))\n"
+        "    v += texture2D(raw_scan_src, (prev + .5) / scan_src_size);",
+        "v");
+    step_slot = rnd_step->slot("scan_src");
+
+    rnd_totals = new render({ &rows_plac, &size }, { &dst_plac }, "", "",
+        "texture2D(raw_scan_rows, vec2(scan_size.x - .5, gl_FragCoord.y) / scan_size)");
+    totals_slot = rnd_totals->slot("scan_rows");
+
+    // Exclusive within the row plus the inclusive sum of all previous rows
+    rnd_final = new render({ &rows_plac, &cols_plac, &size }, { result }, "",
+        "vec2 pos = floor(gl_FragCoord.xy);\n"
+        "vec4 v = vec4(0., 0., 0., 0.);\n\n"
+        "if (pos.x > 0.)\n"
+        "    v += texture2D(raw_scan_rows, (pos + vec2(-.5, .5)) / scan_size);\n"
+        "if (pos.y > 0.)\n"
+        "    v += texture2D(raw_scan_cols, vec2(.5, pos.y - .5) / vec2(1., scan_size.y));",
+        "v");
+    final_row_slot = rnd_final->slot("scan_rows");
+    final_col_slot = rnd_final->slot("scan_cols");
+
+
+    // For reading back just the last row total
+    GLint prev_fbo;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev_fbo);
+
+    glGenFramebuffers(1, &total_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, total_fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, col_last->id, 0);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, prev_fbo);
+}
+
+scan::~scan(void)
+{
+    delete rnd_step;
+    delete rnd_totals;
+    delete rnd_final;
+
+    glDeleteFramebuffers(1, &total_fbo);
+
+    delete row_ping;
+    delete row_pong;
+    delete col_ping;
+    delete col_pong;
+    delete result;
+}
+
+
+void scan::step(const texture *src, const texture *dst, int off, bool vertical)
+{
+    *offset = off;
+    *direction = vertical ? vec2(0.f, 1.f) : vec2(1.f, 0.f);
+    *src_size = vec2(src->width, src->height);
+
+    rnd_step->bind(step_slot, src);
+    *rnd_step >> dst;
+
+    rnd_step->prepare();
+    rnd_step->bind_input();
+    rnd_step->execute();
+
+    *rnd_step -= dst;
+}
+
+
+void scan::operator()(const texture *tex)
+{
+    if ((tex->width != width) || (tex->height != height))
+        throw exc::inv_type;
+
+
+    // Inclusive scan of every row
+    const texture *rows = tex;
+
+    for (int off = 1; off < width; off *= 2)
+    {
+        texture *dst = (rows == row_ping) ? row_pong : row_ping;
+
+        step(rows, dst, off, false);
+        rows = dst;
+    }
+
+
+    // Row totals
+    rnd_totals->bind(totals_slot, rows);
+    *rnd_totals >> col_ping;
+
+    rnd_totals->prepare();
+    rnd_totals->bind_input();
+    rnd_totals->execute();
+
+    *rnd_totals -= col_ping;
+
+
+    // Inclusive scan of the row totals
+    const texture *cols = col_ping;
+
+    for (int off = 1; off < height; off *= 2)
+    {
+        texture *dst = (cols == col_ping) ? col_pong : col_ping;
+
+        step(cols, dst, off, true);
+        cols = dst;
+    }
+
+
+    rnd_final->bind(final_row_slot, rows);
+    rnd_final->bind(final_col_slot, cols);
+
+    rnd_final->prepare();
+    rnd_final->bind_input();
+    rnd_final->execute();
+
+    rnd_step->bind(step_slot, NULL);
+    rnd_totals->bind(totals_slot, NULL);
+    rnd_final->bind(final_row_slot, NULL);
+    rnd_final->bind(final_col_slot, NULL);
+}
+
+
+formats::f0123 scan::total(void)
+{
+    formats::f0123 value;
+    GLint prev_fbo;
+
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &prev_fbo);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, total_fbo);
+    glReadPixels(0, height - 1, 1, 1, GL_RGBA, GL_FLOAT, &value);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, prev_fbo);
+
+    return value;
+}
+
+
+compact::compact(std::initializer_list<const in *> input, const char *predicate, const char *value, int w, int h):
+    size("compact_size", vec2())
+{
+    width  = (w <= 0) ? internals::width  : w;
+    height = (h <= 0) ? internals::height : h;
+
+    *size = vec2(width, height);
+
+    if (value == NULL)
+        value = "vec4(tex_coord, 0., 1.)";
+
+
+    flags  = new texture("compact_flags", true, width, height);
+    result = new texture("compacted", true, width, height);
+
+    flag_scan = new scan(width, height);
+
+
+    std::vector<const in *> flag_in(input), gather_in(input);
+    std::vector<const out *> flag_out({ flags }), gather_out({ result });
+
+    rnd_flags = new render(flag_in, flag_out, "", "",
+        { (std::string("(") + predicate + ") ? vec4(1., 1., 1., 1.) : vec4(0., 0., 0., 0.)").c_str() });
+
+
+    char tmp[96];
+
+    snprintf(tmp, sizeof(tmp), "#define COMPACT_ROW_STEPS %i\n#define COMPACT_COL_STEPS %i\n",
+            search_steps(height), search_steps(width));
+
+    // Element k of the output is the element i with excl(i) == k and
+    // flag(i) == 1, i.e., the first element whose inclusive prefix sum exceeds
+    // k. It is searched for by row first and then within that row.
+    std::string shared = std::string(tmp) +
+        "float compact_k = floor(gl_FragCoord.y) * compact_size.x + floor(gl_FragCoord.x);\n"
+        "float compact_count = texture2D(raw_compact_rows, vec2(.5, compact_size.y - .5) / vec2(1., compact_size.y)).x;\n"
+        "vec2 compact_coord = vec2(0., 0.);\n\n"
+        "if (compact_k < compact_count)\n"
+        "{\n"
+        "    float lo = 0., hi = compact_size.y - 1.;\n\n"
+        "    for (int i = 0; i < COMPACT_ROW_STEPS; i++)\n"
+        "    {\n"
+        "        float mid = floor((lo + hi) * .5);\n\n"
+        "        if (lo >= hi)\n"
+        "            break;\n"
+        "        if (texture2D(raw_compact_rows, vec2(.5, mid + .5) / vec2(1., compact_size.y)).x > compact_k)\n"
+        "            hi = mid;\n"
+        "        else\n"
+        "            lo = mid + 1.;\n"
+        "    }\n\n"
+        "    float row = lo;\n"
+        "    lo = 0.;\n"
+        "    hi = compact_size.x - 1.;\n\n"
+        "    for (int i = 0; i < COMPACT_COL_STEPS; i++)\n"
+        "    {\n"
+        "        float mid = floor((lo + hi) * .5);\n\n"
+        "        if (lo >= hi)\n"
+        "            break;\n\n"
+        "        vec2 c = vec2(mid + .5, row + .5) / compact_size;\n\n"
+        "        if (texture2D(raw_compact_excl, c).x + texture2D(raw_compact_flags, c).x > compact_k)\n"
+        "            hi = mid;\n"
+        "        else\n"
+        "            lo = mid + 1.;\n"
+        "    }\n\n"
+        "    compact_coord = vec2(lo + .5, row + .5) / compact_size;\n"
+        "}\n\n"
+        "#define tex_coord compact_coord\n";
+
+    texture_placebo excl_plac("compact_excl"), rows_plac("compact_rows");
+
+    gather_in.push_back(flags);
+    gather_in.push_back(&excl_plac);
+    gather_in.push_back(&rows_plac);
+    gather_in.push_back(&size);
+
+    rnd_gather = new render(gather_in, gather_out, "", shared.c_str(),
+        { (std::string("(compact_k < compact_count) ? (") + value + ") : vec4(0., 0., 0., 0.)").c_str() });
+
+    scan_slot = rnd_gather->slot("compact_excl");
+    offsets_slot = rnd_gather->slot("compact_rows");
+}
+
+compact::~compact(void)
+{
+    delete rnd_flags;
+    delete rnd_gather;
+
+    delete flag_scan;
+
+    delete flags;
+    delete result;
+}
+
+
+void compact::operator()(void)
+{
+    rnd_flags->prepare();
+    rnd_flags->bind_input();
+    rnd_flags->execute();
+
+    (*flag_scan)(flags);
+
+    rnd_gather->bind(scan_slot, flag_scan->output());
+    rnd_gather->bind(offsets_slot, flag_scan->row_offsets());
+
+    rnd_gather->prepare();
+    rnd_gather->bind_input();
+    rnd_gather->execute();
+
+    rnd_gather->bind(scan_slot, NULL);
+    rnd_gather->bind(offsets_slot, NULL);
+}
+
+
+int compact::count(void)
+{
+    return static_cast<int>(flag_scan->total().r + .5f);
+}
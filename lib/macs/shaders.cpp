@@ -15,6 +15,9 @@ namespace macs
     {
         shader *basic_vertex_shader;
         program *basic_pipeline;
+
+        shader *layered_vertex_shader;
+        shader *layered_geometry_shader;
     }
 }
 
@@ -23,7 +26,7 @@ shader::shader(type t)
 {
     id = glCreateShader(static_cast<int>(t));
 
-    dbgprintf("[sh%u] Is %s shader.\n", id, (t == vertex) ? "vertex" : "fragment");
+    dbgprintf("[sh%u] Is %s shader.\n", id, (t == vertex) ? "vertex" : (t == geometry) ? "geometry" : "fragment");
 }
 
 
@@ -168,7 +171,7 @@ bool program::link(void)
     {
         char *msg = new char[illen + 1];
 
-        glGetShaderInfoLog(id, illen, NULL, msg);
+        glGetProgramInfoLog(id, illen, NULL, msg);
         msg[illen] = 0; // inb4 implementation bug
 
         if (status == GL_TRUE)
@@ -210,16 +213,11 @@ void prg_uniform::operator=(const in *o) throw(exc::invalid_type, exc::texture_n
     {
         case in::t_texture:
         case in::t_texture_array:
-            for (int i = 0; i < tex_units; i++)
-            {
-                if ((*tmu_mgr)[i] == o)
-                {
-                    glUniform1i(id, i);
-                    return;
-                }
-            }
+            if (static_cast<const textures_in *>(o)->unit < 0)
+                throw exc::tex_na;
 
-            throw exc::tex_na;
+            glUniform1i(id, static_cast<const textures_in *>(o)->unit);
+            return;
 
         case in::t_vec4:
             glUniform4fv(id, 1, (**static_cast<const named<vec4> *>(o)).d);
@@ -252,3 +250,18 @@ void prg_uniform::operator=(const in *o) throw(exc::invalid_type, exc::texture_n
 
     throw exc::inv_type;
 }
+
+void prg_uniform::set(int x)
+{
+    glUniform1i(id, x);
+}
+
+void prg_uniform::set(int x, int y)
+{
+    glUniform2i(id, x, y);
+}
+
+void prg_uniform::set(float x, float y)
+{
+    glUniform2f(id, x, y);
+}
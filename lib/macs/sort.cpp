@@ -0,0 +1,370 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "macs.hpp"
+#include "macs-internals.hpp"
+
+using namespace macs;
+using namespace macs::types;
+
+
+/// Elements per radix sort work group (one per invocation).
+#define RADIX_GROUP 256
+/// Bits sorted per radix sort pass.
+#define RADIX_BITS 4
+
+
+/// Radix sort source common to all passes.
+static const char *radix_common =
+    "#version 430\n"
+    "layout(local_size_x = RADIX_GROUP) in;\n"
+    "layout(rgba32f, binding = 0) readonly uniform image2D sort_src;\n"
+    "layout(std430, binding = 0) buffer sort_counts_buffer { uint sort_counts[]; };\n"
+    "uniform int sort_width, sort_count, sort_shift, sort_groups;\n\n"
+    // Maps floats to unsigned integers of the same order
+    "uint sort_digit(vec4 v)\n"
+    "{\n"
+    "    uint u = floatBitsToUint(SORT_KEY(v));\n"
+    "    u = ((u & 0x80000000u) != 0u) ? ~u : (u | 0x80000000u);\n"
+    "    return ((SORT_INVERT u) >> uint(sort_shift)) & (RADIX_DIGITS - 1u);\n"
+    "}\n\n"
+    "vec4 sort_load(int i)\n"
+    "{\n"
+    "    return imageLoad(sort_src, ivec2(i % sort_width, i / sort_width));\n"
+    "}\n\n";
+
+/// Counts the digits of every work group's elements.
+static const char *radix_histogram =
+    "shared uint hist[RADIX_DIGITS];\n\n"
+    "void main(void)\n"
+    "{\n"
+    "    uint l = gl_LocalInvocationID.x;\n"
+    "    int i = int(gl_GlobalInvocationID.x);\n\n"
+    "    if (l < RADIX_DIGITS)\n"
+    "        hist[l] = 0u;\n"
+    "    barrier();\n\n"
+    "    if (i < sort_count)\n"
+    "        atomicAdd(hist[sort_digit(sort_load(i))], 1u);\n"
+    "    barrier();\n\n"
+    "    if (l < RADIX_DIGITS)\n"
+    "        sort_counts[l * gl_NumWorkGroups.x + gl_WorkGroupID.x] = hist[l];\n"
+    "}\n";
+
+/// Exclusive scan of the digit counts (in digit-major order) by a single
+/// work group; every invocation handles one contiguous chunk.
+static const char *radix_scan =
+    "shared uint part[RADIX_GROUP];\n\n"
+    "void main(void)\n"
+    "{\n"
+    "    uint l = gl_LocalInvocationID.x;\n"
+    "    uint n = uint(sort_groups) * RADIX_DIGITS;\n"
+    "    uint chunk = (n + RADIX_GROUP - 1u) / RADIX_GROUP;\n"
+    "    uint b = min(l * chunk, n), e = min(b + chunk, n);\n\n"
+    "    uint sum = 0u;\n"
+    "    for (uint i = b; i < e; i++)\n"
+    "        sum += sort_counts[i];\n\n"
+    "    part[l] = sum;\n"
+    "    barrier();\n\n"
+    "    for (uint off = 1u; off < RADIX_GROUP; off *= 2u)\n"
+    "    {\n"
+    "        uint add = (l >= off) ? part[l - off] : 0u;\n"
+    "        barrier();\n"
+    "        part[l] += add;\n"
+    "        barrier();\n"
+    "    }\n\n"
+    "    uint acc = part[l] - sum;\n"
+    "    for (uint i = b; i < e; i++)\n"
+    "    {\n"
+    "        uint c = sort_counts[i];\n"
+    "        sort_counts[i] = acc;\n"
+    "        acc += c;\n"
+    "    }\n"
+    "}\n";
+
+/// Writes every element to its position. The rank within the work group is
+/// determined by a scan over one-hot digit counters, two 16 bit counters
+/// packed into every word.
+static const char *radix_scatter =
+    "layout(rgba32f, binding = 1) writeonly uniform image2D sort_dst;\n"
+    "shared uint ranks[RADIX_DIGITS / 2u][RADIX_GROUP];\n\n"
+    "void main(void)\n"
+    "{\n"
+    "    uint l = gl_LocalInvocationID.x;\n"
+    "    int i = int(gl_GlobalInvocationID.x);\n\n"
+    "    bool valid = i < sort_count;\n"
+    "    vec4 v = valid ? sort_load(i) : vec4(0., 0., 0., 0.);\n"
+    "    uint d = valid ? sort_digit(v) : RADIX_DIGITS;\n\n"
+    "    for (uint w = 0u; w < RADIX_DIGITS / 2u; w++)\n"
+    "        ranks[w][l] = (d / 2u == w) ? (1u << ((d & 1u) * 16u)) : 0u;\n"
+    "    barrier();\n\n"
+    "    for (uint off = 1u; off < RADIX_GROUP; off *= 2u)\n"
+    "    {\n"
+    "        uint add[RADIX_DIGITS / 2u];\n\n"
+    "        for (uint w = 0u; w < RADIX_DIGITS / 2u; w++)\n"
+    "            add[w] = (l >= off) ? ranks[w][l - off] : 0u;\n"
+    "        barrier();\n\n"
+    "        for (uint w = 0u; w < RADIX_DIGITS / 2u; w++)\n"
+    "            ranks[w][l] += add[w];\n"
+    "        barrier();\n"
+    "    }\n\n"
+    "    if (valid)\n"
+    "    {\n"
+    "        uint r = ((ranks[d / 2u][l] >> ((d & 1u) * 16u)) & 0xffffu) - 1u;\n"
+    "        int pos = int(sort_counts[d * gl_NumWorkGroups.x + gl_WorkGroupID.x] + r);\n\n"
+    "        imageStore(sort_dst, ivec2(pos % sort_width, pos / sort_width), v);\n"
+    "    }\n"
+    "}\n";
+
+
+static const char *channel_names[4] = { "x", "y", "z", "w" };
+
+
+sort::sort(int k, bool desc, int w, int h):
+    key(k),
+    descending(desc),
+    block("sort_block", 0.f),
+    distance("sort_distance", 0.f),
+    size("sort_size", vec2()),
+    histogram(NULL),
+    scan_counts(NULL),
+    scatter(NULL),
+    counts(0)
+{
+    if ((key < 0) || (key > 3))
+        throw exc::inv_type;
+
+    width  = (w <= 0) ? internals::width  : w;
+    height = (h <= 0) ? internals::height : h;
+
+    *size = vec2(width, height);
+
+    ping = new texture("sorted", true, width, height);
+    pong = new texture("sorted", true, width, height);
+    last = ping;
+
+
+    // The lower element of a pair takes its partner if the latter is to be
+    // sorted before it and vice versa; for equal keys, both keep their own
+    std::string global = std::string(
+        "bool sort_before(vec4 a, vec4 b)\n"
+        "{\n"
+        "    return a.") + channel_names[key] + (descending ? " > b." : " < b.") + channel_names[key] + ";\n"
+        "}\n";
+
+    texture_placebo src_plac("sort_src"), dst_plac("sorted");
+
+    // A distance of 0 denotes the first step of every block, which compares
+    // mirrored elements; this way, all blocks are sorted in the same order and
+    // elements beyond the end behave like infinite keys, i.e., they never move
+    rnd_step = new render({ &src_plac, &block, &distance, &size }, { &dst_plac }, global.c_str(),
+        "float i = floor(gl_FragCoord.y) * sort_size.x + floor(gl_FragCoord.x);\n"
+        "float p;\n\n"
+        "if (sort_distance < .5)\n"
+        "{\n"
+        "    float base = floor(i / sort_block) * sort_block;\n"
+        "    p = 2. * base + sort_block - 1. - i;\n"
+        "}\n"
+        "else\n"
+        "    p = (mod(floor(i / sort_distance), 2.) > .5) ? i - sort_distance : i + sort_distance;\n\n"
+        "vec4 v = texture2D(raw_sort_src, tex_coord);\n\n"
+        "if (p < sort_size.x * sort_size.y)\n"
+        "{\n"
+        "    float py = floor((p + .5) / sort_size.x);\n"
+        "    vec4 o = texture2D(raw_sort_src, (vec2(p - py * sort_size.x, py) + .5) / sort_size);\n\n"
+        "    if ((p > i) ? sort_before(o, v) : sort_before(v, o))\n"
+        "        v = o;\n"
+        "}",
+        "v");
+    step_slot = rnd_step->slot("sort_src");
+}
+
+sort::~sort(void)
+{
+    delete rnd_step;
+
+    delete histogram;
+    delete scan_counts;
+    delete scatter;
+
+    if (counts)
+        glDeleteBuffers(1, &counts);
+
+    delete ping;
+    delete pong;
+}
+
+
+bool sort::use_compute(void)
+{
+    if (histogram != NULL)
+        return true;
+
+    if ((internals::ogl_maj < 4) || ((internals::ogl_maj == 4) && (internals::ogl_min < 3)))
+    {
+        dbgprintf("[sort] Compute shaders are not supported.\n");
+        return false;
+    }
+
+
+    char tmp[128];
+    sprintf(tmp, "#define RADIX_GROUP %i\n#define RADIX_DIGITS %iu\n#define SORT_KEY(v) v.%s\n#define SORT_INVERT %s\n",
+            RADIX_GROUP, 1 << RADIX_BITS, channel_names[key], descending ? "~" : "");
+
+    std::string common = std::string(radix_common);
+    common.insert(common.find('\n') + 1, tmp);
+
+    internals::program *prgs[3];
+    const char *srcs[3] = { radix_histogram, radix_scan, radix_scatter };
+
+    for (int i = 0; i < 3; i++)
+    {
+        internals::shader *sh = new internals::shader(internals::shader::compute);
+        sh->load((common + srcs[i]).c_str());
+
+        bool ok = sh->compile();
+
+        prgs[i] = new internals::program;
+
+        if (ok)
+        {
+            prgs[i]->attach(sh);
+            ok = prgs[i]->link();
+        }
+
+        delete sh;
+
+        if (!ok)
+        {
+            for (int j = 0; j <= i; j++)
+                delete prgs[j];
+
+            dbgprintf("[sort] Falling back to the bitonic sort.\n");
+            return false;
+        }
+    }
+
+    histogram   = prgs[0];
+    scan_counts = prgs[1];
+    scatter     = prgs[2];
+
+
+    int groups = (width * height + RADIX_GROUP - 1) / RADIX_GROUP;
+
+    glGenBuffers(1, &counts);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, counts);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, groups * (1 << RADIX_BITS) * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    return true;
+}
+
+
+void sort::bitonic_step(const texture *src, const texture *dst, int k, int j)
+{
+    *block = k;
+    *distance = j;
+
+    rnd_step->bind(step_slot, src);
+    *rnd_step >> dst;
+
+    rnd_step->prepare();
+    rnd_step->bind_input();
+    rnd_step->execute();
+
+    *rnd_step -= dst;
+}
+
+
+void sort::operator()(const texture *tex)
+{
+    if ((tex->width != width) || (tex->height != height))
+        throw exc::inv_type;
+
+    if (histogram != NULL)
+    {
+        radix(tex);
+        return;
+    }
+
+
+    int n = width * height;
+    const texture *src = tex;
+
+    // There is always at least one step, so the output is written even for a
+    // single element
+    for (int k = 2;; k *= 2)
+    {
+        // Mirroring step first, then halving distances
+        int j = 0;
+
+        do
+        {
+            texture *dst = (src == ping) ? pong : ping;
+
+            bitonic_step(src, dst, k, j);
+            src = dst;
+
+            j = j ? j / 2 : k / 4;
+        }
+        while (j > 0);
+
+        if (k >= n)
+            break;
+    }
+
+    last = src;
+
+    rnd_step->bind(step_slot, NULL);
+}
+
+
+void sort::radix(const texture *tex)
+{
+    int n = width * height, groups = (n + RADIX_GROUP - 1) / RADIX_GROUP;
+
+    internals::program *prgs[3] = { histogram, scan_counts, scatter };
+
+    for (auto prg: prgs)
+    {
+        prg->use();
+        prg->uniform("sort_width").set(width);
+        prg->uniform("sort_count").set(n);
+        prg->uniform("sort_groups").set(groups);
+    }
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, counts);
+
+
+    const texture *src = tex;
+
+    for (int shift = 0; shift < 32; shift += RADIX_BITS)
+    {
+        const texture *dst = (src == ping) ? pong : ping;
+
+        glBindImageTexture(0, src->id, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+        glBindImageTexture(1, dst->id, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+
+        histogram->use();
+        histogram->uniform("sort_shift").set(shift);
+        glDispatchCompute(groups, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        scan_counts->use();
+        glDispatchCompute(1, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        scatter->use();
+        scatter->uniform("sort_shift").set(shift);
+        glDispatchCompute(groups, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+        src = dst;
+    }
+
+    glMemoryBarrier(GL_ALL_BARRIER_BITS);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+
+    last = src;
+}
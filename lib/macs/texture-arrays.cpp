@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 
@@ -8,36 +9,106 @@
 using namespace macs;
 
 
-texture_array::texture_array(const char *n, int c):
+texture_array::texture_array(const char *n, int c, bool discrete, int w, int h):
     elements(c)
 {
+    width  = (w <= 0) ? internals::width  : w;
+    height = (h <= 0) ? internals::height : h;
+
     i_type = in::t_texture_array;
+    o_type = out::t_texture_array;
 
-    i_name = strdup(n);
+    i_name = o_name = strdup(n);
 
     glGenTextures(1, &id);
 
-    (*internals::tmu_mgr)[0] = this;
+    internals::tmu_mgr->select(this);
 
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, discrete ? GL_NEAREST : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, discrete ? GL_NEAREST : GL_LINEAR);
 
-    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA32F_ARB, internals::width, internals::height, elements, 0, GL_RGBA, GL_FLOAT, NULL);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA32F_ARB, width, height, elements, 0, GL_RGBA, GL_FLOAT, NULL);
 }
 
 texture_array::~texture_array(void)
 {
+    *internals::tmu_mgr -= this;
+
     glDeleteTextures(1, &id);
 
     free(const_cast<char *>(i_name));
 }
 
+void texture_array::resize(int c, int w, int h)
+{
+    GLuint old_id = id;
+    int old_elements = elements, old_width = width, old_height = height;
+
+    elements = c;
+    width    = w;
+    height   = h;
+
+    internals::tmu_mgr->select(this);
+
+    GLint min_filter, mag_filter;
+    glGetTexParameteriv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, &min_filter);
+    glGetTexParameteriv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, &mag_filter);
+
+    // The new texture takes the old one's place on its TMU
+    glGenTextures(1, &id);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, id);
+
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, min_filter);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, mag_filter);
+
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA32F_ARB, width, height, elements, 0, GL_RGBA, GL_FLOAT, NULL);
+
+
+    // Layers present in both sizes are scaled over by blitting
+    GLint prev_read, prev_draw;
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &prev_read);
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &prev_draw);
+
+    GLboolean scissored = glIsEnabled(GL_SCISSOR_TEST);
+    glDisable(GL_SCISSOR_TEST);
+
+    GLuint fbos[2];
+    glGenFramebuffers(2, fbos);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbos[0]);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbos[1]);
+
+    for (int l = 0; l < std::min(old_elements, elements); l++)
+    {
+        glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, old_id, 0, l);
+        glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, id, 0, l);
+
+        glBlitFramebuffer(0, 0, old_width, old_height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    }
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, prev_read);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, prev_draw);
+
+    glDeleteFramebuffers(2, fbos);
+
+    if (scissored)
+        glEnable(GL_SCISSOR_TEST);
+
+    glDeleteTextures(1, &old_id);
+}
+
 
 #define tex_array_write(format, gl_format) \
     void texture_array::write(const formats::format *src) \
     { \
-        (*internals::tmu_mgr)[0] = this; \
-        glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, internals::width, internals::height, elements, gl_format, GL_FLOAT, src); \
+        internals::tmu_mgr->select(this); \
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, width, height, elements, gl_format, GL_FLOAT, src); \
+    } \
+    \
+    void texture_array::write(int layer, const formats::format *src) \
+    { \
+        internals::tmu_mgr->select(this); \
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, width, height, 1, gl_format, GL_FLOAT, src); \
     }
 
 tex_array_write(f0123, GL_RGBA)
@@ -50,8 +121,24 @@ tex_array_write(f0,    GL_RED )
 #define tex_array_read(format, gl_format) \
     void texture_array::read(formats::format *dst) \
     { \
-        (*internals::tmu_mgr)[0] = this; \
-        glGetTexImage(GL_TEXTURE_3D, 0, gl_format, GL_FLOAT, dst); \
+        internals::tmu_mgr->select(this); \
+        glGetTexImage(GL_TEXTURE_2D_ARRAY, 0, gl_format, GL_FLOAT, dst); \
+    } \
+    \
+    void texture_array::read(int layer, formats::format *dst) \
+    { \
+        size_t sz = static_cast<size_t>(width) * height; \
+        \
+        if ((internals::ogl_maj > 4) || ((internals::ogl_maj == 4) && (internals::ogl_min >= 5))) \
+        { \
+            glGetTextureSubImage(id, 0, 0, 0, layer, width, height, 1, gl_format, GL_FLOAT, sz * sizeof(*dst), dst); \
+            return; \
+        } \
+        \
+        formats::format *all = new formats::format[sz * elements]; \
+        read(all); \
+        memcpy(dst, all + sz * layer, sz * sizeof(*dst)); \
+        delete[] all; \
     }
 
 tex_array_read(f0123, GL_RGBA)
@@ -59,3 +146,18 @@ tex_array_read(f2103, GL_BGRA)
 tex_array_read(f012,  GL_RGB )
 tex_array_read(f210,  GL_BGR )
 tex_array_read(f0,    GL_RED )
+
+
+texture_layer::texture_layer(const texture_array *arr, int l, const char *n):
+    array(arr),
+    layer(l)
+{
+    o_type = out::t_texture_layer;
+
+    o_name = strdup((n == NULL) ? arr->i_name : n);
+}
+
+texture_layer::~texture_layer(void)
+{
+    free(const_cast<char *>(o_name));
+}
@@ -20,7 +20,7 @@ texture::texture(const char *n, bool discrete, int w, int h)
 
     glGenTextures(1, &id);
 
-    (*internals::tmu_mgr)[0] = this;
+    internals::tmu_mgr->select(this);
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, discrete ? GL_NEAREST : GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, discrete ? GL_NEAREST : GL_LINEAR);
@@ -30,6 +30,8 @@ texture::texture(const char *n, bool discrete, int w, int h)
 
 texture::~texture(void)
 {
+    *internals::tmu_mgr -= this;
+
     glDeleteTextures(1, &id);
 
     free(const_cast<char *>(i_name));
@@ -39,7 +41,7 @@ texture::~texture(void)
 #define texture_write(format, gl_format) \
     void texture::write(const formats::format *src) \
     { \
-        (*internals::tmu_mgr)[0] = this; \
+        internals::tmu_mgr->select(this); \
         glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, gl_format, GL_FLOAT, src); \
     }
 
@@ -53,7 +55,7 @@ texture_write(f0,    GL_RED )
 #define texture_read(format, gl_format) \
     void texture::read(formats::format *dst) \
     { \
-        (*internals::tmu_mgr)[0] = this; \
+        internals::tmu_mgr->select(this); \
         glGetTexImage(GL_TEXTURE_2D, 0, gl_format, GL_FLOAT, dst); \
     }
 
@@ -67,7 +69,23 @@ texture_read(f0,    GL_RED )
 
 void texture::display(void)
 {
-    (*internals::tmu_mgr)[0] = this;
+    internals::tmu_mgr->select(this);
+
+    // Render passes set their own viewport
+    glViewport(0, 0, internals::width, internals::height);
+
+    internals::basic_pipeline->use();
+    internals::basic_pipeline->uniform("tex") = this;
+    internals::draw_quad();
+}
+
+void texture::display(int w, int h)
+{
+    internals::tmu_mgr->select(this);
+
+    // The quad is enlarged beyond the screen so that only the requested part
+    // is visible
+    glViewport(0, 0, (internals::width * width + w - 1) / w, (internals::height * height + h - 1) / h);
 
     internals::basic_pipeline->use();
     internals::basic_pipeline->uniform("tex") = this;
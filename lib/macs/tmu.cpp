@@ -8,6 +8,10 @@ using namespace macs;
 using namespace macs::internals;
 
 
+/// Currently active hardware TMU.
+static int active_unit = 0;
+
+
 tmu::tmu(int u):
     unit(u),
     assigned(NULL)
@@ -16,25 +20,30 @@ tmu::tmu(int u):
 
 void tmu::operator=(const textures_in *tex)
 {
+    // Callers rely on this unit being active afterwards (e.g., for uploads).
+    if (active_unit != unit)
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        active_unit = unit;
+    }
+
     if (tex == assigned)
         return;
 
 
-    glActiveTexture(GL_TEXTURE0 + unit);
+    // Only reset the back reference if it actually refers to this unit
+    if ((assigned != NULL) && (assigned->unit == unit))
+        assigned->unit = -1;
+
+    if (tex != NULL)
+        tex->unit = unit;
 
 
-    if ((assigned != NULL) && ((tex == NULL) || (tex->i_type != assigned->i_type)))
+    // Array textures have no fixed function enable, only 2D textures do.
+    if ((assigned != NULL) && (assigned->i_type == in::t_texture) && ((tex == NULL) || (tex->i_type != in::t_texture)))
     {
-        if (assigned->i_type == in::t_texture)
-        {
-            dbgprintf("[tmu%i] Disabling 2D textures.\n", unit);
-            glDisable(GL_TEXTURE_2D);
-        }
-        else // in::t_texture_array
-        {
-            dbgprintf("[tmu%i] Disabling 3D textures.\n", unit);
-            glDisable(GL_TEXTURE_3D);
-        }
+        dbgprintf("[tmu%i] Disabling 2D textures.\n", unit);
+        glDisable(GL_TEXTURE_2D);
     }
 
 
@@ -56,15 +65,9 @@ void tmu::operator=(const textures_in *tex)
         }
         else
         {
-            if ((assigned == NULL) || (assigned->i_type != in::t_texture_array))
-            {
-                glEnable(GL_TEXTURE_3D);
-                dbgprintf("[tmu%i] Enabled 3D textures.\n", unit);
-            }
-
             dbgprintf("[tmu%i] Attaching texture array “%s”.\n", unit, tex->i_name);
 
-            glBindTexture(GL_TEXTURE_3D, static_cast<const texture_array *>(tex)->id);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, static_cast<const texture_array *>(tex)->id);
         }
     }
 
@@ -75,63 +78,102 @@ void tmu::operator=(const textures_in *tex)
 
 
 tmu_manager::tmu_manager(int u):
-    units(u)
+    units(u),
+    clock(1)
 {
     tmus = new tmu[u];
     definitely = new bool[u];
+    last_use = new unsigned long[u];
 
     for (int i = 0; i < u; i++)
+    {
         tmus[i].reassign(i);
+        definitely[i] = false;
+        last_use[i] = 0;
+    }
 }
 
 tmu_manager::~tmu_manager(void)
 {
-    delete tmus;
-    delete definitely;
+    delete[] tmus;
+    delete[] definitely;
+    delete[] last_use;
 }
 
 void tmu_manager::loosen(void)
 {
     memset(definitely, 0, sizeof(bool) * units);
+
+    clock++;
 }
 
 bool tmu_manager::operator&=(const textures_in *tex)
 {
+    if (tex->unit < 0)
+        return false;
+
+    definitely[tex->unit] = true;
+    last_use[tex->unit] = clock;
+
+    return true;
+}
+
+int tmu_manager::victim(void)
+{
+    int lru = -1;
+
     for (int i = 0; i < units; i++)
     {
-        if (tmus[i] == tex)
-        {
-            definitely[i] = true;
-            return true;
-        }
+        if (definitely[i])
+            continue;
+
+        // Free units have never been used (or have been released)
+        if ((lru < 0) || (last_use[i] < last_use[lru]))
+            lru = i;
     }
 
-    return false;
+    return lru;
 }
 
 void tmu_manager::operator+=(const textures_in *tex)
 {
-    for (int i = 0; i < units; i++)
-    {
-        if (tmus[i] == NULL)
-        {
-            definitely[i] = true;
-            tmus[i] = tex;
-            return;
-        }
-    }
+    int i = victim();
+
+    if (i < 0)
+        throw exc::rsrc_lim_exc;
 
+    dbgprintf("[tmu%i] Evicting for “%s”.\n", i, tex->i_name);
+
+    definitely[i] = true;
+    last_use[i] = clock;
+    tmus[i] = tex;
+}
+
+void tmu_manager::operator-=(const textures_in *tex)
+{
     for (int i = 0; i < units; i++)
     {
-        if (!definitely[i])
+        if (tmus[i] == tex)
         {
-            definitely[i] = true;
-            tmus[i] = tex;
-            return;
+            definitely[i] = false;
+            last_use[i] = 0;
+            tmus[i] = NULL;
         }
     }
 
-    throw exc::rsrc_lim_exc;
+    tex->unit = -1;
+}
+
+void tmu_manager::select(const textures_in *tex)
+{
+    int i = (tex->unit >= 0) ? tex->unit : victim();
+
+    // Everything is in use by the current pass; just take the first unit
+    if (i < 0)
+        i = 0;
+
+    last_use[i] = clock;
+    tmus[i] = tex;
 }
 
 void tmu_manager::update(void)
@@ -147,6 +147,83 @@ float mat4::det(void) const
                row(12,   1,  6, 11,   5, 10,  3,   9,  2,  7);
 }
 
+#ifdef MACS_SIMD
+#define shuf(a, b, x, y, z, w) _mm_shuffle_ps(a, b, _MM_SHUFFLE(w, z, y, x))
+
+/// 2x2 matrix product A * B (2x2 matrices stored in one register, row-major).
+static inline __m128 mul2(__m128 a, __m128 b)
+{
+    return _mm_add_ps(_mm_mul_ps(a, shuf(b, b, 0, 3, 0, 3)),
+                      _mm_mul_ps(shuf(a, a, 1, 0, 3, 2), shuf(b, b, 2, 1, 2, 1)));
+}
+
+/// 2x2 matrix product adj(A) * B.
+static inline __m128 adj_mul2(__m128 a, __m128 b)
+{
+    return _mm_sub_ps(_mm_mul_ps(shuf(a, a, 3, 3, 0, 0), b),
+                      _mm_mul_ps(shuf(a, a, 1, 1, 2, 2), shuf(b, b, 2, 3, 0, 1)));
+}
+
+/// 2x2 matrix product A * adj(B).
+static inline __m128 mul_adj2(__m128 a, __m128 b)
+{
+    return _mm_sub_ps(_mm_mul_ps(a, shuf(b, b, 3, 0, 3, 0)),
+                      _mm_mul_ps(shuf(a, a, 1, 0, 3, 2), shuf(b, b, 2, 1, 2, 1)));
+}
+
+/**
+ * Inverts a 4x4 matrix split into the 2x2 blocks A, B, C and D. The layout
+ * does not matter, as the inverse of the transpose is the transpose of the
+ * inverse. nd may be d.
+ */
+static void inv4(const float *d, float *nd)
+{
+    __m128 m0 = _mm_loadu_ps(&d[0]), m1 = _mm_loadu_ps(&d[4]), m2 = _mm_loadu_ps(&d[8]), m3 = _mm_loadu_ps(&d[12]);
+
+    __m128 a = _mm_movelh_ps(m0, m1), b = _mm_movehl_ps(m1, m0);
+    __m128 c = _mm_movelh_ps(m2, m3), e = _mm_movehl_ps(m3, m2);
+
+    // Determinants of A, B, C and D
+    __m128 det_sub = _mm_sub_ps(_mm_mul_ps(shuf(m0, m2, 0, 2, 0, 2), shuf(m1, m3, 1, 3, 1, 3)),
+                                _mm_mul_ps(shuf(m0, m2, 1, 3, 1, 3), shuf(m1, m3, 0, 2, 0, 2)));
+
+    __m128 det_a = shuf(det_sub, det_sub, 0, 0, 0, 0), det_b = shuf(det_sub, det_sub, 1, 1, 1, 1);
+    __m128 det_c = shuf(det_sub, det_sub, 2, 2, 2, 2), det_e = shuf(det_sub, det_sub, 3, 3, 3, 3);
+
+    __m128 ec = adj_mul2(e, c), ab = adj_mul2(a, b);
+
+    // Adjugates of the blocks of the inverse
+    __m128 x = _mm_sub_ps(_mm_mul_ps(det_e, a), mul2(b, ec));
+    __m128 w = _mm_sub_ps(_mm_mul_ps(det_a, e), mul2(c, ab));
+    __m128 y = _mm_sub_ps(_mm_mul_ps(det_b, c), mul_adj2(e, ab));
+    __m128 z = _mm_sub_ps(_mm_mul_ps(det_c, b), mul_adj2(a, ec));
+
+    // det = det(A) det(D) + det(B) det(C) - tr(adj(A) B adj(D) C)
+    __m128 tr = _mm_mul_ps(ab, shuf(ec, ec, 0, 2, 1, 3));
+    tr = _mm_add_ps(tr, shuf(tr, tr, 1, 0, 3, 2));
+    tr = _mm_add_ps(tr, shuf(tr, tr, 2, 3, 0, 1));
+
+    __m128 dt = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(det_a, det_e), _mm_mul_ps(det_b, det_c)), tr);
+
+    if (!_mm_cvtss_f32(dt))
+        abort();
+
+    __m128 rdt = _mm_div_ps(_mm_setr_ps(1.f, -1.f, -1.f, 1.f), dt);
+
+    x = _mm_mul_ps(x, rdt);
+    y = _mm_mul_ps(y, rdt);
+    z = _mm_mul_ps(z, rdt);
+    w = _mm_mul_ps(w, rdt);
+
+    _mm_storeu_ps(&nd[ 0], shuf(x, y, 3, 1, 3, 1));
+    _mm_storeu_ps(&nd[ 4], shuf(x, y, 2, 0, 2, 0));
+    _mm_storeu_ps(&nd[ 8], shuf(z, w, 3, 1, 3, 1));
+    _mm_storeu_ps(&nd[12], shuf(z, w, 2, 0, 2, 0));
+}
+
+#undef shuf
+#endif
+
 #define le(a1, a2, a3, a4, a5) d[a1] * (d[a2] * d[a3] - d[a4] * d[a5])
 
 #define ele(x, a1, a2, a3, a4, a5, a6, a7, a8, a9, aA, aB, aC, aD, aE, aF) \
@@ -154,6 +231,11 @@ float mat4::det(void) const
 
 mat4 mat4::inv(void) const
 {
+#ifdef MACS_SIMD
+    float nd[16];
+    inv4(d, nd);
+    return mat4(nd);
+#else
     float dt = det();
 
     if (!dt)
@@ -182,10 +264,14 @@ mat4 mat4::inv(void) const
     };
 
     return mat4(nd);
+#endif
 }
 
 void mat4::invert(void)
 {
+#ifdef MACS_SIMD
+    inv4(d, d);
+#else
     float dt = det();
 
     if (!dt)
@@ -214,6 +300,7 @@ void mat4::invert(void)
     };
 
     memcpy(d, nd, sizeof(nd));
+#endif
 }
 
 
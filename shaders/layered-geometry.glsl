@@ -0,0 +1,24 @@
+#version 150 compatibility
+
+layout(triangles) in;
+layout(triangle_strip, max_vertices = 3) out;
+
+in vec2 geom_tex_coord[];
+in float geom_layer[];
+
+out vec2 tex_coord;
+out float out_layer;
+
+void main(void)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        gl_Position = gl_in[i].gl_Position;
+        gl_Layer = int(geom_layer[i]);
+        tex_coord = geom_tex_coord[i];
+        out_layer = geom_layer[i];
+        EmitVertex();
+    }
+
+    EndPrimitive();
+}
@@ -0,0 +1,11 @@
+#version 150 compatibility
+
+out vec2 geom_tex_coord;
+out float geom_layer;
+
+void main(void)
+{
+    gl_Position = gl_Vertex;
+    geom_tex_coord = .5 * (gl_Vertex.xy + vec2(1., 1.));
+    geom_layer = float(gl_InstanceID);
+}
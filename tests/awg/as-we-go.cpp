@@ -126,7 +126,7 @@ extern "C" int main(int argc, char *argv[])
 
     betelgeuse::object sphere(
         "if (length(cross(dir, start)) > length(dir))\n"
-        "    discard;\n\n"
+        "    return -1.;\n\n"
         "float a =  dot(dir  , dir  );\n"
         "float b =  dot(start, dir  )       / a;\n"
         "float c = (dot(start, start) - 1.) / a;\n\n"
@@ -135,7 +135,7 @@ extern "C" int main(int argc, char *argv[])
         "if (t1 < 0.)\n"
         "{\n"
         "    if (t2 < 0.)\n"
-        "        discard;\n"
+        "        return -1.;\n"
         "    return t2;\n"
         "}\n\n"
         "if ((t2 < 0.) || (t1 < t2))\n"
@@ -159,7 +159,7 @@ extern "C" int main(int argc, char *argv[])
     betelgeuse::object quad(
         "float i = -start.z / dir.z;\n\n"
         "if ((i < 0.) || (abs(start.x + i * dir.x) > .5) || (abs(start.y + i * dir.y) > .5))\n"
-        "    discard;\n\n"
+        "    return -1.;\n\n"
         "return i;",
 
         "float i = -start.z / dir.z;\n\n"
@@ -0,0 +1,228 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include <SDL/SDL.h>
+
+#include <macs/macs.hpp>
+
+
+/*
+ * Compute backend test.
+ *
+ * Runs the same render passes through the fragment and the compute backend
+ * and compares the results:
+ *
+ *   plain     One output, no blending.
+ *   blend     Additive blending (emulated by the compute backend).
+ *   outputs   Nine outputs (more than max_output_textures() on most
+ *             implementations).
+ *   blur      3x3 box blur; the compute version uses a shared memory tile.
+ *
+ * Usage: test_compute [resolution]
+ *
+ * To run headless (e.g. on llvmpipe), start it inside a virtual X server:
+ *   LIBGL_ALWAYS_SOFTWARE=1 xvfb-run tests/test_compute
+ */
+
+
+#define WG 16
+#define OUTPUTS 9
+
+
+static int res;
+static macs::formats::f0123 *a, *b;
+
+
+static bool compare(const char *name, macs::texture *frag, macs::texture *comp)
+{
+    frag->read(a);
+    comp->read(b);
+
+    float maxdiff = 0.f;
+
+    for (int i = 0; i < res * res; i++)
+    {
+        maxdiff = fmaxf(maxdiff, fabsf(a[i].r - b[i].r));
+        maxdiff = fmaxf(maxdiff, fabsf(a[i].g - b[i].g));
+        maxdiff = fmaxf(maxdiff, fabsf(a[i].b - b[i].b));
+        maxdiff = fmaxf(maxdiff, fabsf(a[i].a - b[i].a));
+    }
+
+    bool ok = maxdiff < 1e-4f;
+
+    printf("%-8s max. difference %g: %s\n", name, maxdiff, ok ? "ok" : "FAILED");
+
+    return ok;
+}
+
+
+static void run(macs::render *rnd, int times = 1)
+{
+    rnd->prepare();
+
+    for (int i = 0; i < times; i++)
+    {
+        rnd->bind_input();
+        rnd->execute();
+    }
+}
+
+
+extern "C" int main(int argc, char *argv[])
+{
+    res = (argc > 1) ? atoi(argv[1]) : 256;
+
+    if (res < 1)
+        res = 256;
+
+
+    SDL_Init(SDL_INIT_VIDEO);
+
+    SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
+
+    SDL_SetVideoMode(64, 64, 32, SDL_OPENGL | SDL_DOUBLEBUF);
+
+
+    if (!macs::init(res, res))
+        return 1;
+
+
+    a = new macs::formats::f0123[res * res];
+    b = new macs::formats::f0123[res * res];
+
+    for (int i = 0; i < res * res; i++)
+        a[i] = macs::formats::f0123({ (i % 7) / 7.f, (i % 13) / 13.f, (i % res) / static_cast<float>(res), 1.f });
+
+    macs::texture src("src");
+    src.write(a);
+
+
+    bool ok = true;
+
+
+    {
+        macs::texture out_f("result"), out_c("result");
+
+        macs::render frag({ &src }, { &out_f }, "", "", "src * 2. + vec4(tex_coord, 0., 1.)");
+        macs::render comp({ &src }, { &out_c }, "", "", "src * 2. + vec4(tex_coord, 0., 1.)");
+
+        if (!comp.use_compute(WG, WG))
+        {
+            printf("Compute backend not available.\n");
+            return 0;
+        }
+
+        run(&frag);
+        run(&comp);
+
+        ok &= compare("plain", &out_f, &out_c);
+
+
+        frag.blend_func(macs::render::use, macs::render::use);
+        comp.blend_func(macs::render::use, macs::render::use);
+
+        run(&frag, 3);
+        run(&comp, 3);
+
+        ok &= compare("blend", &out_f, &out_c);
+    }
+
+
+    {
+        // Exceeds the number of color attachments on most implementations
+        macs::texture *out_f[OUTPUTS], *out_c[OUTPUTS];
+        macs::texture_placebo *plac[OUTPUTS];
+
+        char name[16];
+
+        for (int i = 0; i < OUTPUTS; i++)
+        {
+            sprintf(name, "out%i", i);
+
+            out_f[i] = new macs::texture(name);
+            out_c[i] = new macs::texture(name);
+            plac[i] = new macs::texture_placebo(name);
+        }
+
+#define outputs(n) \
+    macs::render n({ &src }, { plac[0], plac[1], plac[2], plac[3], plac[4], plac[5], plac[6], plac[7], plac[8] }, "", "", \
+                   "src", "src + vec4(1.)", "src + vec4(2.)", "src + vec4(3.)", "src + vec4(4.)", \
+                   "src + vec4(5.)", "src + vec4(6.)", "src + vec4(7.)", "src * tex_coord.y")
+
+        outputs(frag);
+        outputs(comp);
+
+#undef outputs
+
+        comp.use_compute(WG, WG);
+
+        for (int i = 0; i < OUTPUTS; i++)
+        {
+            frag >> out_f[i];
+            comp >> out_c[i];
+        }
+
+        run(&frag);
+        run(&comp);
+
+        for (int i = 0; i < OUTPUTS; i++)
+            ok &= compare("outputs", out_f[i], out_c[i]);
+
+        for (int i = 0; i < OUTPUTS; i++)
+        {
+            delete out_f[i];
+            delete out_c[i];
+            delete plac[i];
+        }
+    }
+
+
+    {
+        macs::texture out_f("blurred"), out_c("blurred");
+        macs::types::named<macs::types::vec2> pixel("pixel", macs::types::vec2(1.f / res, 1.f / res));
+
+        // The compute version uses shared memory, the fragment version (the
+        // fallback) samples all neighbours directly
+        const char *blur =
+            "vec4 sum = vec4(0., 0., 0., 0.);\n"
+            "#ifdef MACS_COMPUTE\n"
+            "ivec2 size = textureSize(raw_src, 0);\n"
+            "ivec2 base = ivec2(gl_WorkGroupID.xy) * WG - 1;\n"
+            "for (int i = int(gl_LocalInvocationIndex); i < (WG + 2) * (WG + 2); i += WG * WG)\n"
+            "{\n"
+            "    ivec2 p = (base + ivec2(i % (WG + 2), i / (WG + 2)) + size) % size;\n"
+            "    tile[i / (WG + 2)][i % (WG + 2)] = texelFetch(raw_src, p, 0);\n"
+            "}\n"
+            "barrier();\n"
+            "ivec2 l = ivec2(gl_LocalInvocationID.xy) + 1;\n"
+            "for (int y = -1; y <= 1; y++)\n"
+            "    for (int x = -1; x <= 1; x++)\n"
+            "        sum += tile[l.y + y][l.x + x];\n"
+            "#else\n"
+            "for (int y = -1; y <= 1; y++)\n"
+            "    for (int x = -1; x <= 1; x++)\n"
+            "        sum += texture2D(raw_src, tex_coord + vec2(float(x), float(y)) * pixel);\n"
+            "#endif";
+
+        macs::render frag({ &src, &pixel }, { &out_f }, "", blur, "sum / 9.");
+        macs::render comp({ &src, &pixel }, { &out_c }, "", blur, "sum / 9.");
+
+        char tile[64];
+        sprintf(tile, "#define WG %i\nshared vec4 tile[WG + 2][WG + 2];\n", WG);
+
+        comp.use_compute(WG, WG, tile);
+
+        run(&frag);
+        run(&comp);
+
+        ok &= compare("blur", &out_f, &out_c);
+    }
+
+
+    delete[] a;
+    delete[] b;
+
+
+    return ok ? 0 : 1;
+}
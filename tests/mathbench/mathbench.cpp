@@ -0,0 +1,313 @@
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <time.h>
+#include <vector>
+
+#include <macs/macs.hpp>
+
+
+/*
+ * MACS algebraic types benchmark.
+ *
+ * Checks the matrix and vector operations of macs::types against plain
+ * reference loops and prints one line per operation:
+ *
+ *   macs ns      Time per operation of the macs::types implementation (SSE
+ *                unless built with -DMACS_NO_SIMD).
+ *   ref ns       Time per operation of the reference loop.
+ *   max error    Largest difference to the reference (the inverses are
+ *                compared to a double precision Gauss-Jordan elimination,
+ *                relative to the largest element; everything else has to
+ *                match exactly).
+ *
+ * The last line measures the per-instance transformation update
+ * (instance::update_transformation(): inverse, transpose and 3x3 normal
+ * matrix).
+ *
+ * Usage: test_mathbench [matrices [min time per measurement in ms]]
+ *
+ * No OpenGL context is needed.
+ */
+
+
+using namespace macs::types;
+
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static float frand(void)
+{
+    return rand() / static_cast<float>(RAND_MAX) * 2.f - 1.f;
+}
+
+
+static void ref_mul4(const float *a, const float *b, float *r)
+{
+    for (int j = 0; j < 4; j++)
+        for (int i = 0; i < 4; i++)
+            r[j * 4 + i] = a[i] * b[j * 4] + a[4 + i] * b[j * 4 + 1] + a[8 + i] * b[j * 4 + 2] + a[12 + i] * b[j * 4 + 3];
+}
+
+static void ref_mul3(const float *a, const float *b, float *r)
+{
+    for (int j = 0; j < 3; j++)
+        for (int i = 0; i < 3; i++)
+            r[j * 3 + i] = a[i] * b[j * 3] + a[3 + i] * b[j * 3 + 1] + a[6 + i] * b[j * 3 + 2];
+}
+
+static void ref_mul_vec4(const float *m, const float *v, float *r)
+{
+    for (int i = 0; i < 4; i++)
+        r[i] = v[0] * m[i] + v[1] * m[4 + i] + v[2] * m[8 + i] + v[3] * m[12 + i];
+}
+
+static void ref_transpose4(const float *m, float *r)
+{
+    for (int j = 0; j < 4; j++)
+        for (int i = 0; i < 4; i++)
+            r[i * 4 + j] = m[j * 4 + i];
+}
+
+/// Gauss-Jordan elimination with partial pivoting (n x n, column-major).
+static void ref_inv(const float *m, double *r, int n)
+{
+    double a[4][8];
+
+    for (int i = 0; i < n; i++)
+        for (int j = 0; j < n; j++)
+        {
+            a[i][j] = m[j * n + i];
+            a[i][n + j] = (i == j) ? 1. : 0.;
+        }
+
+    for (int c = 0; c < n; c++)
+    {
+        int p = c;
+
+        for (int i = c + 1; i < n; i++)
+            if (fabs(a[i][c]) > fabs(a[p][c]))
+                p = i;
+
+        for (int j = 0; j < 2 * n; j++)
+        {
+            double t = a[c][j];
+            a[c][j] = a[p][j];
+            a[p][j] = t;
+        }
+
+        double f = 1. / a[c][c];
+
+        for (int j = 0; j < 2 * n; j++)
+            a[c][j] *= f;
+
+        for (int i = 0; i < n; i++)
+        {
+            if (i == c)
+                continue;
+
+            double g = a[i][c];
+
+            for (int j = 0; j < 2 * n; j++)
+                a[i][j] -= g * a[c][j];
+        }
+    }
+
+    for (int i = 0; i < n; i++)
+        for (int j = 0; j < n; j++)
+            r[j * n + i] = a[i][n + j];
+}
+
+static float rel_error(const float *m, const double *ref, int count)
+{
+    double scale = 0., err = 0.;
+
+    for (int i = 0; i < count; i++)
+    {
+        scale = fmax(scale, fabs(ref[i]));
+        err = fmax(err, fabs(m[i] - ref[i]));
+    }
+
+    return err / scale;
+}
+
+static float abs_error(const float *a, const float *b, int count)
+{
+    float err = 0.f;
+
+    for (int i = 0; i < count; i++)
+        err = fmaxf(err, fabsf(a[i] - b[i]));
+
+    return err;
+}
+
+
+/// Repeats fn over all matrices until min_ns have passed; returns ns per call.
+template<typename F> static double measure(size_t count, uint64_t min_ns, F fn)
+{
+    uint64_t start = now_ns(), elapsed;
+    size_t calls = 0;
+
+    do
+    {
+        for (size_t i = 0; i < count; i++)
+            fn(i);
+
+        calls += count;
+        elapsed = now_ns() - start;
+    }
+    while (elapsed < min_ns);
+
+    return static_cast<double>(elapsed) / calls;
+}
+
+
+static float sink;
+
+
+extern "C" int main(int argc, char *argv[])
+{
+    size_t count = (argc > 1) ? atoi(argv[1]) : 4096;
+    uint64_t min_ns = ((argc > 2) ? atoi(argv[2]) : 200) * 1000000ULL;
+
+#ifdef MACS_SIMD
+    printf("macs::types: SSE\n\n");
+#else
+    printf("macs::types: scalar\n\n");
+#endif
+
+    srand(42);
+
+    // Half of them are transformations as set up by the instances, the rest
+    // are random (but not too badly conditioned)
+    std::vector<mat4> a(count), b(count), r(count);
+    std::vector<mat3> a3(count), b3(count), r3(count);
+    std::vector<vec4> v(count), rv(count);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (i & 1)
+        {
+            a[i].translate(vec3(frand() * 10.f, frand() * 10.f, frand() * 10.f));
+            a[i].rotate(frand() * 3.f, vec3(frand(), frand(), frand() + 2.f));
+            a[i].scale(vec3(frand() + 1.5f, frand() + 1.5f, frand() + 1.5f));
+        }
+        else
+        {
+            for (int j = 0; j < 16; j++)
+                a[i].d[j] = frand() + ((j % 5) ? 0.f : 3.f);
+        }
+
+        for (int j = 0; j < 16; j++)
+            b[i].d[j] = frand();
+
+        a3[i] = mat3(a[i]);
+        b3[i] = mat3(b[i]);
+        v[i] = vec4(frand(), frand(), frand(), 1.f);
+    }
+
+
+    printf("%-16s %10s %10s %12s\n", "operation", "macs ns", "ref ns", "max error");
+
+    float err = 0.f, ref[16];
+    double dref[16];
+
+    for (size_t i = 0; i < count; i++)
+    {
+        ref_mul4(a[i].d, b[i].d, ref);
+        err = fmaxf(err, abs_error((a[i] * b[i]).d, ref, 16));
+    }
+
+    printf("%-16s %10.2f %10.2f %12g\n", "mat4 * mat4",
+           measure(count, min_ns, [&](size_t i) { r[i] = a[i] * b[i]; }),
+           measure(count, min_ns, [&](size_t i) { ref_mul4(a[i].d, b[i].d, r[i].d); }),
+           err);
+
+    err = 0.f;
+    for (size_t i = 0; i < count; i++)
+    {
+        ref_mul_vec4(a[i].d, v[i].d, ref);
+        err = fmaxf(err, abs_error((a[i] * v[i]).d, ref, 4));
+    }
+
+    printf("%-16s %10.2f %10.2f %12g\n", "mat4 * vec4",
+           measure(count, min_ns, [&](size_t i) { rv[i] = a[i] * v[i]; }),
+           measure(count, min_ns, [&](size_t i) { ref_mul_vec4(a[i].d, v[i].d, rv[i].d); }),
+           err);
+
+    err = 0.f;
+    for (size_t i = 0; i < count; i++)
+    {
+        ref_transpose4(a[i].d, ref);
+        err = fmaxf(err, abs_error(a[i].transposed().d, ref, 16));
+    }
+
+    printf("%-16s %10.2f %10.2f %12g\n", "mat4 transpose",
+           measure(count, min_ns, [&](size_t i) { r[i] = a[i].transposed(); }),
+           measure(count, min_ns, [&](size_t i) { ref_transpose4(a[i].d, r[i].d); }),
+           err);
+
+    err = 0.f;
+    for (size_t i = 0; i < count; i++)
+    {
+        ref_inv(a[i].d, dref, 4);
+        err = fmaxf(err, rel_error(a[i].inv().d, dref, 16));
+    }
+
+    printf("%-16s %10.2f %10.2f %12g\n", "mat4 inverse",
+           measure(count, min_ns, [&](size_t i) { r[i] = a[i].inv(); }),
+           measure(count, min_ns, [&](size_t i) { ref_inv(a[i].d, dref, 4); sink += dref[0]; }),
+           err);
+
+    err = 0.f;
+    for (size_t i = 0; i < count; i++)
+    {
+        ref_mul3(a3[i].d, b3[i].d, ref);
+        err = fmaxf(err, abs_error((a3[i] * b3[i]).d, ref, 9));
+    }
+
+    printf("%-16s %10.2f %10.2f %12g\n", "mat3 * mat3",
+           measure(count, min_ns, [&](size_t i) { r3[i] = a3[i] * b3[i]; }),
+           measure(count, min_ns, [&](size_t i) { ref_mul3(a3[i].d, b3[i].d, r3[i].d); }),
+           err);
+
+    err = 0.f;
+    for (size_t i = 0; i < count; i++)
+    {
+        ref_inv(a3[i].d, dref, 3);
+        err = fmaxf(err, rel_error(a3[i].inv().d, dref, 9));
+    }
+
+    printf("%-16s %10.2f %10.2f %12g\n", "mat3 inverse",
+           measure(count, min_ns, [&](size_t i) { r3[i] = a3[i].inv(); }),
+           measure(count, min_ns, [&](size_t i) { ref_inv(a3[i].d, dref, 3); sink += dref[0]; }),
+           err);
+
+    err = 0.f;
+    for (size_t i = 0; i < count; i++)
+    {
+        vec4 s = v[i] + rv[i] * 2.f - v[i];
+        for (int j = 0; j < 4; j++)
+            err = fmaxf(err, fabsf(s.d[j] - (v[i].d[j] + rv[i].d[j] * 2.f - v[i].d[j])));
+    }
+
+    printf("%-16s %10.2f %10.2f %12g\n", "vec4 a + b * s",
+           measure(count, min_ns, [&](size_t i) { rv[i] = v[i] + rv[i] * .5f; }),
+           measure(count, min_ns, [&](size_t i) { for (int j = 0; j < 4; j++) rv[i].d[j] = v[i].d[j] + rv[i].d[j] * .5f; }),
+           err);
+
+
+    // As done by instance::update_transformation()
+    printf("\n%-16s %10.2f ns\n", "instance update",
+           measure(count, min_ns, [&](size_t i) { r[i] = a[i].inv(); r3[i] = mat3(r[i].transposed()); }));
+
+    return (sink == 42.f) ? 1 : 0;
+}
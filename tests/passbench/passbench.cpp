@@ -0,0 +1,362 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <time.h>
+
+#include <SDL/SDL.h>
+
+#include <macs/macs.hpp>
+
+
+/*
+ * MACS render pass micro benchmark.
+ *
+ * Sweeps resolution, filtering, input count and output count with synthetic
+ * render pass scripts and prints one line per configuration:
+ *
+ *   ns/pass      Wall clock time per pass (including GPU time).
+ *   gpu ns/pass  GPU time per pass (GL_TIME_ELAPSED, if available).
+ *   GB/s         Effective bandwidth: (inputs + outputs) * width * height *
+ *                16 bytes per GPU (or wall clock) time.
+ *   cpu ns/pass  Time spent in prepare(), bind_input() and execute().
+ *   ovh ns/pass  Wall clock time per pass with a 1x1 scissor box, i.e., the
+ *                fixed cost of a pass without any fragment work.
+ *
+ * Afterwards, texture upload and readback bandwidth is measured for every
+ * transfer format.
+ *
+ * Usage: test_passbench [max resolution [min time per measurement in ms]]
+ *
+ * To run headless (e.g. on llvmpipe), start it inside a virtual X server:
+ *   LIBGL_ALWAYS_SOFTWARE=1 xvfb-run tests/test_passbench
+ */
+
+
+#define MAX_INPUTS  8
+#define MAX_OUTPUTS 8
+
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static bool timer_queries;
+
+
+/// Result of running a pass for a number of iterations.
+struct timing
+{
+    int iterations;
+    double wall_ns, gpu_ns, cpu_ns;
+};
+
+
+static timing run(macs::render *rnd, uint64_t min_ns, bool scissored)
+{
+    timing t;
+
+    if (scissored)
+    {
+        glEnable(GL_SCISSOR_TEST);
+        glScissor(0, 0, 1, 1);
+    }
+
+    // Warm up (shader compilation on first use, TMU assignment etc.)
+    for (int i = 0; i < 4; i++)
+    {
+        rnd->prepare();
+        rnd->bind_input();
+        rnd->execute();
+    }
+    glFinish();
+
+
+    GLuint query = 0;
+    if (timer_queries)
+        glGenQueries(1, &query);
+
+    for (int iters = 4;; iters *= 2)
+    {
+        uint64_t cpu = 0;
+
+        if (timer_queries)
+            glBeginQuery(GL_TIME_ELAPSED, query);
+
+        uint64_t start = now_ns();
+
+        for (int i = 0; i < iters; i++)
+        {
+            uint64_t call_start = now_ns();
+
+            rnd->prepare();
+            rnd->bind_input();
+            rnd->execute();
+
+            cpu += now_ns() - call_start;
+        }
+
+        if (timer_queries)
+            glEndQuery(GL_TIME_ELAPSED);
+
+        glFinish();
+
+        uint64_t wall = now_ns() - start;
+
+        if ((wall >= min_ns) || (iters >= (1 << 16)))
+        {
+            t.iterations = iters;
+            t.wall_ns = static_cast<double>(wall) / iters;
+            t.cpu_ns  = static_cast<double>(cpu) / iters;
+
+            if (timer_queries)
+            {
+                GLuint64 gpu;
+                glGetQueryObjectui64v(query, GL_QUERY_RESULT, &gpu);
+                t.gpu_ns = static_cast<double>(gpu) / iters;
+            }
+            else
+                t.gpu_ns = -1.;
+
+            break;
+        }
+    }
+
+    if (timer_queries)
+        glDeleteQueries(1, &query);
+
+    if (scissored)
+        glDisable(GL_SCISSOR_TEST);
+
+    return t;
+}
+
+
+/**
+ * Creates the synthetic kernel. All possible inputs are declared as texture
+ * placebos (unused samplers are optimized out by the GLSL compiler), the used
+ * ones are then appended by <tt>operator<<</tt>. Every output is set to the
+ * sum of all inputs plus a per-output constant.
+ */
+static macs::render *make_pass(macs::texture **inputs, int ni, macs::texture **outputs, int no)
+{
+    macs::texture_placebo p0("in0"), p1("in1"), p2("in2"), p3("in3"), p4("in4"), p5("in5"), p6("in6"), p7("in7");
+
+    std::string sum = "vec4 sum = vec4(0., 0., 0., 0.);\n";
+    for (int i = 0; i < ni; i++)
+    {
+        char line[16];
+        sprintf(line, "sum += in%i;\n", i);
+        sum += line;
+    }
+
+    const char *vals[MAX_OUTPUTS] = {
+        "sum", "sum + vec4(1.)", "sum + vec4(2.)", "sum + vec4(3.)",
+        "sum + vec4(4.)", "sum + vec4(5.)", "sum + vec4(6.)", "sum + vec4(7.)"
+    };
+
+    macs::out *o[MAX_OUTPUTS];
+    for (int i = 0; i < no; i++)
+        o[i] = outputs[i];
+
+
+    macs::render *rnd;
+
+#define pass(...) \
+    new macs::render({ &p0, &p1, &p2, &p3, &p4, &p5, &p6, &p7 }, { __VA_ARGS__ }, "", sum.c_str(), \
+                     vals[0], vals[1], vals[2], vals[3], vals[4], vals[5], vals[6], vals[7])
+
+    switch (no)
+    {
+        case 1:  rnd = pass(o[0]); break;
+        case 2:  rnd = pass(o[0], o[1]); break;
+        case 3:  rnd = pass(o[0], o[1], o[2]); break;
+        case 4:  rnd = pass(o[0], o[1], o[2], o[3]); break;
+        case 5:  rnd = pass(o[0], o[1], o[2], o[3], o[4]); break;
+        case 6:  rnd = pass(o[0], o[1], o[2], o[3], o[4], o[5]); break;
+        case 7:  rnd = pass(o[0], o[1], o[2], o[3], o[4], o[5], o[6]); break;
+        default: rnd = pass(o[0], o[1], o[2], o[3], o[4], o[5], o[6], o[7]); break;
+    }
+
+#undef pass
+
+    for (int i = 0; i < ni; i++)
+        *rnd << inputs[i];
+
+    return rnd;
+}
+
+
+static void bench_passes(int res, bool discrete, uint64_t min_ns)
+{
+    int max_in = macs::max_input_textures(), max_out = 2 * macs::max_output_textures();
+
+    if (max_in > MAX_INPUTS)
+        max_in = MAX_INPUTS;
+    if (max_out > MAX_OUTPUTS)
+        max_out = MAX_OUTPUTS;
+
+
+    macs::texture *inputs[MAX_INPUTS], *outputs[MAX_OUTPUTS];
+    char name[8];
+
+    macs::formats::f0123 *data = new macs::formats::f0123[res * res];
+    for (int i = 0; i < res * res; i++)
+        data[i] = macs::formats::f0123({ i / 7.f, i / 5.f, i / 3.f, 1.f });
+
+    for (int i = 0; i < max_in; i++)
+    {
+        sprintf(name, "in%i", i);
+        inputs[i] = new macs::texture(name, discrete, res, res);
+        inputs[i]->write(data);
+    }
+
+    for (int i = 0; i < max_out; i++)
+    {
+        sprintf(name, "out%i", i);
+        outputs[i] = new macs::texture(name, discrete, res, res);
+    }
+
+    delete[] data;
+
+
+    for (int no = 1; no <= max_out; no *= 2)
+    {
+        for (int ni = 0; ni <= max_in; ni = ni ? ni * 2 : 1)
+        {
+            macs::render *rnd;
+
+            try
+            {
+                rnd = make_pass(inputs, ni, outputs, no);
+            }
+            catch (...)
+            {
+                printf("%5i %-9s %3i %3i   (could not create render object)\n", res, discrete ? "discrete" : "filtered", ni, no);
+                continue;
+            }
+
+
+            timing full = run(rnd, min_ns, false);
+            timing ovh  = run(rnd, min_ns, true);
+
+            delete rnd;
+
+
+            double bytes = static_cast<double>(ni + no) * res * res * 16.;
+            double ns = (full.gpu_ns > 0.) ? full.gpu_ns : full.wall_ns;
+
+            printf("%5i %-9s %3i %3i %12.0f ", res, discrete ? "discrete" : "filtered", ni, no, full.wall_ns);
+
+            if (full.gpu_ns >= 0.)
+                printf("%12.0f ", full.gpu_ns);
+            else
+                printf("%12s ", "n/a");
+
+            printf("%8.2f %12.0f %12.0f\n", bytes / ns, ovh.cpu_ns, ovh.wall_ns);
+            fflush(stdout);
+        }
+    }
+
+
+    for (int i = 0; i < max_in; i++)
+        delete inputs[i];
+
+    for (int i = 0; i < max_out; i++)
+        delete outputs[i];
+}
+
+
+template<typename T> static void bench_transfer(macs::texture *tex, int res, const char *fmt, int channels, uint64_t min_ns)
+{
+    T *buf = new T[res * res];
+    memset(buf, 0, sizeof(T) * res * res);
+
+    double bytes = static_cast<double>(res) * res * channels * sizeof(float);
+    double write_ns = 0., read_ns = 0.;
+
+    for (int iters = 1;; iters *= 2)
+    {
+        uint64_t start = now_ns();
+        for (int i = 0; i < iters; i++)
+            tex->write(buf);
+        glFinish();
+        uint64_t mid = now_ns();
+        for (int i = 0; i < iters; i++)
+            tex->read(buf);
+        uint64_t end = now_ns();
+
+        if ((end - start >= min_ns) || (iters >= (1 << 12)))
+        {
+            write_ns = static_cast<double>(mid - start) / iters;
+            read_ns  = static_cast<double>(end - mid) / iters;
+            break;
+        }
+    }
+
+    printf("%5i %-6s %14.0f %8.2f %14.0f %8.2f\n", res, fmt, write_ns, bytes / write_ns, read_ns, bytes / read_ns);
+    fflush(stdout);
+
+    delete[] buf;
+}
+
+
+extern "C" int main(int argc, char *argv[])
+{
+    int max_res = (argc > 1) ? atoi(argv[1]) : 1024;
+    uint64_t min_ns = ((argc > 2) ? atoi(argv[2]) : 100) * 1000000ULL;
+
+    if (max_res < 1)
+        max_res = 1024;
+
+
+    SDL_Init(SDL_INIT_VIDEO);
+
+    SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
+
+    SDL_SetVideoMode(64, 64, 32, SDL_OPENGL | SDL_DOUBLEBUF);
+
+
+    if (!macs::init(max_res, max_res))
+        return 1;
+
+
+    int maj, min;
+    macs::opengl_version(maj, min);
+
+    timer_queries = (maj > 3) || ((maj == 3) && (min >= 3));
+
+    printf("OpenGL %i.%i (%s, %s)\n", maj, min, glGetString(GL_VENDOR), glGetString(GL_RENDERER));
+    printf("%i output units, %i texture units, timer queries %savailable\n\n",
+           macs::max_output_textures(), macs::max_input_textures(), timer_queries ? "" : "not ");
+
+
+    printf("%5s %-9s %3s %3s %12s %12s %8s %12s %12s\n", "res", "filter", "in", "out", "ns/pass", "gpu ns/pass", "GB/s", "cpu ns/pass", "ovh ns/pass");
+
+    for (int res = 64; res <= max_res; res *= 4)
+        for (bool discrete: { true, false })
+            bench_passes(res, discrete, min_ns);
+
+
+    printf("\n%5s %-6s %14s %8s %14s %8s\n", "res", "format", "write ns", "GB/s", "read ns", "GB/s");
+
+    for (int res = 64; res <= max_res; res *= 4)
+    {
+        macs::texture tex("transfer", true, res, res);
+
+        bench_transfer<macs::formats::f0123>(&tex, res, "0123", 4, min_ns);
+        bench_transfer<macs::formats::f2103>(&tex, res, "2103", 4, min_ns);
+        bench_transfer<macs::formats::f012 >(&tex, res, "012",  3, min_ns);
+        bench_transfer<macs::formats::f210 >(&tex, res, "210",  3, min_ns);
+        bench_transfer<macs::formats::f0   >(&tex, res, "0",    1, min_ns);
+    }
+
+
+    return 0;
+}
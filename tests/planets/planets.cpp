@@ -113,25 +113,26 @@ macs::texture *tex_from_bitmap(const char *as, const char *path)
 class planet
 {
     public:
-        planet(betelgeuse::object &base, const char *color_bmp, const char *rp_bmp, float year, float day, float distance, float radius);
-        planet(betelgeuse::object &base, const char *color_bmp, float year, float day, float distance, float radius);
-        planet(betelgeuse::object &base, planet *parent, const char *color_bmp, float year, float day, float distance, float radius);
-        planet(betelgeuse::object &base, const char *ambient_bmp, float day, float radius);
+        planet(betelgeuse::scene &scene, betelgeuse::object &base, const char *color_bmp, const char *rp_bmp, float year, float day, float distance, float radius);
+        planet(betelgeuse::scene &scene, betelgeuse::object &base, const char *color_bmp, float year, float day, float distance, float radius);
+        planet(betelgeuse::scene &scene, betelgeuse::object &base, planet *parent, const char *color_bmp, float year, float day, float distance, float radius);
+        planet(betelgeuse::scene &scene, betelgeuse::object &base, const char *ambient_bmp, float day, float radius);
         ~planet(void);
 
         void update(float days_gone);
 
 
     private:
+        betelgeuse::scene &scn;
         betelgeuse::instance *inst;
-        macs::types::mat4 translated;
         float d, y;
         float dist, rad;
         planet *par;
 };
 
 
-planet::planet(betelgeuse::object &base, const char *color_bmp, const char *rp_bmp, float year, float day, float distance, float radius):
+planet::planet(betelgeuse::scene &scene, betelgeuse::object &base, const char *color_bmp, const char *rp_bmp, float year, float day, float distance, float radius):
+    scn(scene),
     d(day),
     y(year),
     dist(distance),
@@ -147,7 +148,8 @@ planet::planet(betelgeuse::object &base, const char *color_bmp, const char *rp_b
     inst->mat.layer[0].rp_texed = true;
 }
 
-planet::planet(betelgeuse::object &base, const char *color_bmp, float year, float day, float distance, float radius):
+planet::planet(betelgeuse::scene &scene, betelgeuse::object &base, const char *color_bmp, float year, float day, float distance, float radius):
+    scn(scene),
     d(day),
     y(year),
     dist(distance),
@@ -160,7 +162,8 @@ planet::planet(betelgeuse::object &base, const char *color_bmp, float year, floa
     inst->mat.layer[0].color_texed = true;
 }
 
-planet::planet(betelgeuse::object &base, planet *parent, const char *color_bmp, float year, float day, float distance, float radius):
+planet::planet(betelgeuse::scene &scene, betelgeuse::object &base, planet *parent, const char *color_bmp, float year, float day, float distance, float radius):
+    scn(scene),
     d(day),
     y(year),
     dist(distance),
@@ -168,16 +171,19 @@ planet::planet(betelgeuse::object &base, planet *parent, const char *color_bmp,
     par(parent)
 {
     inst = base.instantiate();
+    inst->set_parent(parent->inst);
 
     inst->mat.layer[0].color.tex = tex_from_bitmap("color0_tex", color_bmp);
     inst->mat.layer[0].color_texed = true;
 }
 
-planet::planet(betelgeuse::object &base, const char *ambient_bmp, float day, float radius):
+planet::planet(betelgeuse::scene &scene, betelgeuse::object &base, const char *ambient_bmp, float day, float radius):
+    scn(scene),
     d(day),
     y(1.f),
     dist(0.f),
-    rad(radius)
+    rad(radius),
+    par(NULL)
 {
     inst = base.instantiate();
 
@@ -190,41 +196,50 @@ planet::planet(betelgeuse::object &base, const char *ambient_bmp, float day, flo
 planet::~planet(void)
 {
     if (inst->mat.layer[0].color_texed)
+    {
+        scn.forget_material_texture(inst->mat.layer[0].color.tex);
         delete inst->mat.layer[0].color.tex;
+    }
 
     if (inst->mat.layer[0].rp_texed)
+    {
+        scn.forget_material_texture(inst->mat.layer[0].rp.tex);
         delete inst->mat.layer[0].rp.tex;
+    }
 
     if (inst->mat.ambient_texed)
+    {
+        scn.forget_material_texture(inst->mat.ambient.tex);
         delete inst->mat.ambient.tex;
+    }
 
     delete inst;
 }
 
 void planet::update(float days_gone)
 {
-    float z;
+    inst->reset_transformation();
 
-    if (par == NULL)
-    {
-        translated = macs::types::mat4();
-        z = -10.f;
-    }
-    else
+    if (par != NULL)
     {
-        translated = par->translated;
-        z = 0.f;
+        // The orbit is around the parent's center only, so undo its rotation
+        // and scale (the world transformation is the parent's times this)
+        inst->scale(macs::types::vec3(1.f / par->rad, 1.f / par->rad, 1.f / par->rad));
+        inst->rotate(-days_gone / par->d * 2.f * static_cast<float>(M_PI), macs::types::vec3(0.f, 1.f, 0.f));
+        inst->rotate(-static_cast<float>(M_PI_2), macs::types::vec3(1.f, 0.f, 0.f));
     }
 
-    translated.translate(macs::types::vec3(-dist * 5.f * sinf(days_gone / y * 2.f * static_cast<float>(M_PI)),
-                                            dist * 5.f * cosf(days_gone / y * 2.f * static_cast<float>(M_PI)),
-                                            z));
+    inst->translate(macs::types::vec3(-dist * 5.f * sinf(days_gone / y * 2.f * static_cast<float>(M_PI)),
+                                       dist * 5.f * cosf(days_gone / y * 2.f * static_cast<float>(M_PI)),
+                                       (par == NULL) ? -10.f : 0.f));
 
-    inst->trans = translated;
-    inst->trans.rotate(static_cast<float>(M_PI_2), macs::types::vec3(1.f, 0.f, 0.f));
-    inst->trans.rotate(days_gone / d * 2.f * static_cast<float>(M_PI), macs::types::vec3(0.f, 1.f, 0.f));
-    inst->trans.scale(macs::types::vec3(rad, rad, rad));
+    inst->rotate(static_cast<float>(M_PI_2), macs::types::vec3(1.f, 0.f, 0.f));
+    inst->rotate(days_gone / d * 2.f * static_cast<float>(M_PI), macs::types::vec3(0.f, 1.f, 0.f));
+    inst->scale(macs::types::vec3(rad, rad, rad));
 
+    // Uniform scale only, so the inverse does not need a general inversion.
+    // Only marks the earth and the moon, their world transformations are
+    // computed by the next render().
     inst->update_transformation();
 }
 
@@ -260,7 +275,7 @@ extern "C" int main(int argc, char *argv[])
 
     betelgeuse::object sphere(
         "if (length(cross(dir, start)) > length(dir))\n"
-        "    discard;\n\n"
+        "    return -1.;\n\n"
         "float a =  dot(dir  , dir  );\n"
         "float b =  dot(start, dir  )       / a;\n"
         "float c = (dot(start, start) - 1.) / a;\n\n"
@@ -269,7 +284,7 @@ extern "C" int main(int argc, char *argv[])
         "if (t1 < 0.)\n"
         "{\n"
         "    if (t2 < 0.)\n"
-        "        discard;\n"
+        "        return -1.;\n"
         "    return t2;\n"
         "}\n\n"
         "if ((t2 < 0.) || (t1 < t2))\n"
@@ -293,14 +308,14 @@ extern "C" int main(int argc, char *argv[])
     rts.new_object_type(&sphere);
 
 
-    planet mercury(sphere, "tests/planets/mercury.bmp", 87.969f, 58.65f, .3871f, .1f);
-    planet venus  (sphere, "tests/planets/venus.bmp", 224.701f, -243.019f, .723f, .3f);
-    planet earth  (sphere, "tests/planets/earth.bmp", "tests/planets/earth_spec.bmp", 365.256f, .9973f, 1.f, .3f);
-    planet mars   (sphere, "tests/planets/mars.bmp", 686.98f, 1.026f, 1.524f, .15f);
+    planet mercury(rts, sphere, "tests/planets/mercury.bmp", 87.969f, 58.65f, .3871f, .1f);
+    planet venus  (rts, sphere, "tests/planets/venus.bmp", 224.701f, -243.019f, .723f, .3f);
+    planet earth  (rts, sphere, "tests/planets/earth.bmp", "tests/planets/earth_spec.bmp", 365.256f, .9973f, 1.f, .3f);
+    planet mars   (rts, sphere, "tests/planets/mars.bmp", 686.98f, 1.026f, 1.524f, .15f);
 
-    planet moon(sphere, &earth, "tests/planets/moon.bmp", 27.3217f, 27.3217f, .15f, .08f);
+    planet moon(rts, sphere, &earth, "tests/planets/moon.bmp", 27.3217f, 27.3217f, .15f, .08f);
 
-    planet sun(sphere, "tests/planets/sun.bmp", 25.38f, .5f);
+    planet sun(rts, sphere, "tests/planets/sun.bmp", 25.38f, .5f);
 
 
     struct timeval tv_start, tv_end, tv_cur, tv_last;
@@ -0,0 +1,241 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <time.h>
+#include <vector>
+
+#include <SDL/SDL.h>
+
+#include <macs/macs.hpp>
+
+
+/*
+ * MACS sort benchmark.
+ *
+ * Sorts random key/payload textures of increasing size and prints one line
+ * per size:
+ *
+ *   bitonic ns   Wall clock time of the bitonic sort (render passes).
+ *   radix ns     Wall clock time of the radix sort (compute shaders, if
+ *                available).
+ *   cpu ns       Wall clock time of reading the texture back and sorting it
+ *                with std::sort (by key).
+ *
+ * Every GPU result is checked against the std::sort result (keys in order,
+ * payload carried along). Sorting on other key channels (with the payload
+ * in channel 0) and in descending order is checked as well, but not
+ * timed.
+ *
+ * Usage: test_sortbench [max resolution [min time per measurement in ms]]
+ *
+ * To run headless (e.g. on llvmpipe), start it inside a virtual X server:
+ *   LIBGL_ALWAYS_SOFTWARE=1 xvfb-run tests/test_sortbench
+ */
+
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static bool by_key(const macs::formats::f0123 &a, const macs::formats::f0123 &b)
+{
+    return a.r < b.r;
+}
+
+
+/**
+ * Creates w * h random elements with their key in channel key and their
+ * index in channel 0 (channel 1 if key is 0) as the payload.
+ */
+static std::vector<macs::formats::f0123> make_data(int w, int h, int key)
+{
+    std::vector<macs::formats::f0123> data(w * h);
+    int payload = key ? 0 : 1;
+
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = macs::formats::f0123({ 0.f, 1.f, 2.f, 3.f });
+
+        data[i]._f[key] = (rand() % 20000 - 10000) / 7.f;
+        data[i]._f[payload] = static_cast<float>(i);
+    }
+
+    return data;
+}
+
+
+/**
+ * Checks whether the keys are sorted and every element arrived unchanged
+ * (i.e., the payload has been carried along with its key).
+ */
+static bool check(macs::sort *srt, const std::vector<macs::formats::f0123> &data, int key, bool descending)
+{
+    std::vector<macs::formats::f0123> res(data.size()), ref(data);
+    const_cast<macs::texture *>(srt->output())->read(res.data());
+
+    std::stable_sort(ref.begin(), ref.end(), [=](const macs::formats::f0123 &a, const macs::formats::f0123 &b)
+                     { return descending ? (a._f[key] > b._f[key]) : (a._f[key] < b._f[key]); });
+
+    int payload = key ? 0 : 1;
+    std::vector<bool> seen(data.size(), false);
+
+    for (size_t i = 0; i < res.size(); i++)
+    {
+        if (res[i]._f[key] != ref[i]._f[key])
+            return false;
+
+        size_t index = static_cast<size_t>(res[i]._f[payload]);
+
+        if ((index >= data.size()) || seen[index] || memcmp(&res[i], &data[index], sizeof(res[i])))
+            return false;
+
+        seen[index] = true;
+    }
+
+    return true;
+}
+
+
+static double time_gpu(macs::sort *srt, macs::texture *tex, uint64_t min_ns)
+{
+    // Warm up (shader compilation etc.)
+    (*srt)(tex);
+    glFinish();
+
+    for (int iters = 1;; iters *= 2)
+    {
+        uint64_t start = now_ns();
+
+        for (int i = 0; i < iters; i++)
+            (*srt)(tex);
+        glFinish();
+
+        uint64_t wall = now_ns() - start;
+
+        if ((wall >= min_ns) || (iters >= (1 << 12)))
+            return static_cast<double>(wall) / iters;
+    }
+}
+
+
+static double time_cpu(macs::texture *tex, std::vector<macs::formats::f0123> &buf, uint64_t min_ns)
+{
+    for (int iters = 1;; iters *= 2)
+    {
+        uint64_t start = now_ns();
+
+        for (int i = 0; i < iters; i++)
+        {
+            tex->read(buf.data());
+            std::sort(buf.begin(), buf.end(), by_key);
+        }
+
+        uint64_t wall = now_ns() - start;
+
+        if ((wall >= min_ns) || (iters >= (1 << 12)))
+            return static_cast<double>(wall) / iters;
+    }
+}
+
+
+extern "C" int main(int argc, char *argv[])
+{
+    int max_res = (argc > 1) ? atoi(argv[1]) : 1024;
+    uint64_t min_ns = ((argc > 2) ? atoi(argv[2]) : 100) * 1000000ULL;
+
+    if (max_res < 1)
+        max_res = 1024;
+
+
+    SDL_Init(SDL_INIT_VIDEO);
+
+    SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
+
+    SDL_SetVideoMode(64, 64, 32, SDL_OPENGL | SDL_DOUBLEBUF);
+
+
+    if (!macs::init(max_res, max_res))
+        return 1;
+
+
+    bool ok = true;
+
+    printf("%5s %9s %14s %14s %14s\n", "res", "elements", "bitonic ns", "radix ns", "cpu ns");
+
+    for (int res = 16; res <= max_res; res *= 4)
+    {
+        // Non-square and not a power of two, to exercise the edge handling
+        int w = res, h = res - res / 4;
+
+        srand(res);
+        std::vector<macs::formats::f0123> data = make_data(w, h, 0);
+
+        macs::texture tex("keys", true, w, h);
+        tex.write(data.data());
+
+
+        macs::sort bitonic(0, false, w, h), radix(0, false, w, h);
+
+        double bitonic_ns = time_gpu(&bitonic, &tex, min_ns);
+        ok &= check(&bitonic, data, 0, false);
+
+        double radix_ns = -1.;
+        if (radix.use_compute())
+        {
+            radix_ns = time_gpu(&radix, &tex, min_ns);
+            ok &= check(&radix, data, 0, false);
+        }
+
+
+        // Other key channels and descending order (checked only)
+        static const struct { int key; bool descending; } variants[] = {
+            { 2, false }, { 0, true }, { 3, true }
+        };
+
+        for (auto &v: variants)
+        {
+            std::vector<macs::formats::f0123> vdata = make_data(w, h, v.key);
+
+            macs::texture vtex("keys", true, w, h);
+            vtex.write(vdata.data());
+
+            macs::sort vbitonic(v.key, v.descending, w, h), vradix(v.key, v.descending, w, h);
+
+            vbitonic(&vtex);
+            ok &= check(&vbitonic, vdata, v.key, v.descending);
+
+            if (vradix.use_compute())
+            {
+                vradix(&vtex);
+                ok &= check(&vradix, vdata, v.key, v.descending);
+            }
+        }
+
+
+        double cpu_ns = time_cpu(&tex, data, min_ns);
+
+
+        printf("%5i %9i %14.0f ", res, w * h, bitonic_ns);
+
+        if (radix_ns >= 0.)
+            printf("%14.0f ", radix_ns);
+        else
+            printf("%14s ", "n/a");
+
+        printf("%14.0f\n", cpu_ns);
+        fflush(stdout);
+    }
+
+
+    if (!ok)
+        printf("\nSorting FAILED.\n");
+
+    return ok ? 0 : 1;
+}
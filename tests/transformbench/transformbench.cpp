@@ -0,0 +1,277 @@
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <time.h>
+#include <vector>
+
+#include <betelgeuse/betelgeuse.hpp>
+
+
+/*
+ * Betelgeuse instance transformation benchmark.
+ *
+ * Updates the transformations of many instances and prints one line per
+ * method:
+ *
+ *   ns/instance  Time per instance (best of all runs).
+ *   max error    Largest difference of the inverse and normal matrices to
+ *                the ones update_transformation() computes (relative to the
+ *                largest element of the matrix).
+ *
+ * Methods:
+ *
+ *   single       trans = ...; update_transformation() per instance (as a
+ *                general transformation).
+ *   rigid        Like single, but with rotation and translation only, and
+ *                the structure set accordingly (the error is relative to
+ *                the general inversion).
+ *   uniform      Same with uniform scaling.
+ *   affine       Same with the transformations from single.
+ *   batch N      instance::update_transformations() with a mat4 per
+ *                instance, on up to N threads.
+ *   trs N        instance::update_transformations() with translation,
+ *                rotation (quaternion) and scale per instance.
+ *   tree 1/N     All instances form a hierarchy (four children per
+ *                instance); every N-th instance is changed and
+ *                instance::update_world() recomputes the changed subtrees.
+ *                The time is per instance in the tree, the error is
+ *                relative to the product of all local transformations.
+ *
+ * Usage: test_transformbench [instances [min time per measurement in ms]]
+ *
+ * No OpenGL context is needed.
+ */
+
+
+using namespace betelgeuse;
+using namespace macs::types;
+
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static float frand(void)
+{
+    return rand() / static_cast<float>(RAND_MAX) * 2.f - 1.f;
+}
+
+
+/// Repeats fn until min_ns have passed; returns the best ns per instance.
+template<typename F> static double measure(size_t count, uint64_t min_ns, F fn)
+{
+    uint64_t start = now_ns(), best = UINT64_MAX;
+
+    do
+    {
+        uint64_t t = now_ns();
+        fn();
+        t = now_ns() - t;
+
+        if (t < best)
+            best = t;
+    }
+    while (now_ns() - start < min_ns);
+
+    return static_cast<double>(best) / count;
+}
+
+
+static float rel_error(const float *a, const float *b, int count)
+{
+    float scale = 0.f, err = 0.f;
+
+    for (int i = 0; i < count; i++)
+    {
+        scale = fmaxf(scale, fabsf(b[i]));
+        err = fmaxf(err, fabsf(a[i] - b[i]));
+    }
+
+    return err / scale;
+}
+
+
+/// Compares every instance's matrices to the reference ones.
+static float check(const std::vector<instance *> &insts, const std::vector<mat4> &ref_trans,
+                   const std::vector<mat4> &ref_inv, const std::vector<mat3> &ref_normal)
+{
+    float err = 0.f;
+
+    for (size_t i = 0; i < insts.size(); i++)
+    {
+        err = fmaxf(err, rel_error(insts[i]->trans.d, ref_trans[i].d, 16));
+        err = fmaxf(err, rel_error(insts[i]->inverse_transformation().d, ref_inv[i].d, 16));
+        err = fmaxf(err, rel_error(insts[i]->normal_matrix().d, ref_normal[i].d, 9));
+    }
+
+    return err;
+}
+
+
+extern "C" int main(int argc, char *argv[])
+{
+    size_t count = (argc > 1) ? atoi(argv[1]) : 16384;
+    uint64_t min_ns = ((argc > 2) ? atoi(argv[2]) : 200) * 1000000ULL;
+    int hw = std::thread::hardware_concurrency();
+
+    object obj("return -1.;", "return false;", "return vec2(0., 0.);", "return vec3(0., 0., 1.);");
+
+    std::vector<instance *> insts(count);
+    std::vector<mat4> trans(count), rigid_trans(count), uniform_trans(count);
+    std::vector<vec3> translation(count), scale(count);
+    std::vector<vec4> rotation(count);
+
+    srand(42);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        insts[i] = obj.instantiate();
+
+        vec3 axis = vec3(frand(), frand(), frand() + 2.f).normed();
+        float angle = frand() * 3.f, sh = sinf(angle * .5f);
+
+        translation[i] = vec3(frand() * 10.f, frand() * 10.f, frand() * 10.f);
+        rotation[i] = vec4(axis.x * sh, axis.y * sh, axis.z * sh, cosf(angle * .5f));
+        scale[i] = vec3(frand() + 1.5f, frand() + 1.5f, frand() + 1.5f);
+
+        trans[i].translate(translation[i]);
+        trans[i].rotate(angle, axis);
+
+        rigid_trans[i] = uniform_trans[i] = trans[i];
+        uniform_trans[i].scale(vec3(scale[i].x, scale[i].x, scale[i].x));
+
+        trans[i].scale(scale[i]);
+    }
+
+    printf("%zu instances, %i hardware threads\n\n", count, hw);
+    printf("%-12s %12s %12s\n", "method", "ns/instance", "max error");
+
+
+    printf("%-12s %12.2f %12s\n", "single",
+           measure(count, min_ns, [&]() {
+               for (size_t i = 0; i < count; i++)
+               {
+                   insts[i]->trans = trans[i];
+                   insts[i]->update_transformation();
+               }
+           }), "-");
+
+    std::vector<mat4> ref_trans(count), ref_inv(count);
+    std::vector<mat3> ref_normal(count);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        ref_trans[i] = insts[i]->trans;
+        ref_inv[i] = insts[i]->inverse_transformation();
+        ref_normal[i] = insts[i]->normal_matrix();
+    }
+
+    float err;
+
+    struct { const char *name; instance::transform_structure structure; const std::vector<mat4> &m; } kinds[] = {
+        { "rigid",   instance::rigid,         rigid_trans   },
+        { "uniform", instance::uniform_scale, uniform_trans },
+        { "affine",  instance::affine,        trans         }
+    };
+
+    for (auto &k: kinds)
+    {
+        double ns = measure(count, min_ns, [&]() {
+            for (size_t i = 0; i < count; i++)
+            {
+                insts[i]->set_transformation(k.m[i], k.structure);
+                insts[i]->update_transformation();
+            }
+        });
+
+        err = 0.f;
+
+        for (size_t i = 0; i < count; i++)
+        {
+            mat4 inv = k.m[i].inv();
+            mat3 normal(inv.transposed());
+
+            err = fmaxf(err, rel_error(insts[i]->inverse_transformation().d, inv.d, 16));
+            err = fmaxf(err, rel_error(insts[i]->normal_matrix().d, normal.d, 9));
+        }
+
+        printf("%-12s %12.2f %12g\n", k.name, ns, err);
+    }
+
+    for (int threads = 1; threads <= hw; threads *= 2)
+    {
+        char name[16];
+        sprintf(name, "batch %i", threads);
+
+        double ns = measure(count, min_ns, [&]() { instance::update_transformations(insts.data(), trans.data(), count, threads); });
+        err = check(insts, ref_trans, ref_inv, ref_normal);
+
+        printf("%-12s %12.2f %12g\n", name, ns, err);
+    }
+
+    for (int threads = 1; threads <= hw; threads *= 2)
+    {
+        char name[16];
+        sprintf(name, "trs %i", threads);
+
+        double ns = measure(count, min_ns, [&]() {
+            instance::update_transformations(insts.data(), translation.data(), rotation.data(), scale.data(), count, threads);
+        });
+        err = check(insts, ref_trans, ref_inv, ref_normal);
+
+        printf("%-12s %12.2f %12g\n", name, ns, err);
+    }
+
+
+    // Reference world transformations (parents precede their children)
+    for (size_t i = 0; i < count; i++)
+    {
+        insts[i]->trans = trans[i];
+
+        if (i > 0)
+            insts[i]->set_parent(insts[(i - 1) / 4]);
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        ref_trans[i] = (i > 0) ? ref_trans[(i - 1) / 4] * trans[i] : trans[i];
+        ref_inv[i] = ref_trans[i].inv();
+        ref_normal[i] = mat3(ref_inv[i].transposed());
+    }
+
+    for (int n: { 1, 16, 256 })
+    {
+        char name[16];
+        sprintf(name, "tree 1/%i", n);
+
+        double ns = measure(count, min_ns, [&]() {
+            for (size_t i = n - 1; i < count; i += n)
+                insts[i]->update_transformation();
+
+            insts[0]->update_world();
+        });
+
+        err = 0.f;
+
+        for (size_t i = 0; i < count; i++)
+        {
+            err = fmaxf(err, rel_error(insts[i]->world_transformation().d, ref_trans[i].d, 16));
+            err = fmaxf(err, rel_error(insts[i]->inverse_transformation().d, ref_inv[i].d, 16));
+            err = fmaxf(err, rel_error(insts[i]->normal_matrix().d, ref_normal[i].d, 9));
+        }
+
+        printf("%-12s %12.2f %12g\n", name, ns, err);
+    }
+
+    for (size_t i = count; i-- > 0;)
+        delete insts[i];
+
+    return 0;
+}